@@ -0,0 +1,451 @@
+/**
+ * \file
+ * \brief     Interpreter benchmarks.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ *
+ * Runs a set of classic interpreter workloads, each in a forked
+ * process of its own, and reports the time and allocations per
+ * operation and the peak RSS as JSON. Given a baseline (the JSON
+ * output of an earlier run), it also reports the differences, and
+ * fails on regressions.
+ *
+ * The time per operation is the best of a few rounds of iterations,
+ * to filter out noise from the rest of the system. Allocations are
+ * counted with the interpreter statistics (see stats.hh), which are on
+ * for all benchmarks.
+ */
+#include "matig.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Benchmark {
+    const char *name;
+    const char *setup;      ///< Evaluated once.
+    const char *operation;  ///< Evaluated once per iteration.
+    const char *expected;   ///< The printed result of the operation.
+    unsigned    iterations;
+};
+
+const Benchmark benchmarks[] = {
+    { "fib",
+      "(set 'fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))",
+      "(fib 15)", "610", 20 },
+
+    { "tak",
+      "(set 'tak (lambda (x y z)"
+      "  (if (not (< y x))"
+      "      z"
+      "      (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)))))",
+      "(tak 12 8 4)", "5", 20 },
+
+    { "nqueens",
+      "(set 'safe? (lambda (row dist placed)"
+      "  (if (not placed) t"
+      "    (if (= (car placed) row) nil"
+      "      (if (= (car placed) (+ row dist)) nil"
+      "        (if (= (car placed) (- row dist)) nil"
+      "          (safe? row (+ dist 1) (cdr placed))))))))"
+      "(set 'try-rows (lambda (row n k placed)"
+      "  (if (= row n) 0"
+      "    (+ (if (safe? row 1 placed) (queens n (+ k 1) (cons row placed)) 0)"
+      "       (try-rows (+ row 1) n k placed)))))"
+      "(set 'queens (lambda (n k placed) (if (= k n) 1 (try-rows 0 n k placed))))",
+      "(queens 6 0 nil)", "4", 10 },
+
+    { "ackermann",
+      "(set 'ack (lambda (m n)"
+      "  (if (zero? m) (+ n 1)"
+      "    (if (zero? n) (ack (- m 1) 1)"
+      "      (ack (- m 1) (ack m (- n 1)))))))",
+      "(ack 2 9)", "21", 50 },
+
+    { "list-build",
+      "(set 'build (lambda (n acc) (if (zero? n) acc (build (- n 1) (cons n acc)))))",
+      "(car (build 500 nil))", "1", 100 },
+
+    { "list-reverse",
+      "(set 'build (lambda (n acc) (if (zero? n) acc (build (- n 1) (cons n acc)))))"
+      "(set 'rev (lambda (xs acc) (if xs (rev (cdr xs) (cons (car xs) acc)) acc)))"
+      "(set 'xs (build 500 nil))",
+      "(car (rev xs nil))", "500", 100 },
+
+    { "list-sum",
+      "(set 'build (lambda (n acc) (if (zero? n) acc (build (- n 1) (cons n acc)))))"
+      "(set 'sum (lambda (xs acc) (if xs (sum (cdr xs) (+ acc (car xs))) acc)))"
+      "(set 'xs (build 500 nil))",
+      "(sum xs 0)", "125250", 100 },
+
+    { "deep-recursion",
+      "(set 'depth (lambda (n) (if (zero? n) 0 (+ 1 (depth (- n 1))))))",
+      "(depth 1000)", "1000", 100 },
+
+    { "closures",
+      "(set 'make-adder (lambda (n) (lambda (x) (+ x n))))"
+      "(set 'closures (lambda (n acc)"
+      "  (if (zero? n) acc"
+      "    (closures (- n 1) (let ((f (make-adder n))) (f acc))))))",
+      "(closures 500 0)", "125250", 100 },
+
+    { "string-concat",
+      "(set 'repeat (lambda (n s) (if (zero? n) s (repeat (- n 1) (concat s \"abcd\")))))"
+      "(set 'concat-test (lambda (n) (repeat n \"\") t))",
+      "(concat-test 500)", "t", 100 },
+
+    // Many wakeups on a channel that is almost always full or empty.
+    // A lost wakeup hangs this benchmark, until the timeout kills it.
+    { "channel-stress",
+      "(set 'c (chan 1))"
+      "(set 'sender (lambda (n)"
+      "  (if (zero? n) t (let ((sent (send c n))) (sender (- n 1))))))"
+      "(set 'receiver (lambda (n acc)"
+      "  (if (zero? n) acc (receiver (- n 1) (+ acc (recv c))))))"
+      "(set 'sum (lambda (xs) (if xs (+ (car xs) (sum (cdr xs))) 0)))"
+      "(set 'stress (lambda ()"
+      "  (let ((senders   (list (go (sender 100)) (go (sender 100))"
+      "                         (go (sender 100)) (go (sender 100))))"
+      "        (receivers (list (go (receiver 100 0)) (go (receiver 100 0))"
+      "                         (go (receiver 100 0)) (go (receiver 100 0)))))"
+      "    (await-all senders)"
+      "    (sum (await-all receivers)))))",
+      "(stress)", "20200", 20 },
+};
+
+/// Benchmarks that take longer than this (in seconds) are killed.
+constexpr unsigned timeout = 120;
+
+constexpr unsigned rounds = 5;
+
+struct Options {
+    unsigned    iterations = 0; ///< 0 to use each benchmark's own count.
+    std::string filter;
+    std::string outputPath;
+    std::string baselinePath;
+    double      threshold = 10;
+};
+
+/**
+ * \brief Measurements, as passed from the child process.
+ */
+struct Result {
+    bool     ok;
+    uint64_t iterations;
+    double   nsPerOp;
+    double   allocsPerOp;
+    long     peakRssKb;
+    char     error[256];
+};
+
+/**
+ * \brief Run a benchmark in the current process.
+ */
+Result measure(const Benchmark &benchmark, unsigned iterations) {
+    Result result;
+    memset(&result, 0, sizeof(result));
+    result.iterations = iterations;
+
+    try {
+        matig::Interpreter interp;
+        interp.eval(benchmark.setup);
+
+        matig::Value expr = matig::read(benchmark.operation);
+
+        // One untimed run, which also checks the result.
+        std::string value = interp.eval(expr).repr();
+        if (value != benchmark.expected)
+            throw ProgramError("Expected "s + benchmark.expected + ", got " + value);
+
+        uint64_t allocsBefore = stats::totals().counts[(size_t)stats::Counter::OBJECT_ALLOCS];
+        double   best         = 0;
+
+        for (unsigned round = 0; round < rounds; round++) {
+            auto start = std::chrono::steady_clock::now();
+
+            for (unsigned i = 0; i < iterations; i++)
+                interp.eval(expr);
+
+            double ns = std::chrono::duration<double, std::nano>(
+                            std::chrono::steady_clock::now() - start).count();
+            best = round ? std::min(best, ns) : ns;
+        }
+
+        uint64_t allocsAfter = stats::totals().counts[(size_t)stats::Counter::OBJECT_ALLOCS];
+
+        result.nsPerOp     = best / iterations;
+        result.allocsPerOp = (double)(allocsAfter - allocsBefore) / (rounds * iterations);
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        result.peakRssKb = usage.ru_maxrss;
+        result.ok        = true;
+
+    } catch (std::exception &e) {
+        snprintf(result.error, sizeof(result.error), "%s", e.what());
+    }
+
+    return result;
+}
+
+/**
+ * \brief Run a benchmark in a forked child, so that it starts from a
+ *        clean heap and has its own peak RSS.
+ */
+Result measureIsolated(const Benchmark &benchmark, unsigned iterations) {
+    Result result;
+    memset(&result, 0, sizeof(result));
+
+    int fds[2];
+    if (pipe(fds)) {
+        snprintf(result.error, sizeof(result.error), "pipe: %s", strerror(errno));
+        return result;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        snprintf(result.error, sizeof(result.error), "fork: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return result;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        alarm(timeout);
+        Result childResult = measure(benchmark, iterations);
+        ssize_t written = write(fds[1], &childResult, sizeof(childResult));
+        _exit(written == sizeof(childResult) ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    size_t got = 0;
+    while (got < sizeof(result)) {
+        ssize_t n = read(fds[0], reinterpret_cast<char*>(&result) + got,
+                         sizeof(result) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    if (got != sizeof(result)) {
+        memset(&result, 0, sizeof(result));
+        if (WIFSIGNALED(status))
+            snprintf(result.error, sizeof(result.error),
+                     "Killed by signal %d", WTERMSIG(status));
+        else
+            snprintf(result.error, sizeof(result.error), "No result");
+    }
+
+    return result;
+}
+
+struct Baseline {
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+/**
+ * \brief Read the results of an earlier run.
+ *
+ * Relies on the output format having one benchmark per line.
+ */
+std::map<std::string, Baseline> readBaseline(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw ProgramError("Could not open baseline '"s + path + "'");
+
+    std::regex name  ("\"name\": \"([^\"]*)\"");
+    std::regex time  ("\"ns_per_op\": ([0-9.eE+-]+)");
+    std::regex allocs("\"allocs_per_op\": ([0-9.eE+-]+)");
+
+    std::map<std::string, Baseline> baseline;
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::smatch nameMatch, timeMatch, allocsMatch;
+        if (std::regex_search(line, nameMatch,   name)
+            && std::regex_search(line, timeMatch,   time)
+            && std::regex_search(line, allocsMatch, allocs))
+            baseline[nameMatch[1]] = { std::stod(timeMatch[1]),
+                                       std::stod(allocsMatch[1]) };
+    }
+
+    return baseline;
+}
+
+/**
+ * \brief Compare results against a baseline, on stderr.
+ *
+ * \return false if anything regressed
+ */
+bool compare(const std::vector<std::pair<const Benchmark*, Result>> &results,
+             const std::map<std::string, Baseline> &baseline,
+             double threshold) {
+
+    bool ok = true;
+
+    std::cerr << std::left  << std::setw(16) << "benchmark"
+              << std::right << std::setw(14) << "base ns/op"
+                            << std::setw(14) << "ns/op"
+                            << std::setw(9)  << "change"
+                            << std::setw(14) << "base allocs"
+                            << std::setw(14) << "allocs/op" << "\n";
+
+    for (auto &entry : results) {
+        auto it = baseline.find(entry.first->name);
+        if (it == baseline.end() || !entry.second.ok)
+            continue;
+
+        const Baseline &base = it->second;
+        const Result   &now  = entry.second;
+
+        double change = (now.nsPerOp / base.nsPerOp - 1) * 100;
+
+        // Allocation counts are deterministic: any real increase is a
+        // regression.
+        bool slower     = change > threshold;
+        bool moreAllocs = now.allocsPerOp > base.allocsPerOp * 1.001 + 0.5;
+
+        std::cerr << std::left  << std::setw(16) << entry.first->name
+                  << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(14) << base.nsPerOp
+                  << std::setw(14) << now.nsPerOp
+                  << std::setw(8)  << std::showpos << std::setprecision(1) << change
+                  << std::noshowpos << "%"
+                  << std::setw(14) << base.allocsPerOp
+                  << std::setw(14) << now.allocsPerOp
+                  << (slower     ? "  SLOWER"      : "")
+                  << (moreAllocs ? "  MORE ALLOCS" : "") << "\n";
+
+        if (slower || moreAllocs)
+            ok = false;
+    }
+
+    return ok;
+}
+
+void printUsage(const char *argv0) {
+    std::cerr << "usage: " << argv0
+              << " [--list] [--filter SUBSTRING] [--iterations N] [--output FILE]"
+                 " [--baseline FILE [--threshold PERCENT]]\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool haveValue = i + 1 < argc;
+
+        if (arg == "--list") {
+            for (auto &benchmark : benchmarks)
+                std::cout << benchmark.name << "\n";
+            return 0;
+
+        } else if (arg == "--filter" && haveValue) {
+            options.filter = argv[++i];
+        } else if (arg == "--iterations" && haveValue && atoi(argv[i + 1]) > 0) {
+            options.iterations = atoi(argv[++i]);
+        } else if (arg == "--output" && haveValue) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--baseline" && haveValue) {
+            options.baselinePath = argv[++i];
+        } else if (arg == "--threshold" && haveValue && atof(argv[i + 1]) > 0) {
+            options.threshold = atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, Baseline> baseline;
+    if (options.baselinePath.length()) {
+        try {
+            baseline = readBaseline(options.baselinePath);
+        } catch (ProgramError &e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Before any expression exists, for the live object counts.
+    stats::start();
+
+    std::vector<std::pair<const Benchmark*, Result>> results;
+    bool failed = false;
+
+    for (auto &benchmark : benchmarks) {
+        if (std::string(benchmark.name).find(options.filter) == std::string::npos)
+            continue;
+
+        Result result = measureIsolated(benchmark,
+                                        options.iterations
+                                        ? options.iterations
+                                        : benchmark.iterations);
+        if (!result.ok) {
+            std::cerr << benchmark.name << ": " << result.error << "\n";
+            failed = true;
+        }
+
+        results.emplace_back(&benchmark, result);
+    }
+
+    std::ostringstream json;
+    json << "{\"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i].second;
+
+        json << "  {\"name\": \"" << results[i].first->name << "\"";
+        if (result.ok)
+            json << ", \"iterations\": "    << result.iterations
+                 << ", \"ns_per_op\": "     << std::fixed << std::setprecision(1) << result.nsPerOp
+                 << ", \"allocs_per_op\": " << result.allocsPerOp
+                 << ", \"peak_rss_kb\": "   << result.peakRssKb;
+        else
+            json << ", \"error\": \"failed\"";
+        json << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "]}\n";
+
+    if (options.outputPath.length()) {
+        std::ofstream out(options.outputPath);
+        out << json.str();
+        if (!out) {
+            std::cerr << "Could not write '" << options.outputPath << "'\n";
+            return 1;
+        }
+    } else {
+        std::cout << json.str();
+    }
+
+    if (options.baselinePath.length()
+        && !compare(results, baseline, options.threshold))
+        failed = true;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,392 @@
+/**
+ * \file
+ * \brief     Reader and printer throughput benchmarks.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ *
+ * Generates synthetic corpora of s-expressions (wide flat lists,
+ * deeply nested lists, and lists heavy on strings, symbols or
+ * numbers), and measures the throughput of read(), repr() and print()
+ * on them, and the number of allocations the reader makes per node.
+ * Results are written as JSON, one corpus per line.
+ */
+#include "read.hh"
+#include "print.hh"
+#include "stats.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace {
+
+struct Options {
+    size_t      size     = 4 << 20; ///< Approximate corpus size in bytes.
+    unsigned    depth    = 200;     ///< Nesting depth of the nested corpus.
+    unsigned    rounds   = 5;
+    uint64_t    seed     = 1;
+    std::string filter;
+    std::string outputPath;
+    std::string dumpPath;
+};
+
+/**
+ * \brief Writes random s-expressions.
+ */
+class Generator {
+
+    std::mt19937_64     random;
+    std::ostringstream  out;
+
+public:
+    unsigned uniform(unsigned low, unsigned high) {
+        return std::uniform_int_distribution<unsigned>(low, high)(random);
+    }
+
+    void symbol() {
+        static const char first[] = "abcdefghijklmnopqrstuvwxyz*+-<>=!?";
+        static const char rest[]  = "abcdefghijklmnopqrstuvwxyz0123456789-*?!";
+
+        out << first[uniform(0, sizeof(first) - 2)];
+        for (unsigned i = uniform(2, 11); i; i--)
+            out << rest[uniform(0, sizeof(rest) - 2)];
+    }
+
+    void number() {
+        // Mostly small numbers, as in real data.
+        if (uniform(0, 3))
+            out << uniform(0, 999);
+        else
+            out << std::uniform_int_distribution<int64_t>(0, INT64_MAX)(random);
+    }
+
+    void string() {
+        out << '"';
+        for (unsigned i = uniform(0, 40); i; i--) {
+            unsigned c = uniform(0, 99);
+            if (c == 0)
+                out << "\\\"";
+            else if (c == 1)
+                out << "\\n";
+            else if (c < 15)
+                out << ' ';
+            else
+                out << (char)uniform('a', 'z');
+        }
+        out << '"';
+    }
+
+    /**
+     * \brief Write a list of N atoms written by ATOM.
+     */
+    template<typename F>
+    void list(unsigned n, F atom) {
+        out << '(';
+        for (unsigned i = 0; i < n; i++) {
+            if (i)
+                out << ' ';
+            atom();
+        }
+        out << ")\n";
+    }
+
+    void nested(unsigned depth) {
+        for (unsigned i = 0; i < depth; i++) {
+            out << '(';
+            symbol();
+            out << ' ';
+            number();
+            out << ' ';
+        }
+        out << "nil";
+        for (unsigned i = 0; i < depth; i++)
+            out << ')';
+        out << '\n';
+    }
+
+    size_t size() { return out.tellp(); }
+    std::string take() { return out.str(); }
+
+    Generator(uint64_t seed)
+        : random(seed)
+        { }
+};
+
+struct Corpus {
+    const char *name;
+    void (*generate)(Generator &gen, const Options &options);
+};
+
+const Corpus corpora[] = {
+    { "flat",
+      [](Generator &gen, const Options &options) {
+          // Wide lists, kept short enough for the recursive destruction
+          // of their cdr chains.
+          while (gen.size() < options.size) {
+              gen.list(10000, [&]{
+                  if (gen.uniform(0, 1))
+                      gen.number();
+                  else
+                      gen.symbol();
+              });
+          }
+      } },
+
+    { "nested",
+      [](Generator &gen, const Options &options) {
+          while (gen.size() < options.size)
+              gen.nested(options.depth);
+      } },
+
+    { "strings",
+      [](Generator &gen, const Options &options) {
+          while (gen.size() < options.size)
+              gen.list(100, [&]{ gen.string(); });
+      } },
+
+    { "symbols",
+      [](Generator &gen, const Options &options) {
+          while (gen.size() < options.size)
+              gen.list(100, [&]{ gen.symbol(); });
+      } },
+
+    { "numbers",
+      [](Generator &gen, const Options &options) {
+          while (gen.size() < options.size)
+              gen.list(100, [&]{ gen.number(); });
+      } },
+};
+
+/**
+ * \brief Discards output.
+ */
+class NullBuf : public std::streambuf {
+    char buffer[4096];
+
+protected:
+    int_type overflow(int_type c) override {
+        setp(buffer, buffer + sizeof(buffer));
+        return traits_type::not_eof(c);
+    }
+
+public:
+    NullBuf() {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+};
+
+size_t countNodes(const Expr *expr) {
+    size_t count = 0;
+
+    // Iterate over cdrs, so that wide lists need no deep recursion.
+    while (expr->type() == Expr::Type::CONS) {
+        auto cons = static_cast<const ConsExpr*>(expr);
+        count += 1 + countNodes(cons->getCar().get());
+        expr = cons->getCdr().get();
+    }
+
+    return count + 1;
+}
+
+uint64_t allocations() {
+    return stats::totals().counts[(size_t)stats::Counter::OBJECT_ALLOCS];
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Result {
+    size_t bytes;
+    size_t nodes;
+    size_t printedBytes;
+    double readMBs;
+    double reprMBs;
+    double printMBs;
+    double allocsPerNode;
+};
+
+/**
+ * \brief Measure one corpus, taking the best of a few rounds.
+ */
+Result measure(const std::string &source, unsigned rounds) {
+    Result result = { };
+    result.bytes = source.size();
+
+    double bestRead = 0, bestRepr = 0, bestPrint = 0;
+
+    for (unsigned round = 0; round < rounds; round++) {
+        Elist forms;
+
+        std::istringstream stream(source);
+        uint64_t allocsBefore = allocations();
+        auto start = Clock::now();
+
+        while (Eptr expr = read(stream))
+            forms.push_back(std::move(expr));
+
+        double readTime = seconds(start);
+        uint64_t allocs = allocations() - allocsBefore;
+
+        start = Clock::now();
+        size_t reprBytes = 0;
+        for (auto &expr : forms)
+            reprBytes += expr->repr().size();
+        double reprTime = seconds(start);
+
+        NullBuf buffer;
+        std::ostream sink(&buffer);
+        {
+            OutputRedirect redirect(sink);
+
+            start = Clock::now();
+            for (auto &expr : forms)
+                print(expr);
+        }
+        double printTime = seconds(start);
+
+        if (!round) {
+            for (auto &expr : forms)
+                result.nodes += countNodes(expr.get());
+
+            result.allocsPerNode = (double)allocs / result.nodes;
+            result.printedBytes  = reprBytes;
+        }
+
+        bestRead  = round ? std::min(bestRead,  readTime)  : readTime;
+        bestRepr  = round ? std::min(bestRepr,  reprTime)  : reprTime;
+        bestPrint = round ? std::min(bestPrint, printTime) : printTime;
+    }
+
+    // Reading is measured against the input, printing against the
+    // output.
+    result.readMBs  = result.bytes        / bestRead  / 1e6;
+    result.reprMBs  = result.printedBytes / bestRepr  / 1e6;
+    result.printMBs = result.printedBytes / bestPrint / 1e6;
+
+    return result;
+}
+
+size_t parseSize(const std::string &s) {
+    char *end;
+    double value = strtod(s.c_str(), &end);
+
+    if (*end == 'k' || *end == 'K')
+        value *= 1 << 10;
+    else if (*end == 'm' || *end == 'M')
+        value *= 1 << 20;
+    else if (*end)
+        return 0;
+
+    return value;
+}
+
+void printUsage(const char *argv0) {
+    std::cerr << "usage: " << argv0
+              << " [--list] [--filter SUBSTRING] [--size BYTES[k|m]] [--depth N]"
+                 " [--rounds N] [--seed N] [--output FILE] [--dump DIR]\n";
+}
+
+}
+
+int main(int argc, char **argv) {
+
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool haveValue = i + 1 < argc;
+
+        if (arg == "--list") {
+            for (auto &corpus : corpora)
+                std::cout << corpus.name << "\n";
+            return 0;
+
+        } else if (arg == "--filter" && haveValue) {
+            options.filter = argv[++i];
+        } else if (arg == "--size" && haveValue && parseSize(argv[i + 1])) {
+            options.size = parseSize(argv[++i]);
+        } else if (arg == "--depth" && haveValue && atoi(argv[i + 1]) > 0) {
+            options.depth = atoi(argv[++i]);
+        } else if (arg == "--rounds" && haveValue && atoi(argv[i + 1]) > 0) {
+            options.rounds = atoi(argv[++i]);
+        } else if (arg == "--seed" && haveValue) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--output" && haveValue) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--dump" && haveValue) {
+            options.dumpPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    stats::start();
+
+    std::ostringstream json;
+    json << "{\"corpora\": [\n";
+
+    bool first = true;
+
+    for (auto &corpus : corpora) {
+        if (std::string(corpus.name).find(options.filter) == std::string::npos)
+            continue;
+
+        Generator gen(options.seed);
+        corpus.generate(gen, options);
+        std::string source = gen.take();
+
+        if (options.dumpPath.length()) {
+            std::string path = options.dumpPath + "/" + corpus.name + ".l";
+            std::ofstream dump(path);
+            dump << source;
+            if (!dump) {
+                std::cerr << "Could not write '" << path << "'\n";
+                return 1;
+            }
+        }
+
+        Result result;
+        try {
+            result = measure(source, options.rounds);
+        } catch (ProgramError &e) {
+            std::cerr << corpus.name << ": " << e.what() << "\n";
+            return 1;
+        }
+
+        json << (first ? "" : ",\n")
+             << "  {\"name\": \""         << corpus.name << "\""
+             << ", \"bytes\": "           << result.bytes
+             << ", \"nodes\": "           << result.nodes
+             << std::fixed << std::setprecision(2)
+             << ", \"read_mb_s\": "       << result.readMBs
+             << ", \"repr_mb_s\": "       << result.reprMBs
+             << ", \"print_mb_s\": "      << result.printMBs
+             << ", \"allocs_per_node\": " << result.allocsPerNode << "}";
+        first = false;
+    }
+
+    json << "\n]}\n";
+
+    if (options.outputPath.length()) {
+        std::ofstream out(options.outputPath);
+        out << json.str();
+        if (!out) {
+            std::cerr << "Could not write '" << options.outputPath << "'\n";
+            return 1;
+        }
+    } else {
+        std::cout << json.str();
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * \file
+ * \brief     Embedding example.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ *
+ * A minimal host: it registers a native function, evaluates Lisp code
+ * that uses it, and calls back into a Lisp function. Only the public
+ * header is used.
+ */
+#include <matig.hh>
+
+#include <iostream>
+#include <stdexcept>
+
+static matig::Value hostSum(matig::Values arguments) {
+    int64_t sum = 0;
+    for (const auto &argument : arguments)
+        sum += matig::toInteger(argument);
+
+    return matig::makeInteger(sum);
+}
+
+int main() {
+    matig::Interpreter interp;
+
+    interp.define("host-sum", hostSum, "Return the sum of all arguments.");
+    interp.define("greeting", matig::makeString("Hello from the host"));
+
+    try {
+        interp.eval("(set 'square (lambda (x) (* x x)))");
+
+        std::cout << matig::toString(interp.lookup("greeting")) << "\n";
+        std::cout << interp.eval("(host-sum 1 2 (square 3))").repr() << "\n";
+
+        matig::Value squares = interp.eval("(list (square 4) (square 5))");
+        for (const auto &item : matig::toList(squares))
+            std::cout << matig::toInteger(interp.call("square", { item })) << "\n";
+
+        interp.eval("(host-sum 1 \"two\")");
+
+    } catch (std::runtime_error &e) {
+        std::cout << "Program error: " << e.what() << "\n";
+    }
+
+    return 0;
+}
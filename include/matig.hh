@@ -0,0 +1,166 @@
+/**
+ * \file
+ * \brief     Embedding API.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ *
+ * This is the interface for hosts that link against libmatig. It is
+ * self-contained: hosts need only this directory on their include
+ * path, not the interpreter's sources.
+ *
+ * Errors in evaluated code are thrown as std::runtime_error, errors
+ * in the interpreter itself as std::logic_error.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Expr;
+class Env;
+
+namespace matig {
+
+/**
+ * \brief A handle to a Lisp value.
+ *
+ * Values are reference counted and immutable through this interface.
+ * A default constructed handle refers to no value at all, which is
+ * different from nil.
+ */
+class Value {
+
+    std::shared_ptr<Expr> expr;
+
+public:
+    /**
+     * \brief Get the printed representation of the value.
+     */
+    std::string repr() const;
+
+    explicit operator bool() const { return expr != nullptr; }
+
+    /// For use by the interpreter.
+    const std::shared_ptr<Expr> &get() const { return expr; }
+
+    Value() = default;
+
+    /// For use by the interpreter.
+    explicit Value(std::shared_ptr<Expr> expr)
+        : expr(std::move(expr))
+        { }
+};
+
+typedef std::vector<Value> Values;
+
+/**
+ * \brief A native function, called with argument values.
+ */
+typedef Value (*NativeFunction)(Values arguments);
+
+/**
+ * \brief An interpreter instance.
+ *
+ * Each interpreter has its own root environment. Builtins are shared
+ * by all instances, so creating an interpreter is cheap.
+ */
+class Interpreter {
+
+    std::shared_ptr<Env> root;
+
+public:
+    /**
+     * \brief Read and evaluate all expressions in SOURCE.
+     *
+     * \return The result of the last expression, or nil
+     */
+    Value eval(const std::string &source);
+
+    /**
+     * \brief Evaluate an expression in the root environment.
+     */
+    Value eval(const Value &expr);
+
+    /**
+     * \brief Read and evaluate a source file, using its AST cache.
+     *
+     * \return The result of the last expression, or nil
+     */
+    Value evalFile(const std::string &path);
+
+    /**
+     * \brief Look up a global, an empty handle if it is not bound.
+     */
+    Value lookup(const std::string &name) const;
+
+    /**
+     * \brief Bind a global.
+     */
+    void define(const std::string &name, Value value);
+
+    /**
+     * \brief Bind a native function to global NAME.
+     *
+     * The function accepts any number of arguments; it is passed
+     * their values.
+     */
+    void define(const std::string &name,
+                NativeFunction func,
+                const std::string &doc = "");
+
+    /**
+     * \brief Call a function with argument values.
+     *
+     * Arguments are passed to the function as-is, they are not
+     * evaluated (and thus need not be quoted).
+     */
+    Value call(const Value &func, Values arguments);
+
+    /**
+     * \brief Call the function bound to global NAME with argument
+     *        values.
+     */
+    Value call(const std::string &name, Values arguments);
+
+    /**
+     * \brief Create an interpreter with a fresh root environment.
+     */
+    Interpreter();
+
+    /**
+     * \brief Create an interpreter from a heap image.
+     */
+    explicit Interpreter(const std::string &imagePath);
+};
+
+// Value construction.
+
+Value nil();
+Value t();
+Value makeBool(bool value);
+Value makeInteger(int64_t value);
+Value makeString(const std::string &value);
+Value makeSymbol(const std::string &name);
+Value makeList(const Values &items);
+Value makeVector(const Values &items);
+
+/**
+ * \brief Read the first expression in SOURCE, without evaluating it.
+ *
+ * \return The expression, or an empty handle if SOURCE holds none
+ */
+Value read(const std::string &source);
+
+// Value conversion. These throw std::runtime_error on type mismatches.
+
+bool isTrue(const Value &value);
+int64_t toInteger(const Value &value);
+const std::string &toString(const Value &value);
+const std::string &toSymbol(const Value &value);
+Values toList(const Value &value);
+Values toVector(const Value &value);
+
+}
@@ -0,0 +1,385 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "ast-cache.hh"
+#include "serialize.hh"
+#include "read.hh"
+#include "bignum.hh"
+#include "persistent.hh"
+#include "vector.hh"
+
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+
+// File layout:
+//
+//   "MATIGAST" version:u64 source-hash:u64 source-size:u64
+//   symbol-count:varint { symbol-name:string }
+//   form-count:varint   { node }
+//
+// Nodes are stored in prefix order. A chain of conses is stored as a
+// single LIST node: the element count, the cars, and finally the cdr
+// of the last cons (nil for a proper list). Each car is preceded by
+// the source location of its cons: the line, relative to the previous
+// location stored (svarint), and the column (varint). A VECTOR node
+// is the item count followed by the items, an INT_ARRAY node the
+// value count followed by the values (svarints). IVECTOR nodes are
+// stored like VECTOR nodes, IMAP nodes as the entry count followed by
+// the keys and values. A BIGNUM node is the sign (u8), the limb count
+// and the limbs (u64s), least significant first.
+
+static const char     magic[8] = { 'M', 'A', 'T', 'I', 'G', 'A', 'S', 'T' };
+static const uint64_t version  = 5;
+
+enum class Tag : uint8_t {
+    NUMERIC,
+    STRING,
+    SYMBOL,
+    LIST,
+    VECTOR,
+    INT_ARRAY,
+    IVECTOR,
+    IMAP,
+    BIGNUM,
+};
+
+std::string astCachePath(const std::string &sourcePath) {
+    return sourcePath + "c";
+}
+
+namespace {
+
+class AstWriter {
+
+    ByteWriter body;
+    uint32_t   line = 0;
+    std::unordered_map<std::string, uint64_t> symbolIds;
+    std::vector<const std::string*> symbols;
+
+    uint64_t intern(const std::string &name) {
+        auto it = symbolIds.find(name);
+        if (it != symbolIds.end())
+            return it->second;
+
+        auto result = symbolIds.emplace(name, symbols.size());
+        symbols.push_back(&result.first->first);
+        return result.first->second;
+    }
+
+public:
+    void write(const Expr *expr) {
+        switch (expr->type()) {
+        case Expr::Type::NUMERIC:
+            body.u8((uint8_t)Tag::NUMERIC);
+            body.svarint(static_cast<const NumericExpr*>(expr)->getValue());
+            break;
+
+        case Expr::Type::BIGNUM: {
+            const auto &value = static_cast<const BignumExpr*>(expr)->getValue();
+
+            body.u8((uint8_t)Tag::BIGNUM);
+            body.u8(value.isNegative());
+            body.varint(value.getLimbs().size());
+            for (uint64_t limb : value.getLimbs())
+                body.u64(limb);
+            break;
+        }
+
+        case Expr::Type::STRING:
+            body.u8((uint8_t)Tag::STRING);
+            body.string(static_cast<const StringExpr*>(expr)->getValue());
+            break;
+
+        case Expr::Type::SYMBOL:
+            body.u8((uint8_t)Tag::SYMBOL);
+            body.varint(intern(static_cast<const SymbolExpr*>(expr)->getValue()));
+            break;
+
+        case Expr::Type::CONS: {
+            const Expr *tail = expr;
+            uint64_t count = 0;
+            while (tail->type() == Expr::Type::CONS) {
+                tail = static_cast<const ConsExpr*>(tail)->getCdr().get();
+                count++;
+            }
+
+            body.u8((uint8_t)Tag::LIST);
+            body.varint(count);
+
+            tail = expr;
+            while (tail->type() == Expr::Type::CONS) {
+                auto cons = static_cast<const ConsExpr*>(tail);
+                const auto &location = cons->getLocation();
+
+                body.svarint((int64_t)location.line - line);
+                body.varint(location.column);
+                line = location.line;
+
+                write(cons->getCar().get());
+                tail = cons->getCdr().get();
+            }
+            write(tail);
+            break;
+        }
+
+        case Expr::Type::VECTOR: {
+            const auto &items = static_cast<const VectorExpr*>(expr)->getItems();
+
+            body.u8((uint8_t)Tag::VECTOR);
+            body.varint(items.size());
+            for (const auto &item : items)
+                write(item.get());
+            break;
+        }
+
+        case Expr::Type::INT_ARRAY: {
+            const auto &values = static_cast<const IntArrayExpr*>(expr)->getValues();
+
+            body.u8((uint8_t)Tag::INT_ARRAY);
+            body.varint(values.size());
+            for (int64_t value : values)
+                body.svarint(value);
+            break;
+        }
+
+        case Expr::Type::IVECTOR: {
+            auto vector = static_cast<const IVectorExpr*>(expr);
+
+            body.u8((uint8_t)Tag::IVECTOR);
+            body.varint(vector->size());
+            vector->forEach([&](const Eptr &item) { write(item.get()); });
+            break;
+        }
+
+        case Expr::Type::IMAP: {
+            auto map = static_cast<const IMapExpr*>(expr);
+
+            body.u8((uint8_t)Tag::IMAP);
+            body.varint(map->size());
+            map->forEach([&](const IMapExpr::Entry &entry) {
+                write(entry.key.get());
+                write(entry.value.get());
+            });
+            break;
+        }
+
+        default:
+            throw LogicError("Expression type cannot be stored in an AST cache");
+        }
+    }
+
+    std::string finish(const std::string &source, size_t formCount) {
+        ByteWriter out;
+        out.bytes(magic, sizeof(magic));
+        out.u64(version);
+        out.u64(hashBytes(source.data(), source.size()));
+        out.u64(source.size());
+
+        out.varint(symbols.size());
+        for (auto name : symbols)
+            out.string(*name);
+
+        out.varint(formCount);
+        out.data() += body.data();
+
+        return std::move(out.data());
+    }
+};
+
+class AstReader {
+
+    ByteReader in;
+    Elist symbols;
+
+    uint16_t file;
+    uint32_t line = 0;
+
+    SourceLocation readLocation() {
+        SourceLocation location;
+        location.line   = line += in.svarint();
+        location.column = in.varint();
+        location.file   = location.line ? file : 0;
+        return location;
+    }
+
+    Eptr readNode() {
+        auto tag = (Tag)in.u8();
+
+        if (tag == Tag::NUMERIC) {
+            return std::make_shared<NumericExpr>(in.svarint());
+
+        } else if (tag == Tag::BIGNUM) {
+            bool negative = in.u8();
+
+            Bignum::Limbs limbs;
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++)
+                limbs.push_back(in.u64());
+
+            return makeIntegerExpr(Bignum::fromLimbs(std::move(limbs), negative));
+
+        } else if (tag == Tag::STRING) {
+            size_t size = in.varint();
+            return std::make_shared<StringExpr>(std::string(in.bytes(size), size));
+
+        } else if (tag == Tag::SYMBOL) {
+            uint64_t id = in.varint();
+            if (id >= symbols.size())
+                throw FormatError("Symbol index out of range");
+            return symbols[id];
+
+        } else if (tag == Tag::LIST) {
+            uint64_t count = in.varint();
+            if (!count)
+                throw FormatError("Empty list node");
+
+            auto rootCons         = std::make_shared<ConsExpr>();
+            ConsExpr *currentCons = rootCons.get();
+
+            for (uint64_t i = 0; i < count; i++) {
+                if (i) {
+                    currentCons->getCdr() = std::make_shared<ConsExpr>();
+                    currentCons = static_cast<ConsExpr*>(currentCons->getCdr().get());
+                }
+                currentCons->setLocation(readLocation());
+                currentCons->getCar() = readNode();
+            }
+            currentCons->getCdr() = readNode();
+
+            return rootCons;
+
+        } else if (tag == Tag::VECTOR) {
+            uint64_t count = in.varint();
+
+            Elist items;
+            for (uint64_t i = 0; i < count; i++)
+                items.push_back(readNode());
+
+            return std::make_shared<VectorExpr>(std::move(items));
+
+        } else if (tag == Tag::INT_ARRAY) {
+            uint64_t count = in.varint();
+
+            std::vector<int64_t> values;
+            for (uint64_t i = 0; i < count; i++)
+                values.push_back(in.svarint());
+
+            return std::make_shared<IntArrayExpr>(std::move(values));
+
+        } else if (tag == Tag::IVECTOR) {
+            uint64_t count = in.varint();
+
+            Elist items;
+            for (uint64_t i = 0; i < count; i++)
+                items.push_back(readNode());
+
+            return IVectorExpr::fromList(items);
+
+        } else if (tag == Tag::IMAP) {
+            uint64_t count = in.varint();
+
+            IMapEptr map = std::make_shared<IMapExpr>();
+            for (uint64_t i = 0; i < count; i++) {
+                Eptr key = readNode();
+                map = map->put(key, readNode());
+            }
+
+            return map;
+
+        } else {
+            throw FormatError("Unknown node tag");
+        }
+    }
+
+public:
+    bool read(const std::string &source, Elist &forms) {
+        if (memcmp(in.bytes(sizeof(magic)), magic, sizeof(magic))
+            || in.u64() != version
+            || in.u64() != hashBytes(source.data(), source.size())
+            || in.u64() != source.size())
+            return false;
+
+        uint64_t symbolCount = in.varint();
+        for (uint64_t i = 0; i < symbolCount; i++)
+            symbols.push_back(std::make_shared<SymbolExpr>(in.string()));
+
+        uint64_t formCount = in.varint();
+        for (uint64_t i = 0; i < formCount; i++)
+            forms.push_back(readNode());
+
+        if (!in.atEnd())
+            throw FormatError("Trailing data");
+
+        return true;
+    }
+
+    AstReader(const char *data, size_t size, uint16_t file)
+        : in(data, size),
+          file(file)
+        { }
+};
+
+}
+
+bool loadAstCache(const std::string &cachePath,
+                  const std::string &source,
+                  Elist &forms,
+                  uint16_t file) {
+
+    MappedFile mapped;
+    if (!mapped.open(cachePath))
+        return false;
+
+    try {
+        return AstReader(mapped.data(), mapped.size(), file).read(source, forms);
+
+    } catch (FormatError &e) {
+        forms.clear();
+        return false;
+    }
+}
+
+bool writeAstCache(const std::string &cachePath,
+                   const std::string &source,
+                   const Elist &forms) {
+
+    AstWriter writer;
+    for (const auto &expr : forms)
+        writer.write(expr.get());
+
+    return writeFileAtomic(cachePath, writer.finish(source, forms.size()));
+}
+
+bool readSource(const std::string &path,
+                const std::string &source,
+                Elist &forms) {
+
+    std::string cachePath = astCachePath(path);
+
+    SourceLocation position = sourceStart(path);
+
+    if (loadAstCache(cachePath, source, forms, position.file))
+        return true;
+
+    try {
+        std::istringstream stream(source);
+        if (slurpShebang(stream))
+            position.line++;
+
+        while (Eptr expr = read(stream, position))
+            forms.push_back(expr);
+
+    } catch (ProgramError &e) {
+        forms.clear();
+        return false;
+    }
+
+    writeAstCache(cachePath, source, forms);
+
+    return true;
+}
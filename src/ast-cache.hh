@@ -0,0 +1,63 @@
+/**
+ * \file
+ * \brief     Precompiled AST cache.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief Get the path of the AST cache file belonging to a source file.
+ */
+std::string astCachePath(const std::string &sourcePath);
+
+/**
+ * \brief Load the reader output for SOURCE from an AST cache file.
+ *
+ * The cache is mapped into memory and decoded in a single linear
+ * pass. It is only used when it was created from a source text with
+ * the same content hash.
+ *
+ * \param cachePath The cache file
+ * \param source    The full source text the cache should belong to
+ * \param forms     Receives the top-level expressions
+ * \param file      The source file id for the locations of the conses
+ *
+ * \return false if the cache is missing, stale or corrupt
+ */
+bool loadAstCache(const std::string &cachePath,
+                  const std::string &source,
+                  Elist &forms,
+                  uint16_t file = 0);
+
+/**
+ * \brief Write the reader output for SOURCE to an AST cache file.
+ *
+ * Failure to write the cache (e.g. in a read-only directory) is not
+ * an error.
+ *
+ * \return false if the cache could not be written
+ */
+bool writeAstCache(const std::string &cachePath,
+                   const std::string &source,
+                   const Elist &forms);
+
+/**
+ * \brief Read all expressions in a source text.
+ *
+ * The reader output is taken from the AST cache belonging to PATH when
+ * it is up to date, and written to it otherwise.
+ *
+ * \param path   The path of the source file
+ * \param source The contents of the source file
+ * \param forms  Receives the top-level expressions
+ *
+ * \return false if the source contains a syntax error
+ */
+bool readSource(const std::string &path,
+                const std::string &source,
+                Elist &forms);
@@ -0,0 +1,156 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "batch.hh"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Job {
+    FILE *out  = nullptr;
+    FILE *err  = nullptr;
+    bool  done = false;
+    int   status = 0;
+};
+
+void copyAndClose(FILE *from, std::ostream &to) {
+    if (!from)
+        return;
+
+    rewind(from);
+
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), from)))
+        to.write(buffer, n);
+
+    fclose(from);
+}
+
+/**
+ * \brief Start evaluating a file in a child process.
+ *
+ * \return The child's pid, or -1 on failure
+ */
+pid_t start(const std::string &path, Job &job,
+            const std::function<void(const std::string&)> &runFile) {
+
+    job.out = tmpfile();
+    job.err = tmpfile();
+    if (!job.out || !job.err) {
+        std::cerr << "Could not create output files for '" << path << "': "
+                  << strerror(errno) << "\n";
+        return -1;
+    }
+
+    // Buffered output must not be written twice.
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        std::cerr << "Could not fork for '" << path << "': " << strerror(errno) << "\n";
+        return -1;
+
+    } else if (pid == 0) {
+        dup2(fileno(job.out), STDOUT_FILENO);
+        dup2(fileno(job.err), STDERR_FILENO);
+
+        runFile(path);
+
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+
+        // Skip destructors of state shared with the parent.
+        _exit(0);
+    }
+
+    return pid;
+}
+
+}
+
+int runBatch(const std::vector<std::string> &paths,
+             unsigned jobs,
+             std::function<void(const std::string &path)> runFile) {
+
+    std::vector<Job> results(paths.size());
+    std::map<pid_t, size_t> running;
+
+    size_t next    = 0;
+    size_t emitted = 0;
+    int    exitStatus = 0;
+
+    while (emitted < paths.size()) {
+        while (running.size() < std::max(jobs, 1u) && next < paths.size()) {
+            pid_t pid = start(paths[next], results[next], runFile);
+
+            if (pid < 0) {
+                results[next].done   = true;
+                results[next].status = -1;
+            } else {
+                running[pid] = next;
+            }
+            next++;
+        }
+
+        // Copy out finished files, in order.
+        while (emitted < paths.size() && results[emitted].done) {
+            Job &job = results[emitted];
+
+            copyAndClose(job.out, std::cout);
+            copyAndClose(job.err, std::cerr);
+            std::cout.flush();
+            std::cerr.flush();
+
+            if (job.status == -1) {
+                exitStatus = 1;
+            } else if (WIFSIGNALED(job.status)) {
+                std::cerr << paths[emitted] << ": terminated by signal "
+                          << WTERMSIG(job.status) << "\n";
+                exitStatus = 1;
+            } else if (WEXITSTATUS(job.status)) {
+                exitStatus = 1;
+            }
+            emitted++;
+        }
+
+        if (running.empty())
+            continue;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+
+            std::cerr << "waitpid: " << strerror(errno) << "\n";
+            return 1;
+        }
+
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+
+        results[it->second].done   = true;
+        results[it->second].status = status;
+        running.erase(it);
+    }
+
+    return exitStatus;
+}
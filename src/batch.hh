@@ -0,0 +1,32 @@
+/**
+ * \file
+ * \brief     Running many script files in parallel processes.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <functional>
+#include <vector>
+
+/**
+ * \brief Run every file in PATHS in a forked child process.
+ *
+ * Up to JOBS children run at a time; the next file is started as soon
+ * as a child exits. Children are forked from the calling process, so
+ * they share its initialized state copy-on-write, and each file runs
+ * against that state unaffected by the others.
+ *
+ * The stdout and stderr of every file are captured separately, and
+ * copied to stdout and stderr in the order of PATHS.
+ *
+ * \param runFile Evaluates one file, in the child
+ *
+ * \return An exit status: non-zero if any child failed
+ */
+int runBatch(const std::vector<std::string> &paths,
+             unsigned jobs,
+             std::function<void(const std::string &path)> runFile);
@@ -0,0 +1,347 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "bignum.hh"
+
+#include <algorithm>
+#include <limits>
+
+typedef Bignum::Limbs Limbs;
+__extension__ typedef unsigned __int128 uint128_t;
+
+/// Operands with fewer limbs are multiplied the schoolbook way.
+static const size_t karatsubaThreshold = 32;
+
+static void trimLimbs(Limbs &limbs) {
+    while (limbs.size() && !limbs.back())
+        limbs.pop_back();
+}
+
+static int compareMagnitudes(const Limbs &a, const Limbs &b) {
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+
+    for (size_t i = a.size(); i--; ) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static Limbs addMagnitudes(const Limbs &a, const Limbs &b) {
+    const Limbs &longer  = a.size() >= b.size() ? a : b;
+    const Limbs &shorter = a.size() >= b.size() ? b : a;
+
+    Limbs    result(longer.size() + 1);
+    uint64_t carry = 0;
+
+    for (size_t i = 0; i < longer.size(); i++) {
+        uint128_t sum = (uint128_t)longer[i]
+                      + (i < shorter.size() ? shorter[i] : 0)
+                      + carry;
+        result[i] = (uint64_t)sum;
+        carry     = sum >> 64;
+    }
+    result.back() = carry;
+
+    trimLimbs(result);
+    return result;
+}
+
+/**
+ * \brief Subtract magnitude B from magnitude A, which must not be
+ *        smaller.
+ */
+static Limbs subtractMagnitudes(const Limbs &a, const Limbs &b) {
+    Limbs    result(a.size());
+    uint64_t borrow = 0;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        uint128_t difference = (uint128_t)a[i]
+                             - (i < b.size() ? b[i] : 0)
+                             - borrow;
+        result[i] = (uint64_t)difference;
+        borrow    = (difference >> 64) ? 1 : 0;
+    }
+
+    trimLimbs(result);
+    return result;
+}
+
+/**
+ * \brief Add X, shifted left by SHIFT limbs, to ACC.
+ *
+ * ACC must be large enough to hold the sum.
+ */
+static void addShifted(Limbs &acc, const Limbs &x, size_t shift) {
+    uint64_t carry = 0;
+    size_t   i     = 0;
+
+    for (; i < x.size(); i++) {
+        uint128_t sum = (uint128_t)acc[shift + i] + x[i] + carry;
+        acc[shift + i] = (uint64_t)sum;
+        carry          = sum >> 64;
+    }
+    for (; carry; i++) {
+        uint128_t sum = (uint128_t)acc[shift + i] + carry;
+        acc[shift + i] = (uint64_t)sum;
+        carry          = sum >> 64;
+    }
+}
+
+static Limbs multiplySchoolbook(const uint64_t *a, size_t aSize,
+                                const uint64_t *b, size_t bSize) {
+    Limbs result(aSize + bSize);
+
+    for (size_t i = 0; i < aSize; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < bSize; j++) {
+            uint128_t product = (uint128_t)a[i] * b[j] + result[i + j] + carry;
+            result[i + j] = (uint64_t)product;
+            carry         = product >> 64;
+        }
+        result[i + bSize] = carry;
+    }
+
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs limbRange(const uint64_t *limbs, size_t size) {
+    Limbs result(limbs, limbs + size);
+    trimLimbs(result);
+    return result;
+}
+
+static Limbs multiplyMagnitudes(const uint64_t *a, size_t aSize,
+                                const uint64_t *b, size_t bSize) {
+    if (aSize < bSize) {
+        std::swap(a, b);
+        std::swap(aSize, bSize);
+    }
+
+    if (bSize < karatsubaThreshold)
+        return multiplySchoolbook(a, aSize, b, bSize);
+
+    Limbs result(aSize + bSize + 1);
+
+    if (aSize >= 2 * bSize) {
+        // Split only A, into pieces the size of B.
+        for (size_t i = 0; i < aSize; i += bSize)
+            addShifted(result,
+                       multiplyMagnitudes(a + i, std::min(bSize, aSize - i), b, bSize),
+                       i);
+
+        trimLimbs(result);
+        return result;
+    }
+
+    // Karatsuba: with A = A1·X + A0 and B = B1·X + B0,
+    // A·B = Z2·X² + Z1·X + Z0, where Z2 = A1·B1, Z0 = A0·B0 and
+    // Z1 = (A1 + A0)·(B1 + B0) - Z2 - Z0: three half-size products
+    // instead of four.
+    size_t half = aSize / 2;
+
+    Limbs a0 = limbRange(a,        half);
+    Limbs a1 = limbRange(a + half, aSize - half);
+    Limbs b0 = limbRange(b,        half);
+    Limbs b1 = limbRange(b + half, bSize - half);
+
+    Limbs z0 = multiplyMagnitudes(a0.data(), a0.size(), b0.data(), b0.size());
+    Limbs z2 = multiplyMagnitudes(a1.data(), a1.size(), b1.data(), b1.size());
+
+    Limbs aSum = addMagnitudes(a0, a1);
+    Limbs bSum = addMagnitudes(b0, b1);
+    Limbs z1   = multiplyMagnitudes(aSum.data(), aSum.size(), bSum.data(), bSum.size());
+    z1 = subtractMagnitudes(subtractMagnitudes(z1, z0), z2);
+
+    addShifted(result, z0, 0);
+    addShifted(result, z1, half);
+    addShifted(result, z2, 2 * half);
+
+    trimLimbs(result);
+    return result;
+}
+
+void Bignum::trim() {
+    trimLimbs(limbs);
+    if (limbs.empty())
+        negative = false;
+}
+
+bool Bignum::fitsInt64() const {
+    if (limbs.size() > 1)
+        return false;
+    if (limbs.empty())
+        return true;
+
+    return negative ? limbs[0] <= (uint64_t)1 << 63
+                    : limbs[0] <= (uint64_t)std::numeric_limits<int64_t>::max();
+}
+
+int64_t Bignum::toInt64() const {
+    if (limbs.empty())
+        return 0;
+
+    return negative ? (int64_t)(0 - limbs[0])
+                    : (int64_t)limbs[0];
+}
+
+std::string Bignum::toString() const {
+    if (isZero())
+        return "0";
+
+    // Divide by 10^18 until nothing is left, collecting the remainders
+    // as chunks of 18 digits, least significant first.
+    const uint64_t chunkBase = 1000000000000000000;
+
+    Limbs                 rest = limbs;
+    std::vector<uint64_t> chunks;
+
+    while (rest.size()) {
+        uint128_t remainder = 0;
+        for (size_t i = rest.size(); i--; ) {
+            uint128_t current = (remainder << 64) | rest[i];
+            rest[i]   = (uint64_t)(current / chunkBase);
+            remainder = current % chunkBase;
+        }
+        chunks.push_back((uint64_t)remainder);
+        trimLimbs(rest);
+    }
+
+    std::string s = negative ? "-" : "";
+    s += std::to_string(chunks.back());
+
+    for (size_t i = chunks.size() - 1; i--; ) {
+        std::string chunk = std::to_string(chunks[i]);
+        s += std::string(18 - chunk.size(), '0') + chunk;
+    }
+
+    return s;
+}
+
+size_t Bignum::hash() const {
+    size_t hash = negative;
+    for (uint64_t limb : limbs)
+        hash = hash * 31 + limb;
+    return hash;
+}
+
+int Bignum::compare(const Bignum &other) const {
+    if (negative != other.negative)
+        return negative ? -1 : 1;
+
+    int result = compareMagnitudes(limbs, other.limbs);
+    return negative ? -result : result;
+}
+
+Bignum Bignum::operator-() const {
+    return Bignum(limbs, !negative);
+}
+
+Bignum operator+(const Bignum &a, const Bignum &b) {
+    if (a.negative == b.negative)
+        return Bignum(addMagnitudes(a.limbs, b.limbs), a.negative);
+
+    // Subtract the smaller magnitude from the larger, which gives the
+    // result its sign.
+    if (compareMagnitudes(a.limbs, b.limbs) >= 0)
+        return Bignum(subtractMagnitudes(a.limbs, b.limbs), a.negative);
+    else
+        return Bignum(subtractMagnitudes(b.limbs, a.limbs), b.negative);
+}
+
+Bignum operator-(const Bignum &a, const Bignum &b) {
+    return a + -b;
+}
+
+Bignum operator*(const Bignum &a, const Bignum &b) {
+    return Bignum(multiplyMagnitudes(a.limbs.data(), a.limbs.size(),
+                                     b.limbs.data(), b.limbs.size()),
+                  a.negative != b.negative);
+}
+
+Bignum Bignum::pow(uint64_t exponent) const {
+    Bignum result(1);
+    Bignum base = *this;
+
+    while (true) {
+        if (exponent & 1)
+            result = result * base;
+
+        exponent >>= 1;
+        if (!exponent)
+            return result;
+
+        base = base * base;
+    }
+}
+
+Bignum Bignum::parse(const std::string &digits) {
+    if (digits.empty()
+        || !std::all_of(digits.begin(), digits.end(), [](char c) { return isdigit(c); }))
+        throw LogicError("Invalid bignum digits '" + digits + "'");
+
+    Limbs limbs;
+
+    // Multiply in 18 digits at a time.
+    for (size_t i = 0; i < digits.size(); ) {
+        size_t   count = std::min<size_t>(18, digits.size() - i);
+        uint64_t scale = 1;
+        uint64_t carry = 0;
+
+        for (size_t j = 0; j < count; j++) {
+            scale *= 10;
+            carry  = carry * 10 + (digits[i + j] - '0');
+        }
+
+        for (auto &limb : limbs) {
+            uint128_t value = (uint128_t)limb * scale + carry;
+            limb  = (uint64_t)value;
+            carry = value >> 64;
+        }
+        if (carry)
+            limbs.push_back(carry);
+
+        i += count;
+    }
+
+    return Bignum(std::move(limbs), false);
+}
+
+Bignum Bignum::fromLimbs(Limbs limbs, bool negative) {
+    return Bignum(std::move(limbs), negative);
+}
+
+Bignum::Bignum(Limbs limbs, bool negative)
+    : limbs(std::move(limbs)),
+      negative(negative) {
+    trim();
+}
+
+Bignum::Bignum(int64_t value)
+    : negative(value < 0) {
+
+    if (value)
+        limbs.push_back(negative ? 0 - (uint64_t)value : (uint64_t)value);
+}
+
+Bignum toBignum(const Expr &expr) {
+    if (expr.type() == Expr::Type::BIGNUM)
+        return static_cast<const BignumExpr&>(expr).getValue();
+    if (expr.type() == Expr::Type::NUMERIC)
+        return Bignum(static_cast<const NumericExpr&>(expr).getValue());
+
+    throw LogicError("Expression is not an integer");
+}
+
+Eptr makeIntegerExpr(Bignum value) {
+    if (value.fitsInt64())
+        return std::make_shared<NumericExpr>(value.toInt64());
+
+    return std::make_shared<BignumExpr>(std::move(value));
+}
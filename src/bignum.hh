@@ -0,0 +1,131 @@
+/**
+ * \file
+ * \brief     Arbitrary precision integers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief An arbitrary precision integer.
+ *
+ * Stored as a sign and a magnitude of 64-bit limbs, least significant
+ * first, without leading zero limbs. Zero has no limbs and is never
+ * negative.
+ */
+class Bignum {
+
+public:
+    typedef std::vector<uint64_t> Limbs;
+
+private:
+    Limbs limbs;
+    bool  negative = false;
+
+    void trim();
+
+    Bignum(Limbs limbs, bool negative);
+
+public:
+    bool isZero()     const { return limbs.empty(); }
+    bool isNegative() const { return negative;      }
+
+    const Limbs &getLimbs() const { return limbs; }
+
+    bool    fitsInt64() const;
+    int64_t toInt64()   const; ///< Only valid if fitsInt64().
+
+    std::string toString() const;
+
+    size_t hash() const;
+
+    /**
+     * \brief Compare with OTHER.
+     *
+     * \return a negative number, zero or a positive number if this is
+     *         less than, equal to or greater than OTHER
+     */
+    int compare(const Bignum &other) const;
+
+    bool operator==(const Bignum &other) const {
+        return negative == other.negative && limbs == other.limbs;
+    }
+
+    Bignum operator-() const;
+
+    friend Bignum operator+(const Bignum &a, const Bignum &b);
+    friend Bignum operator-(const Bignum &a, const Bignum &b);
+
+    /**
+     * Large operands are multiplied with Karatsuba's algorithm.
+     */
+    friend Bignum operator*(const Bignum &a, const Bignum &b);
+
+    /**
+     * \brief Raise to the EXPONENTth power, by repeated squaring.
+     */
+    Bignum pow(uint64_t exponent) const;
+
+    /**
+     * \brief Parse a string of decimal digits.
+     */
+    static Bignum parse(const std::string &digits);
+
+    static Bignum fromLimbs(Limbs limbs, bool negative);
+
+    Bignum(int64_t value = 0);
+};
+
+/**
+ * \brief Bignum atom Expression type.
+ *
+ * Holds integers that do not fit in a NumericExpr. Arithmetic
+ * builtins promote to bignums when a result would overflow, and
+ * return a NumericExpr again when the result fits, so integers that
+ * fit in 64 bits are always numerics.
+ */
+class BignumExpr : public AtomExpr {
+
+    Bignum value;
+
+public:
+    Type type() const override { return Type::BIGNUM; }
+
+    std::string repr() const override {
+        return value.toString();
+    }
+
+    const Bignum &getValue() const { return value; }
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    BignumExpr(Bignum value)
+        : value(std::move(value)) {
+        profileAlloc(Type::BIGNUM, sizeof(*this)
+                                   + this->value.getLimbs().size() * sizeof(uint64_t));
+    }
+};
+
+/**
+ * \brief Check whether EXPR is a numeric or a bignum.
+ */
+inline bool isInteger(const Expr &expr) {
+    return expr.type() == Expr::Type::NUMERIC
+        || expr.type() == Expr::Type::BIGNUM;
+}
+
+/**
+ * \brief Get the value of an integer (see isInteger()) as a bignum.
+ */
+Bignum toBignum(const Expr &expr);
+
+/**
+ * \brief Make a numeric for VALUE if it fits, a bignum otherwise.
+ */
+Eptr makeIntegerExpr(Bignum value);
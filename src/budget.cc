@@ -0,0 +1,199 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "budget.hh"
+#include "green-thread.hh"
+
+#include <algorithm>
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+namespace budget {
+
+thread_local State state;
+
+namespace {
+
+unsigned checkInterval = 256;
+Limits   defaults;
+
+/// Generous stack space taken by one function call.
+const size_t callSize = 2048;
+
+/// Stack space left for builtins that recurse without calls (e.g.
+/// printing, destroying deep structures) once the stack limit is hit.
+const size_t headroom = 256 * 1024;
+
+/// The stack size for evaluations without a call depth limit.
+const size_t unlimitedStackSize = 16 * 1024 * 1024;
+
+/**
+ * \brief Get the stack limit of the calling OS thread.
+ */
+const char *threadStackLimit() {
+    pthread_attr_t attr;
+    void          *base;
+    size_t         size;
+
+    if (pthread_getattr_np(pthread_self(), &attr))
+        return nullptr;
+
+    int error = pthread_attr_getstack(&attr, &base, &size);
+    pthread_attr_destroy(&attr);
+
+    if (error || size <= headroom)
+        return nullptr;
+
+    return static_cast<const char*>(base) + headroom;
+}
+
+uint64_t used(int64_t countdown, uint64_t quantum, uint64_t counted) {
+    // Nested scopes may leave the countdown below zero.
+    return counted + ((int64_t)quantum - countdown);
+}
+
+/**
+ * \brief Start a new countdown, no longer than what remains of LIMIT.
+ */
+void restart(int64_t &countdown, uint64_t &quantum, uint64_t counted,
+             uint64_t limit, const char *what) {
+
+    if (limit && counted >= limit)
+        throw Exceeded(what + " budget of "s + std::to_string(limit) + " exceeded");
+
+    quantum = limit ? std::min<uint64_t>(checkInterval, limit - counted)
+                    : checkInterval;
+    countdown = quantum;
+}
+
+}
+
+void stepCheck() {
+    state.stepsCounted = used(state.stepCountdown, state.stepQuantum, state.stepsCounted);
+    restart(state.stepCountdown, state.stepQuantum,
+            state.stepsCounted, state.limits.steps, "Step");
+
+    // Let other green threads run.
+    if (GreenThread *thread = GreenThread::current())
+        thread->yield();
+}
+
+void allocCheck() {
+    state.allocsCounted = used(state.allocCountdown, state.allocQuantum, state.allocsCounted);
+    restart(state.allocCountdown, state.allocQuantum,
+            state.allocsCounted, state.limits.allocs, "Allocation");
+}
+
+void enterCall() {
+    uint64_t depth = ++state.depth;
+
+    if (state.limits.depth && depth > state.limits.depth) {
+        state.depth--;
+        throw Exceeded("Call depth limit of "s + std::to_string(state.limits.depth)
+                       + " exceeded");
+    }
+
+    if (!state.stackLimit)
+        state.stackLimit = threadStackLimit();
+
+    char here;
+    if (&here < state.stackLimit) {
+        state.depth--;
+        throw Exceeded("Stack exhausted at call depth "s + std::to_string(depth));
+    }
+}
+
+void leaveCall() {
+    state.depth--;
+}
+
+size_t stackSize(const Limits &limits) {
+    if (!limits.depth)
+        return unlimitedStackSize;
+
+    return limits.depth * callSize + 2 * headroom;
+}
+
+void setStack(const char *top, size_t size) {
+    state.stackLimit = top - size + headroom;
+}
+
+void setCheckInterval(unsigned interval) {
+    checkInterval = std::max(interval, 1u);
+}
+
+void setDefaultLimits(const Limits &limits) {
+    defaults = limits;
+
+    // Size the stacks of threads started from now on, like pool and
+    // server workers.
+    size_t size = stackSize(limits);
+
+    pthread_attr_t attr;
+    if (!pthread_getattr_default_np(&attr)) {
+        pthread_attr_setstacksize(&attr, size);
+        pthread_setattr_default_np(&attr);
+        pthread_attr_destroy(&attr);
+    }
+
+    // The main thread's stack grows on demand, up to the soft limit.
+    rlimit stack;
+    if (!getrlimit(RLIMIT_STACK, &stack)
+        && stack.rlim_cur != RLIM_INFINITY && stack.rlim_cur < size) {
+        stack.rlim_cur = std::min<rlim_t>(size, stack.rlim_max);
+        setrlimit(RLIMIT_STACK, &stack);
+    }
+}
+
+const Limits &defaultLimits() {
+    return defaults;
+}
+
+/**
+ * \brief Combine a new limit with what remains of an outer one.
+ */
+static uint64_t nested(uint64_t limit, uint64_t outerLimit, uint64_t outerUsed) {
+    if (!outerLimit)
+        return limit;
+
+    uint64_t remaining = outerUsed < outerLimit ? outerLimit - outerUsed : 1;
+    return limit ? std::min(limit, remaining) : remaining;
+}
+
+Scope::Scope(const Limits &limits)
+    : outer(state) {
+
+    Limits effective;
+    effective.steps  = nested(limits.steps,  outer.limits.steps,
+                              used(outer.stepCountdown, outer.stepQuantum, outer.stepsCounted));
+    effective.allocs = nested(limits.allocs, outer.limits.allocs,
+                              used(outer.allocCountdown, outer.allocQuantum, outer.allocsCounted));
+
+    // Call depth is absolute, so the lower limit applies.
+    effective.depth  = limits.depth && outer.limits.depth
+                     ? std::min(limits.depth, outer.limits.depth)
+                     : std::max(limits.depth, outer.limits.depth);
+
+    state = State();
+    state.limits     = effective;
+    state.depth      = outer.depth;
+    state.stackLimit = outer.stackLimit;
+}
+
+Scope::~Scope() {
+    uint64_t steps  = used(state.stepCountdown,  state.stepQuantum,  state.stepsCounted);
+    uint64_t allocs = used(state.allocCountdown, state.allocQuantum, state.allocsCounted);
+
+    // Charge the outer budget by shortening its countdowns; it is
+    // checked on its next step or allocation.
+    state = outer;
+    state.stepCountdown  -= steps;
+    state.allocCountdown -= allocs;
+}
+
+}
@@ -0,0 +1,179 @@
+/**
+ * \file
+ * \brief     Step and allocation budgets for evaluations.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <cstdint>
+
+/**
+ * Every function call counts as a step, and every expression node
+ * created counts as an allocation. Counting only decrements a
+ * thread-local countdown; the budget itself is checked once every
+ * check interval, or when less than an interval remains. Each check is
+ * also where green threads yield.
+ *
+ * The depth of nested function calls is limited as well, and checked
+ * on every call, so that runaway recursion fails before it overflows
+ * the stack. Stacks of the threads and green threads that evaluate
+ * are sized to fit the depth limit (see stackSize()). Stacks that can
+ * not be sized to fit are guarded by a check that enough of the stack
+ * remains.
+ */
+namespace budget {
+
+class Exceeded : public ProgramError {
+public:
+    Exceeded(const std::string &s)
+        : ProgramError(s) { }
+};
+
+/**
+ * \brief Budget limits, 0 meaning unlimited.
+ */
+struct Limits {
+    uint64_t steps  = 0;
+    uint64_t allocs = 0;
+    uint64_t depth  = 0; ///< Of nested function calls.
+};
+
+/// The call depth limit used unless another is given.
+const uint64_t defaultMaxDepth = 10000;
+
+/**
+ * \brief Accounting of the evaluation running on a thread.
+ *
+ * Zero-initialized, so that the first step and allocation take the
+ * slow path, which sets up the countdowns.
+ */
+struct State {
+    int64_t  stepCountdown;
+    int64_t  allocCountdown;
+    uint64_t stepsCounted;  ///< Steps before the current countdown.
+    uint64_t allocsCounted;
+    uint64_t stepQuantum;   ///< The value the current countdown started at.
+    uint64_t allocQuantum;
+    Limits   limits;
+
+    uint64_t    depth;      ///< Of the function call being evaluated.
+    const char *stackLimit; ///< The lowest stack address calls may start at.
+};
+
+extern thread_local State state;
+
+void stepCheck();
+void allocCheck();
+
+/**
+ * \brief Count a step.
+ *
+ * Green threads may yield here, after which they may run on another
+ * OS thread: callers must not keep pointers to thread-local data
+ * across this call.
+ */
+inline void step() {
+    if (--state.stepCountdown <= 0)
+        stepCheck();
+}
+
+/**
+ * \brief Count an allocation.
+ */
+inline void alloc() {
+    if (--state.allocCountdown <= 0)
+        allocCheck();
+}
+
+/**
+ * \brief Count COUNT allocations at once, for objects that take as
+ *        much memory as COUNT expressions.
+ */
+inline void alloc(uint64_t count) {
+    state.allocCountdown -= count;
+    if (state.allocCountdown <= 0)
+        allocCheck();
+}
+
+/**
+ * \brief Enter a function call.
+ *
+ * \throw Exceeded if the call depth limit is reached, or too little
+ *        of the stack remains
+ */
+void enterCall();
+void leaveCall();
+
+/**
+ * \brief Counts a function call for the lifetime of this object.
+ *
+ * Entering and leaving are not inlined: a green thread may continue on
+ * another OS thread in between, so the thread-local state must be
+ * looked up anew.
+ */
+class Call {
+public:
+    Call()  { enterCall(); }
+    ~Call() { leaveCall(); }
+
+    Call(const Call&) = delete;
+    Call &operator=(const Call&) = delete;
+};
+
+/**
+ * \brief Get the stack size needed to evaluate under LIMITS.
+ */
+size_t stackSize(const Limits &limits);
+
+/**
+ * \brief Set the stack limit of an evaluation starting on a new stack.
+ *
+ * \param top  An address near the top of the stack
+ * \param size The size of the stack
+ */
+void setStack(const char *top, size_t size);
+
+/**
+ * \brief Set the number of steps or allocations between checks.
+ *
+ * Must be set before evaluation starts.
+ */
+void setCheckInterval(unsigned interval);
+
+/**
+ * \brief Set the limits that top-level evaluations run with.
+ *
+ * Threads started from now on get stacks that fit LIMITS, and the main
+ * thread's stack may grow to fit them, as far as its hard limit allows.
+ */
+void setDefaultLimits(const Limits &limits);
+const Limits &defaultLimits();
+
+/**
+ * \brief Get the limits of the evaluation on the current thread.
+ */
+inline const Limits &currentLimits() { return state.limits; }
+
+/**
+ * \brief Evaluate under a budget for the lifetime of this object.
+ *
+ * A nested budget can not extend the one it is nested in: what
+ * remains of the outer budget still applies. Steps and allocations
+ * are charged to the outer budget when the scope ends.
+ */
+class Scope {
+
+    State outer;
+
+public:
+    Scope(const Limits &limits);
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+    ~Scope();
+};
+
+}
@@ -0,0 +1,838 @@
+/**
+ * \file
+ * \brief     Collection builtin functions.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "builtins.hh"
+#include "budget.hh"
+#include "hash-table.hh"
+#include "persistent.hh"
+#include "simd.hh"
+#include "struct.hh"
+#include "vector.hh"
+
+#include <algorithm>
+#include <unordered_set>
+
+/**
+ * \brief Get the vector a VECTOR expression refers to.
+ */
+static VectorExpr *vectorParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::VECTOR)
+        throw ProgramError("First parameter to "s + builtinName + " must be a vector");
+
+    return static_cast<VectorExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the hash table a HASH_TABLE expression refers to.
+ */
+static HashTableExpr *hashTableParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::HASH_TABLE)
+        throw ProgramError("Table parameter to "s + builtinName + " must be a hash table");
+
+    return static_cast<HashTableExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the integer array an INT_ARRAY expression refers to.
+ */
+static IntArrayExpr *intArrayParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::INT_ARRAY)
+        throw ProgramError("Parameter to "s + builtinName + " must be an integer array");
+
+    return static_cast<IntArrayExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the persistent vector an IVECTOR expression refers to.
+ */
+static IVectorExpr *ivectorParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::IVECTOR)
+        throw ProgramError("First parameter to "s + builtinName + " must be a persistent vector");
+
+    return static_cast<IVectorExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the persistent map an IMAP expression refers to.
+ */
+static IMapExpr *imapParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::IMAP)
+        throw ProgramError("First parameter to "s + builtinName + " must be a persistent map");
+
+    return static_cast<IMapExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the value of a numeric parameter.
+ */
+static int64_t numericParam(const Eptr &expr, const char *builtinName,
+                            const char *paramName = "VALUE") {
+    if (expr->type() != Expr::Type::NUMERIC)
+        throw ProgramError(paramName + " parameter to "s + builtinName + " must be numeric");
+
+    return static_cast<NumericExpr*>(expr.get())->getValue();
+}
+
+static int64_t indexParam(const Eptr &expr, const char *builtinName) {
+    return numericParam(expr, builtinName, "Index");
+}
+
+/**
+ * \brief Get the values of two integer arrays of the same length.
+ */
+static std::pair<const std::vector<int64_t>*, const std::vector<int64_t>*>
+intArrayPairParam(const Elist &parameters, const char *builtinName) {
+    auto &a = intArrayParam(parameters[0], builtinName)->getValues();
+    auto &b = intArrayParam(parameters[1], builtinName)->getValues();
+
+    if (a.size() != b.size())
+        throw ProgramError("Arrays given to "s + builtinName + " differ in length");
+
+    return { &a, &b };
+}
+
+/**
+ * \brief Allocate an integer array of LENGTH values.
+ */
+static IntArrayEptr makeIntArray(size_t length) {
+    // Count the values, so that budgets catch huge arrays before they
+    // are allocated.
+    budget::alloc(length);
+
+    return std::make_shared<IntArrayExpr>(std::vector<int64_t>(length));
+}
+
+static const Builtin builtins[] = {
+
+    // Vectors {{{
+
+    { "vector",
+      { },
+      "items",
+      "Create a vector containing ITEMS.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<VectorExpr>(std::move(rest));
+      } },
+
+    { "make-vector",
+      { {"length"}, {"fill", true} },
+      "",
+      "Create a vector of LENGTH items, all set to FILL.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t length = indexParam(parameters[0], "MAKE-VECTOR");
+          if (length < 0)
+              throw ProgramError("Length parameter to MAKE-VECTOR must not be negative");
+
+          // Count the items, so that budgets catch huge vectors
+          // before they are allocated.
+          budget::alloc(length);
+
+          return std::make_shared<VectorExpr>(Elist(length, parameters[1]));
+      } },
+
+    { "vector?",
+      { {"thing"} },
+      "",
+      "Return t if THING is a vector.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              parameters[0]->type() == Expr::Type::VECTOR ? "t" : "nil");
+      } },
+
+    { "vref",
+      { {"vector"}, {"index"} },
+      "",
+      "Return the item at INDEX in VECTOR. Indices start at 0.\n"
+      "VECTOR may also be an integer array.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t index = indexParam(parameters[1], "VREF");
+
+          if (parameters[0]->type() == Expr::Type::INT_ARRAY)
+              return std::make_shared<NumericExpr>(
+                  static_cast<IntArrayExpr*>(parameters[0].get())->at(index));
+
+          return vectorParam(parameters[0], "VREF")->at(index);
+      } },
+
+    { "vset!",
+      { {"vector"}, {"index"}, {"value"} },
+      "",
+      "Replace the item at INDEX in VECTOR with VALUE. Return VALUE.\n"
+      "VECTOR may also be an integer array, if VALUE is numeric.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t index = indexParam(parameters[1], "VSET!");
+
+          if (parameters[0]->type() == Expr::Type::INT_ARRAY)
+              static_cast<IntArrayExpr*>(parameters[0].get())->at(index)
+                  = numericParam(parameters[2], "VSET!");
+          else
+              vectorParam(parameters[0], "VSET!")->at(index) = parameters[2];
+
+          return parameters[2];
+      } },
+
+    { "vlength",
+      { {"vector"} },
+      "",
+      "Return the number of items in VECTOR, which may also be an integer array.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (parameters[0]->type() == Expr::Type::INT_ARRAY)
+              return std::make_shared<NumericExpr>(
+                  static_cast<IntArrayExpr*>(parameters[0].get())->size());
+
+          return std::make_shared<NumericExpr>(vectorParam(parameters[0], "VLENGTH")->size());
+      } },
+
+    { "vpush",
+      { {"vector"}, {"value"} },
+      "",
+      "Append VALUE to the end of VECTOR. Return VECTOR.\n"
+      "VECTOR may also be an integer array, if VALUE is numeric.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (parameters[0]->type() == Expr::Type::INT_ARRAY)
+              static_cast<IntArrayExpr*>(parameters[0].get())->getValues()
+                  .push_back(numericParam(parameters[1], "VPUSH"));
+          else
+              vectorParam(parameters[0], "VPUSH")->getItems().push_back(parameters[1]);
+
+          return parameters[0];
+      } },
+
+    { "list->vector",
+      { {"list"} },
+      "",
+      "Create a vector containing the items in LIST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr = parameters[0];
+
+          if (expr->isNil())
+              return std::make_shared<VectorExpr>();
+
+          if (expr->type() != Expr::Type::CONS
+              || !static_cast<ConsExpr*>(expr.get())->isList())
+              throw ProgramError("Parameter to LIST->VECTOR must be a list");
+
+          return std::make_shared<VectorExpr>(static_cast<ConsExpr*>(expr.get())->asList());
+      } },
+
+    { "vector->list",
+      { {"vector"} },
+      "",
+      "Create a list containing the items in VECTOR.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ConsExpr::fromList(vectorParam(parameters[0], "VECTOR->LIST")->getItems());
+      } },
+
+    // }}}
+    // Integer arrays {{{
+
+    { "int-array",
+      { },
+      "values",
+      "Create an integer array containing the numerics in VALUES.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto array = makeIntArray(rest.size());
+          auto &values = array->getValues();
+
+          for (size_t i = 0; i < rest.size(); i++)
+              values[i] = numericParam(rest[i], "INT-ARRAY");
+
+          return array;
+      } },
+
+    { "make-int-array",
+      { {"length"}, {"fill", true} },
+      "",
+      "Create an integer array of LENGTH values, all set to FILL (default 0).",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t length = indexParam(parameters[0], "MAKE-INT-ARRAY");
+          if (length < 0)
+              throw ProgramError("Length parameter to MAKE-INT-ARRAY must not be negative");
+
+          int64_t fill = parameters[1]->isNil() ? 0 : numericParam(parameters[1], "MAKE-INT-ARRAY");
+
+          auto array = makeIntArray(length);
+          std::fill(array->getValues().begin(), array->getValues().end(), fill);
+          return array;
+      } },
+
+    { "int-array?",
+      { {"thing"} },
+      "",
+      "Return t if THING is an integer array.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              parameters[0]->type() == Expr::Type::INT_ARRAY ? "t" : "nil");
+      } },
+
+    { "array-range",
+      { {"start"}, {"end"} },
+      "",
+      "Create an integer array of the numbers from START up to, but not including, END.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t start = numericParam(parameters[0], "ARRAY-RANGE", "Start");
+          int64_t end   = numericParam(parameters[1], "ARRAY-RANGE", "End");
+
+          auto array = makeIntArray(end > start ? (uint64_t)end - (uint64_t)start : 0);
+          auto &values = array->getValues();
+
+          for (size_t i = 0; i < values.size(); i++)
+              values[i] = start + i;
+
+          return array;
+      } },
+
+    { "list->int-array",
+      { {"list"} },
+      "",
+      "Create an integer array from the numerics in LIST, which may also be a vector.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr = parameters[0];
+          Elist items;
+
+          if (expr->type() == Expr::Type::VECTOR)
+              items = static_cast<VectorExpr*>(expr.get())->getItems();
+          else if (expr->type() == Expr::Type::CONS
+                   && static_cast<ConsExpr*>(expr.get())->isList())
+              items = static_cast<ConsExpr*>(expr.get())->asList();
+          else if (!expr->isNil())
+              throw ProgramError("Parameter to LIST->INT-ARRAY must be a list or vector");
+
+          auto array = makeIntArray(items.size());
+          auto &values = array->getValues();
+
+          for (size_t i = 0; i < items.size(); i++)
+              values[i] = numericParam(items[i], "LIST->INT-ARRAY");
+
+          return array;
+      } },
+
+    { "int-array->list",
+      { {"array"} },
+      "",
+      "Create a list of the values in integer array ARRAY.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "INT-ARRAY->LIST")->getValues();
+
+          Elist items;
+          items.reserve(values.size());
+          for (int64_t value : values)
+              items.push_back(std::make_shared<NumericExpr>(value));
+
+          return ConsExpr::fromList(items);
+      } },
+
+    { "array-add",
+      { {"a"}, {"b"} },
+      "",
+      "Return an integer array of the sums of the values in integer arrays A and B.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto arrays = intArrayPairParam(parameters, "ARRAY-ADD");
+          auto result = makeIntArray(arrays.first->size());
+
+          simd::add(arrays.first->data(), arrays.second->data(),
+                    result->getValues().data(), result->size());
+          return result;
+      } },
+
+    { "array-mul",
+      { {"a"}, {"b"} },
+      "",
+      "Return an integer array of the products of the values in integer arrays A and B.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto arrays = intArrayPairParam(parameters, "ARRAY-MUL");
+          auto result = makeIntArray(arrays.first->size());
+
+          simd::mul(arrays.first->data(), arrays.second->data(),
+                    result->getValues().data(), result->size());
+          return result;
+      } },
+
+    { "array-scale",
+      { {"array"}, {"factor"} },
+      "",
+      "Return an integer array of the values in integer array ARRAY multiplied by FACTOR.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "ARRAY-SCALE")->getValues();
+          auto result  = makeIntArray(values.size());
+
+          simd::scale(values.data(), numericParam(parameters[1], "ARRAY-SCALE", "Factor"),
+                      result->getValues().data(), result->size());
+          return result;
+      } },
+
+    { "array-prefix-sum",
+      { {"array"} },
+      "",
+      "Return an integer array of the running totals of the values in integer array ARRAY.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "ARRAY-PREFIX-SUM")->getValues();
+          auto result  = makeIntArray(values.size());
+
+          simd::prefixSum(values.data(), result->getValues().data(), result->size());
+          return result;
+      } },
+
+    { "array-sum",
+      { {"array"} },
+      "",
+      "Return the sum of the values in integer array ARRAY.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "ARRAY-SUM")->getValues();
+          return std::make_shared<NumericExpr>(simd::sum(values.data(), values.size()));
+      } },
+
+    { "array-dot",
+      { {"a"}, {"b"} },
+      "",
+      "Return the dot product of integer arrays A and B.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto arrays = intArrayPairParam(parameters, "ARRAY-DOT");
+          return std::make_shared<NumericExpr>(
+              simd::dot(arrays.first->data(), arrays.second->data(), arrays.first->size()));
+      } },
+
+    { "array-min",
+      { {"array"} },
+      "",
+      "Return the smallest value in integer array ARRAY, or nil if it is empty.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "ARRAY-MIN")->getValues();
+          if (values.empty())
+              return std::make_shared<SymbolExpr>("nil");
+
+          return std::make_shared<NumericExpr>(simd::min(values.data(), values.size()));
+      } },
+
+    { "array-max",
+      { {"array"} },
+      "",
+      "Return the largest value in integer array ARRAY, or nil if it is empty.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto &values = intArrayParam(parameters[0], "ARRAY-MAX")->getValues();
+          if (values.empty())
+              return std::make_shared<SymbolExpr>("nil");
+
+          return std::make_shared<NumericExpr>(simd::max(values.data(), values.size()));
+      } },
+
+    { "simd-level",
+      { },
+      "",
+      "Return the instruction set the integer array kernels use: scalar, sse2 or avx2.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(simd::name(simd::level()));
+      } },
+
+    // }}}
+    // Hash tables {{{
+
+    { "make-hash",
+      { {"size", true} },
+      "",
+      "Create an empty hash table, with room for SIZE entries if given.\n"
+      "Keys are compared with EQUAL.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t size = parameters[0]->isNil() ? 0 : numericParam(parameters[0], "MAKE-HASH", "Size");
+          if (size < 0)
+              throw ProgramError("Size parameter to MAKE-HASH must not be negative");
+
+          budget::alloc(size);
+
+          return std::make_shared<HashTableExpr>(size);
+      } },
+
+    { "hash-table?",
+      { {"thing"} },
+      "",
+      "Return t if THING is a hash table.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              parameters[0]->type() == Expr::Type::HASH_TABLE ? "t" : "nil");
+      } },
+
+    { "gethash",
+      { {"key"}, {"table"}, {"default", true} },
+      "",
+      "Return the value of KEY in TABLE, or DEFAULT if KEY is not in TABLE.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          Eptr value = hashTableParam(parameters[1], "GETHASH")->get(parameters[0]);
+          return value ? value : parameters[2];
+      } },
+
+    { "puthash",
+      { {"key"}, {"value"}, {"table"} },
+      "",
+      "Set the value of KEY in TABLE to VALUE. Return VALUE.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          hashTableParam(parameters[2], "PUTHASH")->put(parameters[0], parameters[1]);
+          return parameters[1];
+      } },
+
+    { "remhash",
+      { {"key"}, {"table"} },
+      "",
+      "Remove KEY from TABLE. Return t if it was there, nil otherwise.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              hashTableParam(parameters[1], "REMHASH")->remove(parameters[0]) ? "t" : "nil");
+      } },
+
+    { "hash-count",
+      { {"table"} },
+      "",
+      "Return the number of entries in TABLE.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<NumericExpr>(hashTableParam(parameters[0], "HASH-COUNT")->size());
+      } },
+
+    { "maphash",
+      { {"func"}, {"table"} },
+      "",
+      "Call FUNC with the key and value of every entry in TABLE, in no particular order.\n"
+      "FUNC may modify TABLE: it is called for the entries TABLE had beforehand.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (parameters[0]->type() != Expr::Type::FUNC)
+              throw ProgramError("First parameter to MAPHASH must be a function");
+
+          Fptr func = static_cast<FuncExpr*>(parameters[0].get())->getValue();
+
+          for (auto &entry : hashTableParam(parameters[1], "MAPHASH")->entries())
+              func->apply({ entry.first, entry.second }, env);
+
+          return std::make_shared<SymbolExpr>("nil");
+      } },
+
+    { "hash-keys",
+      { {"table"} },
+      "",
+      "Return a list of the keys in TABLE, in no particular order.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Elist keys;
+          for (auto &entry : hashTableParam(parameters[0], "HASH-KEYS")->entries())
+              keys.push_back(std::move(entry.first));
+
+          return ConsExpr::fromList(keys);
+      } },
+
+    { "equal",
+      { {"a"}, {"b"} },
+      "",
+      "Return t if A and B are equal: numerics, strings and symbols by value,\n"
+      "conses and persistent collections by their contents, and anything else\n"
+      "only if they are the same object.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              structuralEqual(*parameters[0], *parameters[1]) ? "t" : "nil");
+      } },
+
+    // }}}
+    // Persistent collections {{{
+
+    { "ivector",
+      { },
+      "items",
+      "Create a persistent vector containing ITEMS.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return IVectorExpr::fromList(rest);
+      } },
+
+    { "ivector?",
+      { {"thing"} },
+      "",
+      "Return t if THING is a persistent vector.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              parameters[0]->type() == Expr::Type::IVECTOR ? "t" : "nil");
+      } },
+
+    { "ivref",
+      { {"vector"}, {"index"} },
+      "",
+      "Return the item at INDEX in persistent VECTOR. Indices start at 0.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ivectorParam(parameters[0], "IVREF")->at(indexParam(parameters[1], "IVREF"));
+      } },
+
+    { "ivset",
+      { {"vector"}, {"index"}, {"value"} },
+      "",
+      "Return a copy of persistent VECTOR with the item at INDEX replaced by VALUE.\n"
+      "VECTOR itself is not modified.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ivectorParam(parameters[0], "IVSET")
+              ->set(indexParam(parameters[1], "IVSET"), parameters[2]);
+      } },
+
+    { "ivpush",
+      { {"vector"}, {"value"} },
+      "",
+      "Return a copy of persistent VECTOR with VALUE appended.\n"
+      "VECTOR itself is not modified.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ivectorParam(parameters[0], "IVPUSH")->push(parameters[1]);
+      } },
+
+    { "ivpop",
+      { {"vector"} },
+      "",
+      "Return a copy of persistent VECTOR without its last item.\n"
+      "VECTOR itself is not modified.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ivectorParam(parameters[0], "IVPOP")->pop();
+      } },
+
+    { "ivlength",
+      { {"vector"} },
+      "",
+      "Return the number of items in persistent VECTOR.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<NumericExpr>(ivectorParam(parameters[0], "IVLENGTH")->size());
+      } },
+
+    { "list->ivector",
+      { {"list"} },
+      "",
+      "Create a persistent vector containing the items in LIST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr = parameters[0];
+
+          if (expr->isNil())
+              return std::make_shared<IVectorExpr>();
+
+          if (expr->type() != Expr::Type::CONS
+              || !static_cast<ConsExpr*>(expr.get())->isList())
+              throw ProgramError("Parameter to LIST->IVECTOR must be a list");
+
+          return IVectorExpr::fromList(static_cast<ConsExpr*>(expr.get())->asList());
+      } },
+
+    { "ivector->list",
+      { {"vector"} },
+      "",
+      "Create a list containing the items in persistent VECTOR.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return ConsExpr::fromList(ivectorParam(parameters[0], "IVECTOR->LIST")->items());
+      } },
+
+    { "imap",
+      { },
+      "keys-and-values",
+      "Create a persistent map from alternating KEYS-AND-VALUES.\n"
+      "Keys are compared with EQUAL.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (rest.size() % 2)
+              throw ProgramError("IMAP needs a value for every key");
+
+          IMapEptr map = std::make_shared<IMapExpr>();
+          for (size_t i = 0; i < rest.size(); i += 2)
+              map = map->put(rest[i], rest[i+1]);
+
+          return map;
+      } },
+
+    { "imap?",
+      { {"thing"} },
+      "",
+      "Return t if THING is a persistent map.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(
+              parameters[0]->type() == Expr::Type::IMAP ? "t" : "nil");
+      } },
+
+    { "imap-get",
+      { {"map"}, {"key"}, {"default", true} },
+      "",
+      "Return the value of KEY in persistent MAP, or DEFAULT if KEY is not in MAP.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          Eptr value = imapParam(parameters[0], "IMAP-GET")->get(parameters[1]);
+          return value ? value : parameters[2];
+      } },
+
+    { "imap-put",
+      { {"map"}, {"key"}, {"value"} },
+      "",
+      "Return a copy of persistent MAP with KEY set to VALUE.\n"
+      "MAP itself is not modified.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return imapParam(parameters[0], "IMAP-PUT")->put(parameters[1], parameters[2]);
+      } },
+
+    { "imap-remove",
+      { {"map"}, {"key"} },
+      "",
+      "Return a copy of persistent MAP without KEY.\n"
+      "MAP itself is not modified.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return imapParam(parameters[0], "IMAP-REMOVE")->remove(parameters[1]);
+      } },
+
+    { "imap-count",
+      { {"map"} },
+      "",
+      "Return the number of entries in persistent MAP.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<NumericExpr>(imapParam(parameters[0], "IMAP-COUNT")->size());
+      } },
+
+    { "imap-keys",
+      { {"map"} },
+      "",
+      "Return a list of the keys in persistent MAP, in no particular order.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Elist keys;
+          imapParam(parameters[0], "IMAP-KEYS")->forEach([&](const IMapExpr::Entry &entry) {
+              keys.push_back(entry.key);
+          });
+
+          return ConsExpr::fromList(keys);
+      } },
+
+    { "imap-entries",
+      { {"map"} },
+      "",
+      "Return a list of (KEY . VALUE) pairs for the entries in persistent MAP,\n"
+      "in no particular order.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Elist entries;
+          imapParam(parameters[0], "IMAP-ENTRIES")->forEach([&](const IMapExpr::Entry &entry) {
+              entries.push_back(std::make_shared<ConsExpr>(entry.key, entry.value));
+          });
+
+          return ConsExpr::fromList(entries);
+      } },
+
+    // }}}
+    // Structures {{{
+
+    { "defstruct",
+      { {"name"} },
+      "slots",
+      "Define a structure type NAME with the given SLOTS (symbols), and the functions\n"
+      "  (make-NAME SLOT...)            create a NAME, slots not given are nil\n"
+      "  (NAME? THING)                  return t if THING is a NAME\n"
+      "  (NAME-SLOT INSTANCE)           return the value of SLOT\n"
+      "  (set-NAME-SLOT! INSTANCE VALUE) set SLOT to VALUE\n"
+      "Slot access takes constant time. Return NAME.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (parameters[0]->type() != Expr::Type::SYMBOL || parameters[0]->isNil())
+              throw ProgramError("First parameter to DEFSTRUCT must be a symbol");
+
+          auto structType  = std::make_shared<StructType>();
+          structType->name = static_cast<SymbolExpr*>(parameters[0].get())->getValue();
+
+          std::unordered_set<std::string> seen;
+
+          for (const auto &slot : rest) {
+              if (slot->type() != Expr::Type::SYMBOL || slot->isNil())
+                  throw ProgramError("Slot names given to DEFSTRUCT must be symbols");
+
+              const std::string &slotName = static_cast<SymbolExpr*>(slot.get())->getValue();
+              if (!seen.insert(slotName).second)
+                  throw ProgramError("Duplicate slot '" + slotName + "' given to DEFSTRUCT");
+
+              structType->slotNames.push_back(slotName);
+          }
+
+          auto define = [&](FuncStruct::Kind kind, size_t slot) {
+              auto func = std::make_shared<FuncStruct>(structType, kind, slot);
+              env->setDeepest(func->getName(), std::make_shared<FuncExpr>(func));
+          };
+
+          define(FuncStruct::Kind::CONSTRUCTOR, 0);
+          define(FuncStruct::Kind::PREDICATE,   0);
+
+          for (size_t i = 0; i < structType->slotNames.size(); i++) {
+              define(FuncStruct::Kind::GETTER, i);
+              define(FuncStruct::Kind::SETTER, i);
+          }
+
+          return parameters[0];
+      } },
+
+    // }}}
+};
+
+const BuiltinTable collectionBuiltins = { std::begin(builtins), std::end(builtins) };
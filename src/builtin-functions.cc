@@ -5,502 +5,917 @@
  * \copyright Copyright (c) 2016, 2017, Chris Smeele
  * \license   MIT, see LICENSE.
  */
-#include "function.hh"
+#include "builtins.hh"
+#include "bignum.hh"
+#include "budget.hh"
+#include "green-thread.hh"
+#include "heap-profile.hh"
+#include "perf-counters.hh"
+#include "print.hh"
+#include "stats.hh"
 
 #include <iostream>
-#include <cmath>
-
-void registerBuiltinFunctions(Env &env) {
-
-    // env.setHere(FUNCTION_NAME, std::make_shared<FuncC>(FuncC(
-    //     {{ POSITIONAL_PARAM_NAME },
-    //      { POSITIONAL_PARAM_NAME, DEFAULT_VALUE }},
-    //     {{ KEYVALUE_PARAM_NAME }},
-    //      { KEYVALUE_PARAM_NAME, DEFAULT_VALUE }},
-    //     REST_PARAM_NAME, // empty string => no rest allowed
-    //     DOC_STRING,
-    //     SPECIAL_BOOL,
-    //     [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-    //         IMPLEMENTATION
-    //     })));
+#include <functional>
+#include <unordered_map>
+
+/**
+ * \brief Compare integers A and B with OP.
+ */
+template<typename Op>
+static bool compareIntegers(const Expr &a, const Expr &b, Op op) {
+    if (a.type() == Expr::Type::NUMERIC && b.type() == Expr::Type::NUMERIC)
+        return op(static_cast<const NumericExpr&>(a).getValue(),
+                  static_cast<const NumericExpr&>(b).getValue());
+
+    return op(toBignum(a).compare(toBignum(b)), 0);
+}
+
+/**
+ * \brief Check that NUM and each numeric in REST are in the order
+ *        given by OP.
+ */
+template<typename Op>
+static Eptr compareNumerics(const char *name, const Eptr &num, const Elist &rest, Op op) {
+
+    if (!isInteger(*num))
+        throw ProgramError("Parameter to "s + name + " is not numeric");
+
+    const Expr *previous = num.get();
+    bool        result   = true;
+
+    for (auto &expr : rest) {
+        if (!isInteger(*expr))
+            throw ProgramError("Parameter to "s + name + " is not numeric");
+
+        result   = result && compareIntegers(*previous, *expr, op);
+        previous = expr.get();
+    }
+
+    return std::make_shared<SymbolExpr>(result ? "t" : "nil");
+}
+
+/// Results of ** may take at most this many bits.
+static const uint64_t maxPowerBits = (uint64_t)1 << 30;
+
+/**
+ * \brief Raise BASE to the power EXPONENT, where EXPONENT is not
+ *        representable as a numeric, or negative.
+ *
+ * Only bases 0, 1 and -1 give results that are not 0 or too large.
+ */
+static Eptr powerSpecial(const Bignum &base, const Bignum &exponent) {
+    bool odd = !exponent.isZero() && (exponent.getLimbs()[0] & 1);
+
+    if (base == Bignum(1) || (base == Bignum(-1) && !odd))
+        return std::make_shared<NumericExpr>(1);
+    if (base == Bignum(-1))
+        return std::make_shared<NumericExpr>(-1);
+
+    if (exponent.isNegative()) {
+        if (base.isZero())
+            throw ProgramError("Division by zero in **");
+        // The result is a fraction, which truncates to zero.
+        return std::make_shared<NumericExpr>(0);
+    }
+
+    if (base.isZero())
+        return std::make_shared<NumericExpr>(0);
+
+    throw ProgramError("Result of ** is too large");
+}
+
+// { FUNCTION_NAME,
+//   {{ POSITIONAL_PARAM_NAME },
+//    { POSITIONAL_PARAM_NAME, true }}, // true => optional, defaults to nil
+//   REST_PARAM_NAME, // empty string => no rest allowed
+//   DOC_STRING,
+//   SPECIAL_BOOL,
+//   [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+//       IMPLEMENTATION
+//   } },
+
+static const Builtin builtins[] = {
 
     // Core features {{{
 
-    env.setHere("quote", std::make_shared<FuncC>(FuncC(
-        { {"thing"} },
-        { },
-        "",
-        "Return expression THING without evaluating it.",
-        true,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            return std::move(parameters.at(0));
-        })));
-
-    env.setHere("print", std::make_shared<FuncC>(FuncC(
-        { {"thing"} },
-        { },
-        "",
-        "Print the textual representation of THING and return it.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            std::cout << parameters.at(0)->repr() << "\n";
-            return std::move(parameters.at(0));
-        })));
-
-    env.setHere("doc", std::make_shared<FuncC>(FuncC(
-        { {"symbol"} },
-        { },
-        "",
-        "Get documentation on SYMBOL.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            auto expr1 = parameters.at(0);
-            if (expr1->type() != Expr::Type::SYMBOL)
-                throw ProgramError("First parameter to DOC must be a symbol");
-
-            auto symName = static_cast<SymbolExpr*>(expr1.get())->getValue();
-
-            std::string doc = "";
-
-            auto sym = env->lookup(symName);
-            if (sym->type() == Expr::Type::FUNC) {
-                doc = static_cast<FuncExpr*>(sym.get())->getDoc(symName) + "\n";
-            } else {
-                throw LogicError("Unimplemented");
-            }
-
-            return std::make_shared<StringExpr>(doc);
-        })));
+    { "quote",
+      { {"thing"} },
+      "",
+      "Return expression THING without evaluating it.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::move(parameters.at(0));
+      } },
+
+    { "print",
+      { {"thing"} },
+      "",
+      "Print the textual representation of THING and return it.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          output() << parameters.at(0)->repr() << "\n";
+          return std::move(parameters.at(0));
+      } },
+
+    { "doc",
+      { {"symbol"} },
+      "",
+      "Get documentation on SYMBOL.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr1 = parameters.at(0);
+          if (expr1->type() != Expr::Type::SYMBOL)
+              throw ProgramError("First parameter to DOC must be a symbol");
+
+          auto symName = static_cast<SymbolExpr*>(expr1.get())->getValue();
+
+          std::string doc = "";
+
+          auto sym = env->lookup(symName);
+          if (sym->type() == Expr::Type::FUNC) {
+              doc = static_cast<FuncExpr*>(sym.get())->getDoc(symName) + "\n";
+          } else {
+              throw LogicError("Unimplemented");
+          }
+
+          return std::make_shared<StringExpr>(doc);
+      } },
 
     // }}}
     // Environment manipulation {{{
 
-    env.setHere("let", std::make_shared<FuncC>(FuncC(
-        { {"decls"} },
-        { },
-        "body",
-        "Bind DECLS in a new environment, and evaluate BODY in the new environment.",
-        true,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            // The environment in which we will eval our body.
-            auto subEnv = std::make_shared<Env>(env);
-
-            auto declsExpr = parameters.at(0);
-            if (!declsExpr->isNil()) {
-                if (declsExpr->type() != Expr::Type::CONS)
-                    throw ProgramError("First parameter of let must be a declaration list");
-
-                auto declsCons = static_cast<ConsExpr*>(declsExpr.get());
-
-                if (!declsCons->isList())
-                    throw ProgramError("First parameter of let must be a declaration list");
-
-                // Define given symbols in subEnv.
-                for (auto declCons : *declsCons) {
-                    auto car = declCons->getCar();
-                    if (car->type() == Expr::Type::CONS) {
-                        // ((sym value)) declaration.
-                        auto declCons = static_cast<ConsExpr*>(car.get());
-                        if (!declCons->isList())
-                            throw ProgramError("Invalid let syntax (1)");
-
-                        auto declList = declCons->asList();
-                        if (declList.size() != 2)
-                            throw ProgramError("Invalid let syntax (2)");
-
-                        if (declList[0]->type() != Expr::Type::SYMBOL)
-                            throw ProgramError("Invalid let syntax (3)");
-
-                        auto symExpr = static_cast<SymbolExpr*>(declList[0].get());
-                        subEnv->setHere(symExpr->getValue(),
-                                        declList[1]->eval(env));
-
-                    } else if (car->type() == Expr::Type::SYMBOL) {
-                        // (sym) declaration (sym is set to nil).
-                        auto symExpr = static_cast<SymbolExpr*>(car.get());
-                        subEnv->setHere(symExpr->getValue(),
-                                        std::make_shared<SymbolExpr>("nil"));
-                    } else {
-                        throw ProgramError("Invalid let syntax (0)");
-                    }
-                }
-            }
-
-            Eptr result = nullptr;
-
-            // Evaluate body.
-            for (auto &expr : rest)
-                result = expr->eval(subEnv);
-
-            if (!result)
-                result = std::make_shared<SymbolExpr>("nil");
-
-            return std::move(result);
-        })));
-
-    env.setHere("set", std::make_shared<FuncC>(FuncC(
-        { {"symbol"},
-          { "value", std::make_shared<SymbolExpr>("nil") } },
-        { },
-        "",
-        "Set SYMBOL to VALUE, return VALUE.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            auto expr1 = parameters.at(0);
-            auto expr2 = parameters.at(1);
-
-            if (expr1->type() != Expr::Type::SYMBOL)
-                throw ProgramError("First parameter to SET must be a symbol");
-
-            env->setDeepest(static_cast<SymbolExpr*>(expr1.get())->getValue(),
-                            expr2);
-
-            return std::move(expr2);
-        })));
+    { "let",
+      { {"decls"} },
+      "body",
+      "Bind DECLS in a new environment, and evaluate BODY in the new environment.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          // The environment in which we will eval our body.
+          auto subEnv = std::make_shared<Env>(env);
+
+          auto declsExpr = parameters.at(0);
+          if (!declsExpr->isNil()) {
+              if (declsExpr->type() != Expr::Type::CONS)
+                  throw ProgramError("First parameter of let must be a declaration list");
+
+              auto declsCons = static_cast<ConsExpr*>(declsExpr.get());
+
+              if (!declsCons->isList())
+                  throw ProgramError("First parameter of let must be a declaration list");
+
+              // Define given symbols in subEnv.
+              for (auto declCons : *declsCons) {
+                  auto car = declCons->getCar();
+                  if (car->type() == Expr::Type::CONS) {
+                      // ((sym value)) declaration.
+                      auto declCons = static_cast<ConsExpr*>(car.get());
+                      if (!declCons->isList())
+                          throw ProgramError("Invalid let syntax (1)");
+
+                      auto declList = declCons->asList();
+                      if (declList.size() != 2)
+                          throw ProgramError("Invalid let syntax (2)");
+
+                      if (declList[0]->type() != Expr::Type::SYMBOL)
+                          throw ProgramError("Invalid let syntax (3)");
+
+                      auto symExpr = static_cast<SymbolExpr*>(declList[0].get());
+                      subEnv->setHere(symExpr->getValue(),
+                                      declList[1]->eval(env));
+
+                  } else if (car->type() == Expr::Type::SYMBOL) {
+                      // (sym) declaration (sym is set to nil).
+                      auto symExpr = static_cast<SymbolExpr*>(car.get());
+                      subEnv->setHere(symExpr->getValue(),
+                                      std::make_shared<SymbolExpr>("nil"));
+                  } else {
+                      throw ProgramError("Invalid let syntax (0)");
+                  }
+              }
+          }
+
+          Eptr result = nullptr;
+
+          // Evaluate body.
+          for (auto &expr : rest)
+              result = expr->eval(subEnv);
+
+          if (!result)
+              result = std::make_shared<SymbolExpr>("nil");
+
+          return std::move(result);
+      } },
+
+    { "set",
+      { {"symbol"},
+        { "value", true } },
+      "",
+      "Set SYMBOL to VALUE, return VALUE.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr1 = parameters.at(0);
+          auto expr2 = parameters.at(1);
+
+          if (expr1->type() != Expr::Type::SYMBOL)
+              throw ProgramError("First parameter to SET must be a symbol");
+
+          env->setDeepest(static_cast<SymbolExpr*>(expr1.get())->getValue(),
+                          expr2);
+
+          return std::move(expr2);
+      } },
 
     // }}}
     // Data structures {{{
 
-    env.setHere("car", std::make_shared<FuncC>(FuncC(
-        { {"cons"} },
-        { },
-        "",
-        "Return the car of CONS.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            auto expr = parameters.at(0);
-
-            if (expr->isNil())
-                return std::make_shared<SymbolExpr>("nil");
-
-            if (expr->type() != Expr::Type::CONS)
-                throw ProgramError("First parameter to CAR must be a cons");
-
-            auto cons = static_cast<ConsExpr*>(expr.get());
-            return cons->getCar();
-        })));
-
-    env.setHere("cdr", std::make_shared<FuncC>(FuncC(
-        { {"cons"} },
-        { },
-        "",
-        "Return the cdr of CONS.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            auto expr = parameters.at(0);
-
-            if (expr->isNil())
-                return std::make_shared<SymbolExpr>("nil");
-
-            if (expr->type() != Expr::Type::CONS)
-                throw ProgramError("First parameter to CAR must be a cons");
-
-            auto cons = static_cast<ConsExpr*>(expr.get());
-            return cons->getCdr();
-        })));
-
-    env.setHere("cons", std::make_shared<FuncC>(FuncC(
-        { {"car"}, {"cdr"} },
-        { },
-        "",
-        "Create a cons from CAR and CDR.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            return std::make_shared<ConsExpr>(parameters.at(0),
-                                              parameters.at(1));
-        })));
-
-    env.setHere("list", std::make_shared<FuncC>(FuncC(
-        { },
-        { },
-        "rest",
-        "Create a list from REST.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            if (parameters.size()) {
-
-                auto rootCons = std::make_shared<ConsExpr>();
-                std::shared_ptr<ConsExpr> currentCons = rootCons;
-
-                for (auto expr : parameters) {
-                    if (currentCons->getCar()) {
-                        currentCons->getCdr() = std::make_shared<ConsExpr>();
-                        currentCons = std::static_pointer_cast<ConsExpr>(currentCons->getCdr());
-                    }
-                    currentCons->getCar() = expr;
-                }
-                currentCons->getCdr() = std::make_shared<SymbolExpr>("nil");
-
-                return std::move(rootCons);
-
-            } else {
-                return std::make_shared<SymbolExpr>("nil");
-            }
-        })));
+    { "car",
+      { {"cons"} },
+      "",
+      "Return the car of CONS.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr = parameters.at(0);
+
+          if (expr->isNil())
+              return std::make_shared<SymbolExpr>("nil");
+
+          if (expr->type() != Expr::Type::CONS)
+              throw ProgramError("First parameter to CAR must be a cons");
+
+          auto cons = static_cast<ConsExpr*>(expr.get());
+          return cons->getCar();
+      } },
+
+    { "cdr",
+      { {"cons"} },
+      "",
+      "Return the cdr of CONS.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          auto expr = parameters.at(0);
+
+          if (expr->isNil())
+              return std::make_shared<SymbolExpr>("nil");
+
+          if (expr->type() != Expr::Type::CONS)
+              throw ProgramError("First parameter to CAR must be a cons");
+
+          auto cons = static_cast<ConsExpr*>(expr.get());
+          return cons->getCdr();
+      } },
+
+    { "cons",
+      { {"car"}, {"cdr"} },
+      "",
+      "Create a cons from CAR and CDR.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<ConsExpr>(parameters.at(0),
+                                            parameters.at(1));
+      } },
+
+    { "list",
+      { },
+      "rest",
+      "Create a list from REST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (rest.size()) {
+
+              auto rootCons = std::make_shared<ConsExpr>();
+              std::shared_ptr<ConsExpr> currentCons = rootCons;
+
+              for (auto expr : rest) {
+                  if (currentCons->getCar()) {
+                      currentCons->getCdr() = std::make_shared<ConsExpr>();
+                      currentCons = std::static_pointer_cast<ConsExpr>(currentCons->getCdr());
+                  }
+                  currentCons->getCar() = expr;
+              }
+              currentCons->getCdr() = std::make_shared<SymbolExpr>("nil");
+
+              return std::move(rootCons);
+
+          } else {
+              return std::make_shared<SymbolExpr>("nil");
+          }
+      } },
 
     // }}}
     // Functions {{{
 
-    env.setHere("lambda", std::make_shared<FuncC>(FuncC(
-        { {"params"} },
-        { },
-        "body",
-        "Create an anonymous function.",
-        true,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            Func::Signature signature;
+    { "lambda",
+      { {"params"} },
+      "body",
+      "Create an anonymous function.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
 
-            std::string doc = "";
-            Eptr paramsExpr;
+          Func::Signature signature;
 
-            paramsExpr = parameters.at(0);
+          std::string doc = "";
+          Eptr paramsExpr;
 
-            if (!paramsExpr->isNil()) {
-                if (paramsExpr->type() != Expr::Type::CONS)
-                    throw ProgramError("First parameter to LAMBDA must be a cons");
+          paramsExpr = parameters.at(0);
 
-                auto paramsCons = static_cast<ConsExpr*>(paramsExpr.get());
-                if (!paramsCons->isList())
-                    throw ProgramError("First parameter to LAMBDA must be a list");
+          if (!paramsExpr->isNil()) {
+              if (paramsExpr->type() != Expr::Type::CONS)
+                  throw ProgramError("First parameter to LAMBDA must be a cons");
 
-                bool haveDefault = false; // Whether we have encountered a param with default value.
-                bool haveRest    = false; // Whether we have encountered '&rest'.
+              auto paramsCons = static_cast<ConsExpr*>(paramsExpr.get());
+              if (!paramsCons->isList())
+                  throw ProgramError("First parameter to LAMBDA must be a list");
 
-                for (ConsExpr *pexpr : *paramsCons) {
-                    Eptr car = pexpr->getCar();
+              bool haveDefault = false; // Whether we have encountered a param with default value.
+              bool haveRest    = false; // Whether we have encountered '&rest'.
 
-                    if (haveRest && signature.haveRest())
-                        // More parameters after a &rest name. Bad.
-                        throw ProgramError("Invalid lambda param spec");
+              for (ConsExpr *pexpr : *paramsCons) {
+                  Eptr car = pexpr->getCar();
 
-                    // (NAME DEFAULT)
-                    if (!haveRest && car->type() == Expr::Type::CONS) {
-                        auto consExpr = static_cast<ConsExpr*>(car.get());
+                  if (haveRest && signature.haveRest())
+                      // More parameters after a &rest name. Bad.
+                      throw ProgramError("Invalid lambda param spec");
 
-                        if (!consExpr->isList())
-                            throw ProgramError("Invalid lambda param spec");
+                  // (NAME DEFAULT)
+                  if (!haveRest && car->type() == Expr::Type::CONS) {
+                      auto consExpr = static_cast<ConsExpr*>(car.get());
 
-                        Eptr nameExpr  = (*consExpr)[0];
-                        Eptr valueExpr = (*consExpr)[1]; // Default value.
+                      if (!consExpr->isList())
+                          throw ProgramError("Invalid lambda param spec");
 
-                        if (nameExpr->type() != Expr::Type::SYMBOL)
-                            throw ProgramError("Invalid lambda param spec");
+                      Eptr nameExpr  = (*consExpr)[0];
+                      Eptr valueExpr = (*consExpr)[1]; // Default value.
 
-                        auto symExpr = static_cast<SymbolExpr*>(nameExpr.get());
+                      if (nameExpr->type() != Expr::Type::SYMBOL)
+                          throw ProgramError("Invalid lambda param spec");
 
-                        signature.positional.emplace_back(symExpr->getValue(), valueExpr);
+                      auto symExpr = static_cast<SymbolExpr*>(nameExpr.get());
 
-                        haveDefault = true;
+                      signature.positional.emplace_back(symExpr->getValue(), valueExpr);
 
-                    } else if (car->type() == Expr::Type::SYMBOL) {
-                        auto symExpr = static_cast<SymbolExpr*>(car.get());
+                      haveDefault = true;
 
-                        const std::string &name = symExpr->getValue();
+                  } else if (car->type() == Expr::Type::SYMBOL) {
+                      auto symExpr = static_cast<SymbolExpr*>(car.get());
 
-                        if (haveRest) {
-                            signature.rest = name;
-                        } else {
-                            if (name == "&rest") {
-                                haveRest = true;
-                            } else {
-                                if (haveDefault)
-                                    throw ProgramError("Invalid lambda param spec");
-                                signature.positional.emplace_back(symExpr->getValue());
-                            }
-                        }
-                    } else {
-                        throw ProgramError("Invalid lambda param spec");
-                    }
-                }
-            }
+                      const std::string &name = symExpr->getValue();
 
-            return std::make_shared<FuncExpr>(
-                std::make_shared<FuncLisp>(env, signature, "", false, rest));
+                      if (haveRest) {
+                          signature.rest = name;
+                      } else {
+                          if (name == "&rest") {
+                              haveRest = true;
+                          } else {
+                              if (haveDefault)
+                                  throw ProgramError("Invalid lambda param spec");
+                              signature.positional.emplace_back(symExpr->getValue());
+                          }
+                      }
+                  } else {
+                      throw ProgramError("Invalid lambda param spec");
+                  }
+              }
+          }
 
-        })));
+          return std::make_shared<FuncExpr>(
+              std::make_shared<FuncLisp>(env, signature, "", false, rest));
 
-    env.setHere("λ", env.lookup("lambda"));
+      } },
 
     // }}}
     // Condional execution {{{
 
-    env.setHere("when", std::make_shared<FuncC>(FuncC(
-        { {"condition"} },
-        { },
-        "body",
-        "Evaluate BODY only when CONDITION is non-nil.",
-        true,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            Eptr result = nullptr;
-
-            if (!parameters[0]->eval(env)->isNil()) {
-                for (auto &expr : rest)
-                    result = expr->eval(env);
-            }
-
-            if (!result)
-                result = std::make_shared<SymbolExpr>("nil");
-
-            return std::move(result);
-        })));
-
-    env.setHere("if", std::make_shared<FuncC>(FuncC(
-        { {"condition"},
-          {"true-case"},
-          {"false-case", std::make_shared<SymbolExpr>("nil")} },
-        { },
-        "",
-        "Evaluate TRUE-CASE when CONDITION is non-nil. Evaluate FALSE-CASE otherwise.",
-        true,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            Eptr result = nullptr;
-
-            if (parameters[0]->eval(env)->isNil()) {
-                // False case
-                return parameters[2]->eval(env);
-            } else {
-                // True case
-                return parameters[1]->eval(env);
-            }
-        })));
+    { "when",
+      { {"condition"} },
+      "body",
+      "Evaluate BODY only when CONDITION is non-nil.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Eptr result = nullptr;
+
+          if (!parameters[0]->eval(env)->isNil()) {
+              for (auto &expr : rest)
+                  result = expr->eval(env);
+          }
+
+          if (!result)
+              result = std::make_shared<SymbolExpr>("nil");
+
+          return std::move(result);
+      } },
+
+    { "if",
+      { {"condition"},
+        {"true-case"},
+        {"false-case", true} },
+      "",
+      "Evaluate TRUE-CASE when CONDITION is non-nil. Evaluate FALSE-CASE otherwise.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Eptr result = nullptr;
+
+          if (parameters[0]->eval(env)->isNil()) {
+              // False case
+              return parameters[2]->eval(env);
+          } else {
+              // True case
+              return parameters[1]->eval(env);
+          }
+      } },
+
+    // }}}
+    // Evaluation limits {{{
+
+    { "with-budget",
+      { {"steps"}, {"allocs"} },
+      "body",
+      "Evaluate BODY, failing once it makes more than STEPS function calls or\n"
+      "creates more than ALLOCS values. Either limit may be nil for no limit.\n"
+      "The budget is checked at intervals (see --check-interval), so evaluation may\n"
+      "overshoot a limit slightly before it fails.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          budget::Limits limits;
+          uint64_t *fields[] = { &limits.steps, &limits.allocs };
+
+          for (int i = 0; i < 2; i++) {
+              Eptr limit = parameters[i]->eval(env);
+              if (limit->isNil())
+                  continue;
+
+              if (limit->type() != Expr::Type::NUMERIC
+                  || static_cast<NumericExpr*>(limit.get())->getValue() < 1)
+                  throw ProgramError("WITH-BUDGET limits must be positive numbers or nil");
+
+              *fields[i] = static_cast<NumericExpr*>(limit.get())->getValue();
+          }
+
+          budget::Scope scope(limits);
+
+          Eptr result = std::make_shared<SymbolExpr>("nil");
+          for (auto &expr : rest)
+              result = expr->eval(env);
+
+          return result;
+      } },
+
+    // }}}
+    // Profiling {{{
+
+    { "heap-profile",
+      { },
+      "",
+      "Return a report of the values created so far, per type and per call site.\n"
+      "Only available when started with --heap-profile.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (!heapprof::enabled)
+              throw ProgramError("The heap profiler is not enabled (see --heap-profile)");
+
+          return std::make_shared<StringExpr>(heapprof::report());
+      } },
+
+    { "interp-stats",
+      { },
+      "",
+      "Return the interpreter statistics counted so far, as an alist of counter\n"
+      "names and values. LOOKUP-HOPS lists how many symbol lookups searched 0, 1,\n"
+      "2... parent environments. Only available when started with --stats.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (!stats::enabled)
+              throw ProgramError("Statistics are not enabled (see --stats)");
+
+          auto totals = stats::totals();
+          Elist entries;
+
+          auto entry = [&](const char *name, Eptr value) {
+              entries.push_back(std::make_shared<ConsExpr>(std::make_shared<SymbolExpr>(name),
+                                                           value));
+          };
+
+          for (size_t i = 0; i < (size_t)stats::Counter::COUNT; i++)
+              entry(stats::name((stats::Counter)i),
+                    std::make_shared<NumericExpr>(totals.counts[i]));
+
+          entry("live-objects",      std::make_shared<NumericExpr>(totals.liveObjects));
+          entry("peak-live-objects", std::make_shared<NumericExpr>(totals.peakLiveObjects));
+
+          Elist hops;
+          for (auto count : totals.lookupHops)
+              hops.push_back(std::make_shared<NumericExpr>(count));
+          entry("lookup-hops", ConsExpr::fromList(hops));
+
+          return ConsExpr::fromList(entries);
+      } },
+
+    { "with-perf-counters",
+      { {"events"} },
+      "body",
+      "Evaluate BODY while counting the hardware performance counters named in the\n"
+      "list EVENTS (cycles, instructions, cache-references, cache-misses,\n"
+      "branches, branch-misses). Return an alist of the counts, ending with the\n"
+      "value of BODY as RESULT. Only the calling thread is counted: a green thread\n"
+      "does not yield while BODY runs, and fails if BODY waits for a future or a\n"
+      "channel. Fails when the counters are not available on this system.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          std::vector<perf::Event> events;
+          if (!parameters[0]->isNil()) {
+              if (parameters[0]->type() != Expr::Type::CONS
+                  || !static_cast<ConsExpr*>(parameters[0].get())->isList())
+                  throw ProgramError("WITH-PERF-COUNTERS events must be a list of names");
+
+              for (auto cons : *static_cast<ConsExpr*>(parameters[0].get())) {
+                  if (cons->getCar()->type() != Expr::Type::SYMBOL)
+                      throw ProgramError("WITH-PERF-COUNTERS events must be a list of names");
+                  events.push_back(perf::eventByName(cons->getCar()->repr()));
+              }
+          }
+
+          Eptr result = std::make_shared<SymbolExpr>("nil");
+          std::vector<uint64_t> counts;
+          {
+              // Counters count this OS thread only.
+              GreenThread::Pin pin;
+              perf::Counters   counters(events);
+
+              for (auto &expr : rest)
+                  result = expr->eval(env);
+
+              if (pin.wasSuspended())
+                  throw ProgramError("WITH-PERF-COUNTERS body was suspended,"
+                                     " its counts would include other work");
+
+              counts = counters.read();
+          }
+
+          Elist entries;
+          for (size_t i = 0; i < events.size(); i++)
+              entries.push_back(std::make_shared<ConsExpr>(std::make_shared<SymbolExpr>(perf::name(events[i])),
+                                                           std::make_shared<NumericExpr>(counts[i])));
+
+          entries.push_back(std::make_shared<ConsExpr>(std::make_shared<SymbolExpr>("result"),
+                                                       result));
+
+          return ConsExpr::fromList(entries);
+      } },
 
     // }}}
     // Predicates {{{
 
-    env.setHere("zero?", std::make_shared<FuncC>(FuncC(
-        { {"numeric"} },
-        { },
-        "",
-        "Return t if NUMERIC equals zero.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            if (parameters[0]->type() == Expr::Type::NUMERIC) {
-                auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
-                return numExpr->getValue() == 0
-                    ? std::make_shared<SymbolExpr>("t")
-                    : std::make_shared<SymbolExpr>("nil");
-            } else {
-                throw ProgramError("Parameter to zero? is not numeric");
-            }
-        })));
-
-    env.setHere("one?", std::make_shared<FuncC>(FuncC(
-        { {"numeric"} },
-        { },
-        "",
-        "Return t if NUMERIC equals one.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            if (parameters[0]->type() == Expr::Type::NUMERIC) {
-                auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
-                return numExpr->getValue() == 1
-                    ? std::make_shared<SymbolExpr>("t")
-                    : std::make_shared<SymbolExpr>("nil");
-            } else {
-                throw ProgramError("Parameter to one? is not numeric");
-            }
-        })));
+    { "zero?",
+      { {"numeric"} },
+      "",
+      "Return t if NUMERIC equals zero.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (parameters[0]->type() == Expr::Type::NUMERIC) {
+              auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
+              return numExpr->getValue() == 0
+                  ? std::make_shared<SymbolExpr>("t")
+                  : std::make_shared<SymbolExpr>("nil");
+          } else if (parameters[0]->type() == Expr::Type::BIGNUM) {
+              // Integers that fit in a numeric are never bignums.
+              return std::make_shared<SymbolExpr>("nil");
+          } else {
+              throw ProgramError("Parameter to zero? is not numeric");
+          }
+      } },
+
+    { "one?",
+      { {"numeric"} },
+      "",
+      "Return t if NUMERIC equals one.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (parameters[0]->type() == Expr::Type::NUMERIC) {
+              auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
+              return numExpr->getValue() == 1
+                  ? std::make_shared<SymbolExpr>("t")
+                  : std::make_shared<SymbolExpr>("nil");
+          } else if (parameters[0]->type() == Expr::Type::BIGNUM) {
+              // Integers that fit in a numeric are never bignums.
+              return std::make_shared<SymbolExpr>("nil");
+          } else {
+              throw ProgramError("Parameter to one? is not numeric");
+          }
+      } },
+
+    { "not",
+      { {"expr"} },
+      "",
+      "Return t if EXPR is nil, nil otherwise.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return std::make_shared<SymbolExpr>(parameters[0]->isNil() ? "t" : "nil");
+      } },
+
+    // }}}
+    // Comparison {{{
+
+    { "=",
+      { {"num"} },
+      "rest",
+      "Return t if NUM and all numerics in REST are equal.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return compareNumerics("=", parameters[0], rest, std::equal_to<int64_t>());
+      } },
+
+    { "<",
+      { {"num"} },
+      "rest",
+      "Return t if NUM and the numerics in REST are strictly increasing.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return compareNumerics("<", parameters[0], rest, std::less<int64_t>());
+      } },
+
+    { ">",
+      { {"num"} },
+      "rest",
+      "Return t if NUM and the numerics in REST are strictly decreasing.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return compareNumerics(">", parameters[0], rest, std::greater<int64_t>());
+      } },
+
+    { "<=",
+      { {"num"} },
+      "rest",
+      "Return t if NUM and the numerics in REST are increasing.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return compareNumerics("<=", parameters[0], rest, std::less_equal<int64_t>());
+      } },
+
+    { ">=",
+      { {"num"} },
+      "rest",
+      "Return t if NUM and the numerics in REST are decreasing.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return compareNumerics(">=", parameters[0], rest, std::greater_equal<int64_t>());
+      } },
+
+    // }}}
+    // Strings {{{
+
+    { "concat",
+      { },
+      "rest",
+      "Concatenate the strings in REST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          std::string result;
+
+          for (auto &expr : rest) {
+              if (expr->type() != Expr::Type::STRING)
+                  throw ProgramError("Parameter to concat is not a string");
+
+              result += static_cast<StringExpr*>(expr.get())->getValue();
+          }
+
+          return std::make_shared<StringExpr>(result);
+      } },
 
     // }}}
     // Arithmetic operators {{{
 
-    env.setHere("+", std::make_shared<FuncC>(FuncC(
-        { },
-        { },
-        "rest",
-        "Sum all numerics in REST.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-            int64_t result = 0;
-            for (const auto &expr : rest) {
-                if (expr.get()->type() != Expr::Type::NUMERIC)
-                    throw ProgramError("Parameter '"s + expr->repr() + "' is not numeric");
-                auto numExpr = static_cast<const NumericExpr*>(expr.get());
-
-                result += numExpr->getValue();
-            }
-            return std::make_shared<NumericExpr>(result);
-        })));
-
-    env.setHere("-", std::make_shared<FuncC>(FuncC(
-        { {"num"} },
-        { },
-        "rest",
-        "Negate NUM, or, when REST is given, subtract all of REST from NUM.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            if (parameters[0]->type() != Expr::Type::NUMERIC)
-                throw ProgramError("Parameter to - is not numeric");
-
-            auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
-
-            int64_t result = numExpr->getValue();
-
-            if (rest.size()) {
-                for (auto expr : rest) {
-                    if (expr->type() != Expr::Type::NUMERIC)
-                        throw ProgramError("Parameter to - is not numeric");
-
-                    auto numExpr = static_cast<NumericExpr*>(expr.get());
-                    result -= numExpr->getValue();
-                }
-            } else {
-                result = -result;
-            }
-
-            return std::make_shared<NumericExpr>(result);
-        })));
-
-    env.setHere("*", std::make_shared<FuncC>(FuncC(
-        { },
-        { },
-        "rest",
-        "Return the product of REST.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            int64_t result = 1;
-
-            for (auto expr : rest) {
-                if (expr->type() != Expr::Type::NUMERIC)
-                    throw ProgramError("Parameter to * is not numeric");
-
-                auto numExpr = static_cast<NumericExpr*>(expr.get());
-                result *= numExpr->getValue();
-            }
-
-            return std::make_shared<NumericExpr>(result);
-        })));
-
-    env.setHere("**", std::make_shared<FuncC>(FuncC(
-        { {"x"}, {"y"} },
-        { },
-        "",
-        "Raise X to the Yth power.",
-        false,
-        [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
-
-            if (parameters[0]->type() != Expr::Type::NUMERIC)
-                throw ProgramError("Parameter to ** is not numeric");
-            auto numExpr1 = static_cast<NumericExpr*>(parameters[0].get());
-
-            if (parameters[1]->type() != Expr::Type::NUMERIC)
-                throw ProgramError("Parameter to ** is not numeric");
-            auto numExpr2 = static_cast<NumericExpr*>(parameters[1].get());
-
-            return std::make_shared<NumericExpr>(
-                std::pow(numExpr1->getValue(), numExpr2->getValue()));
-        })));
+    { "+",
+      { },
+      "rest",
+      "Sum all numerics in REST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          int64_t result = 0;
+          size_t  i      = 0;
+
+          for (; i < rest.size(); i++) {
+              if (rest[i]->type() != Expr::Type::NUMERIC)
+                  break;
+              auto numExpr = static_cast<const NumericExpr*>(rest[i].get());
+
+              int64_t sum;
+              if (__builtin_add_overflow(result, numExpr->getValue(), &sum))
+                  break;
+              result = sum;
+          }
+
+          if (i == rest.size())
+              return std::make_shared<NumericExpr>(result);
+
+          // Continue with bignums after an overflow or a bignum.
+          Bignum bigResult = result;
+
+          for (; i < rest.size(); i++) {
+              if (!isInteger(*rest[i]))
+                  throw ProgramError("Parameter '"s + rest[i]->repr() + "' is not numeric");
+
+              bigResult = bigResult + toBignum(*rest[i]);
+          }
+          return makeIntegerExpr(std::move(bigResult));
+      } },
+
+    { "-",
+      { {"num"} },
+      "rest",
+      "Negate NUM, or, when REST is given, subtract all of REST from NUM.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (parameters[0]->type() == Expr::Type::NUMERIC) {
+              auto numExpr = static_cast<NumericExpr*>(parameters[0].get());
+
+              int64_t result = numExpr->getValue();
+              bool overflow  = false;
+
+              if (rest.size()) {
+                  for (const auto &expr : rest) {
+                      if (expr->type() != Expr::Type::NUMERIC) {
+                          overflow = true;
+                          break;
+                      }
+
+                      auto numExpr = static_cast<NumericExpr*>(expr.get());
+                      if ((overflow = __builtin_sub_overflow(result, numExpr->getValue(), &result)))
+                          break;
+                  }
+              } else {
+                  overflow = __builtin_sub_overflow(0, result, &result);
+              }
+
+              if (!overflow)
+                  return std::make_shared<NumericExpr>(result);
+          }
+
+          // Start over with bignums after an overflow or a bignum.
+          if (!isInteger(*parameters[0]))
+              throw ProgramError("Parameter to - is not numeric");
+
+          Bignum result = toBignum(*parameters[0]);
+
+          if (rest.size()) {
+              for (const auto &expr : rest) {
+                  if (!isInteger(*expr))
+                      throw ProgramError("Parameter to - is not numeric");
+
+                  result = result - toBignum(*expr);
+              }
+          } else {
+              result = -result;
+          }
+
+          return makeIntegerExpr(std::move(result));
+      } },
+
+    { "*",
+      { },
+      "rest",
+      "Return the product of REST.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          int64_t result = 1;
+          size_t  i      = 0;
+
+          for (; i < rest.size(); i++) {
+              if (rest[i]->type() != Expr::Type::NUMERIC)
+                  break;
+              auto numExpr = static_cast<NumericExpr*>(rest[i].get());
+
+              int64_t product;
+              if (__builtin_mul_overflow(result, numExpr->getValue(), &product))
+                  break;
+              result = product;
+          }
+
+          if (i == rest.size())
+              return std::make_shared<NumericExpr>(result);
+
+          // Continue with bignums after an overflow or a bignum.
+          Bignum bigResult = result;
+
+          for (; i < rest.size(); i++) {
+              if (!isInteger(*rest[i]))
+                  throw ProgramError("Parameter to * is not numeric");
+
+              bigResult = bigResult * toBignum(*rest[i]);
+          }
+
+          return makeIntegerExpr(std::move(bigResult));
+      } },
+
+    { "**",
+      { {"x"}, {"y"} },
+      "",
+      "Raise X to the Yth power. Negative powers truncate to an integer.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          if (!isInteger(*parameters[0]) || !isInteger(*parameters[1]))
+              throw ProgramError("Parameter to ** is not numeric");
+
+          if (parameters[1]->type() != Expr::Type::NUMERIC
+              || static_cast<NumericExpr*>(parameters[1].get())->getValue() < 0)
+              return powerSpecial(toBignum(*parameters[0]), toBignum(*parameters[1]));
+
+          uint64_t exponent = static_cast<NumericExpr*>(parameters[1].get())->getValue();
+
+          if (parameters[0]->type() == Expr::Type::NUMERIC) {
+              // Square and multiply, as long as that does not overflow.
+              int64_t base     = static_cast<NumericExpr*>(parameters[0].get())->getValue();
+              int64_t result   = 1;
+              bool    overflow = false;
+
+              for (uint64_t e = exponent; e; e >>= 1) {
+                  if ((e & 1) && (overflow = __builtin_mul_overflow(result, base, &result)))
+                      break;
+                  if (e > 1 && (overflow = __builtin_mul_overflow(base, base, &base)))
+                      break;
+              }
+
+              if (!overflow)
+                  return std::make_shared<NumericExpr>(result);
+          }
+
+          Bignum base = toBignum(*parameters[0]);
+
+          // Refuse results that cannot reasonably fit in memory, and
+          // count the rest against the allocation budget up front.
+          const auto &limbs = base.getLimbs();
+          uint64_t    bits  = limbs.size() * 64 - __builtin_clzll(limbs.back());
+
+          if (__builtin_mul_overflow(bits, exponent, &bits) || bits > maxPowerBits)
+              throw ProgramError("Result of ** is too large");
+
+          budget::alloc(bits / 64);
+
+          return makeIntegerExpr(base.pow(exponent));
+      } },
 
     // }}}
+};
+
+const BuiltinTable coreBuiltins = { std::begin(builtins), std::end(builtins) };
+
+/**
+ * \brief Alternative names for builtins.
+ */
+static const struct {
+    const char *alias;
+    const char *name;
+} builtinAliases[] = {
+    { "λ", "lambda" },
+};
+
+/**
+ * \brief Instantiate all builtin functions and constants.
+ *
+ * This happens once per process. All root environments share the
+ * resulting values.
+ */
+static std::unordered_map<std::string, Eptr> makeBuiltins() {
+
+    static const BuiltinTable *tables[] = {
+        &coreBuiltins,
+        &parallelBuiltins,
+        &collectionBuiltins,
+    };
+
+    std::unordered_map<std::string, Eptr> builtins;
+
+    for (auto table : tables) {
+        for (auto builtin = table->begin; builtin != table->end; builtin++)
+            builtins[builtin->name] = std::make_shared<FuncExpr>(std::make_shared<FuncC>(*builtin));
+    }
+
+    for (const auto &alias : builtinAliases)
+        builtins[alias.alias] = builtins.at(alias.name);
+
+    builtins["nil"]             = std::make_shared<SymbolExpr>("nil");
+    builtins["t"]               = std::make_shared<SymbolExpr>("t");
+    builtins["*matig-version*"] = std::make_shared<NumericExpr>(0);
+    builtins["*magic*"]         = std::make_shared<NumericExpr>(539);
+
+    return builtins;
+}
+
+Eptr lookupBuiltin(const std::string &name) {
+    static const auto builtins = makeBuiltins();
+
+    auto it = builtins.find(name);
+    return it == builtins.end() ? nullptr : it->second;
 }
@@ -0,0 +1,474 @@
+/**
+ * \file
+ * \brief     Parallel builtin functions.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "builtins.hh"
+#include "channel.hh"
+#include "future.hh"
+#include "green-thread.hh"
+#include "hash-table.hh"
+#include "persistent.hh"
+#include "struct.hh"
+#include "print.hh"
+#include "thread-pool.hh"
+#include "vector.hh"
+
+#include <algorithm>
+
+/**
+ * \brief Get the function a FUNC expression refers to.
+ */
+static Fptr funcParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::FUNC)
+        throw ProgramError("First parameter to "s + builtinName + " must be a function");
+
+    return static_cast<FuncExpr*>(expr.get())->getValue();
+}
+
+/**
+ * \brief Get the items of a list or vector parameter.
+ */
+static Elist listParam(const Eptr &expr, const char *builtinName,
+                       const char *paramName = "LIST") {
+    if (expr->isNil())
+        return { };
+
+    if (expr->type() == Expr::Type::VECTOR)
+        return static_cast<VectorExpr*>(expr.get())->getItems();
+
+    if (expr->type() == Expr::Type::IVECTOR)
+        return static_cast<IVectorExpr*>(expr.get())->items();
+
+    if (expr->type() != Expr::Type::CONS
+        || !static_cast<ConsExpr*>(expr.get())->isList())
+        throw ProgramError("Parameter "s + paramName + " to " + builtinName
+                           + " must be a list or vector");
+
+    return static_cast<ConsExpr*>(expr.get())->asList();
+}
+
+/**
+ * \brief Make a list of ITEMS, or a vector if LIKE is a (persistent)
+ *        vector.
+ */
+static Eptr listLike(const Eptr &like, Elist items) {
+    if (like->type() == Expr::Type::VECTOR)
+        return std::make_shared<VectorExpr>(std::move(items));
+
+    if (like->type() == Expr::Type::IVECTOR)
+        return IVectorExpr::fromList(items);
+
+    return ConsExpr::fromList(items);
+}
+
+/**
+ * \brief Get what to put in a channel for VALUE.
+ *
+ * Channels pass values by reference, which is only safe for values
+ * that cannot change. Vectors, integer arrays, hash tables and
+ * structures are copied instead (the items they contain are not).
+ */
+static Eptr channelValue(const Eptr &value) {
+    if (value->type() == Expr::Type::VECTOR)
+        return std::make_shared<VectorExpr>(static_cast<VectorExpr*>(value.get())->getItems());
+
+    if (value->type() == Expr::Type::INT_ARRAY)
+        return std::make_shared<IntArrayExpr>(static_cast<IntArrayExpr*>(value.get())->getValues());
+
+    if (value->type() == Expr::Type::HASH_TABLE)
+        return std::make_shared<HashTableExpr>(*static_cast<HashTableExpr*>(value.get()));
+
+    if (value->type() == Expr::Type::STRUCT)
+        return std::make_shared<StructExpr>(*static_cast<StructExpr*>(value.get()));
+
+    return value;
+}
+
+/**
+ * \brief Get the future a FUTURE expression refers to.
+ */
+static FutureExpr *futureParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::FUTURE)
+        throw ProgramError("Parameter to "s + builtinName + " must be a future");
+
+    return static_cast<FutureExpr*>(expr.get());
+}
+
+/**
+ * \brief Get the channel a CHANNEL expression refers to.
+ */
+static ChannelExpr *channelParam(const Eptr &expr, const char *builtinName) {
+    if (expr->type() != Expr::Type::CHANNEL)
+        throw ProgramError("Parameter to "s + builtinName + " must be a channel");
+
+    return static_cast<ChannelExpr*>(expr.get());
+}
+
+/**
+ * \brief Run BODY over index ranges that together cover [0, COUNT).
+ *
+ * Ranges are evaluated in parallel, each in its own child environment
+ * of ENV. Output printed by BODY goes where the caller's output goes,
+ * and every range runs with the caller's budget limits and write layer.
+ */
+template<typename F>
+static void parallelChunks(size_t count, EnvPtr env, F body) {
+    ThreadPool &pool = ThreadPool::instance();
+
+    // A few chunks per worker, so that stealing can even out the load.
+    size_t chunkCount = std::min(count, (size_t)pool.size() * 4);
+
+    if (chunkCount <= 1) {
+        if (count)
+            body(0, count, std::make_shared<Env>(env));
+        return;
+    }
+
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    std::ostream *out = &output();
+    budget::Limits limits = budget::currentLimits();
+    EnvPtr layer = Env::writeLayer;
+
+    env->share();
+    Env::setConcurrent();
+
+    TaskGroup group(pool);
+
+    for (size_t start = 0; start < count; start += chunkSize) {
+        size_t end = std::min(start + chunkSize, count);
+
+        group.run([=, &group, &body]{
+            OutputRedirect  redirect(*out);
+            budget::Scope   scope(limits);
+            Env::WriteLayer writeLayer(layer);
+            auto workerEnv = std::make_shared<Env>(env);
+
+            if (!group.hasFailed())
+                body(start, end, workerEnv);
+        });
+    }
+
+    group.wait();
+}
+
+static const Builtin builtins[] = {
+
+    { "pmap",
+      { {"func"}, {"list"} },
+      "",
+      "Apply FUNC to every item in LIST in parallel, return a list of the results in order.\n"
+      "LIST may also be a (persistent) vector, in which case one is returned.\n"
+      "FUNC must not have side effects.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Fptr  func  = funcParam(parameters[0], "PMAP");
+          Elist items = listParam(parameters[1], "PMAP");
+
+          Elist results(items.size());
+
+          parallelChunks(items.size(), env, [&](size_t start, size_t end, EnvPtr workerEnv) {
+              for (size_t i = start; i < end; i++)
+                  results[i] = func->apply({ items[i] }, workerEnv);
+          });
+
+          return listLike(parameters[1], std::move(results));
+      } },
+
+    { "pfilter",
+      { {"func"}, {"list"} },
+      "",
+      "Return the items in LIST for which FUNC returns non-nil, testing items in parallel.\n"
+      "LIST may also be a (persistent) vector, in which case one is returned.\n"
+      "FUNC must not have side effects.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Fptr  func  = funcParam(parameters[0], "PFILTER");
+          Elist items = listParam(parameters[1], "PFILTER");
+
+          std::vector<char> keep(items.size());
+
+          parallelChunks(items.size(), env, [&](size_t start, size_t end, EnvPtr workerEnv) {
+              for (size_t i = start; i < end; i++)
+                  keep[i] = !func->apply({ items[i] }, workerEnv)->isNil();
+          });
+
+          Elist results;
+          for (size_t i = 0; i < items.size(); i++) {
+              if (keep[i])
+                  results.push_back(std::move(items[i]));
+          }
+
+          return listLike(parameters[1], std::move(results));
+      } },
+
+    { "preduce",
+      { {"func"}, {"list"} },
+      "initial",
+      "Combine the items in LIST with FUNC, starting with INITIAL if given.\n"
+      "Parts of LIST are reduced in parallel, so FUNC must be associative and must not have side effects.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Fptr  func  = funcParam(parameters[0], "PREDUCE");
+          Elist items = listParam(parameters[1], "PREDUCE");
+
+          if (rest.size() > 1)
+              throw ProgramError("PREDUCE takes at most one initial value");
+
+          if (items.empty())
+              return rest.size() ? rest[0] : std::make_shared<SymbolExpr>("nil");
+
+          // Reduce chunks in parallel, then combine their results in order.
+          std::vector<std::pair<size_t, Eptr>> partials;
+          std::mutex partialsMutex;
+
+          parallelChunks(items.size(), env, [&](size_t start, size_t end, EnvPtr workerEnv) {
+              Eptr acc = items[start];
+              for (size_t i = start + 1; i < end; i++)
+                  acc = func->apply({ acc, items[i] }, workerEnv);
+
+              std::lock_guard<std::mutex> lock(partialsMutex);
+              partials.emplace_back(start, acc);
+          });
+
+          std::sort(partials.begin(), partials.end(),
+                    [](const std::pair<size_t, Eptr> &a,
+                       const std::pair<size_t, Eptr> &b) {
+                        return a.first < b.first; });
+
+          Eptr result = rest.size() ? rest[0] : nullptr;
+
+          for (auto &partial : partials)
+              result = result ? func->apply({ result, partial.second }, env) : partial.second;
+
+          return result;
+      } },
+
+    { "spawn",
+      { {"expr"} },
+      "",
+      "Start evaluating EXPR on a background worker, return a future for its result.\n"
+      "EXPR sees the bindings of the spawning scope by reference, like a closure would.\n"
+      "Unlike GO, EXPR keeps its worker until it finishes, except while it waits for\n"
+      "a channel or future.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return spawn(parameters[0], env);
+      } },
+
+    { "go",
+      { {"expr"} },
+      "",
+      "Start evaluating EXPR in a new green thread, return a future for its result.\n"
+      "Green threads take turns on the worker threads at budget checks (see\n"
+      "--check-interval).",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return GreenThread::start(parameters[0], env);
+      } },
+
+    { "yield",
+      { },
+      "",
+      "Let other green threads run. Does nothing outside of green threads.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (GreenThread::current())
+              GreenThread::current()->yield();
+
+          return std::make_shared<SymbolExpr>("nil");
+      } },
+
+    { "chan",
+      { {"capacity", true} },
+      "",
+      "Create a channel that holds up to CAPACITY values, or any number of values\n"
+      "if no CAPACITY is given.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          if (parameters[0]->isNil())
+              return makeChannel(0);
+
+          if (parameters[0]->type() != Expr::Type::NUMERIC
+              || static_cast<NumericExpr*>(parameters[0].get())->getValue() < 1)
+              throw ProgramError("CHAN capacity must be a positive number");
+
+          return makeChannel(static_cast<NumericExpr*>(parameters[0].get())->getValue());
+      } },
+
+    { "send",
+      { {"channel"}, {"value"} },
+      "",
+      "Send VALUE over CHANNEL, waiting while the channel is full. Return VALUE.\n"
+      "Vectors, integer arrays, hash tables and structures are sent as a copy.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          channelParam(parameters[0], "SEND")->send(channelValue(parameters[1]));
+          return parameters[1];
+      } },
+
+    { "recv",
+      { {"channel"} },
+      "",
+      "Receive a value from CHANNEL, waiting while the channel is empty.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return channelParam(parameters[0], "RECV")->recv();
+      } },
+
+    { "select",
+      { },
+      "clauses",
+      "Perform the first channel operation that is possible, and evaluate the\n"
+      "body of its clause. Clauses look like:\n"
+      "\n"
+      "  ((recv CHANNEL VAR) BODY...)   VAR is bound to the received value\n"
+      "  ((send CHANNEL VALUE) BODY...)\n"
+      "  (default BODY...)               If no operation is possible right away\n"
+      "\n"
+      "Without a default clause, wait until an operation is possible.",
+      true,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          struct Clause {
+              bool         isSend;
+              ChannelExpr *channel;
+              Eptr         value;   // Sent or received.
+              std::string  var;
+              Elist        body;
+          };
+
+          std::vector<Clause> clauses;
+          std::vector<ChannelExpr*> channels;
+          Elist channelRefs;
+          const Elist *defaultBody = nullptr;
+          Elist defaultClause;
+
+          for (auto &clauseExpr : rest) {
+              if (clauseExpr->type() != Expr::Type::CONS
+                  || !static_cast<ConsExpr*>(clauseExpr.get())->isList())
+                  throw ProgramError("SELECT clauses must be lists");
+
+              Elist clause = static_cast<ConsExpr*>(clauseExpr.get())->asList();
+
+              if (clause[0]->type() == Expr::Type::SYMBOL
+                  && static_cast<SymbolExpr*>(clause[0].get())->getValue() == "default") {
+
+                  if (defaultBody)
+                      throw ProgramError("SELECT takes at most one default clause");
+
+                  defaultClause.assign(clause.begin() + 1, clause.end());
+                  defaultBody = &defaultClause;
+                  continue;
+              }
+
+              Elist op;
+              if (clause[0]->type() == Expr::Type::CONS
+                  && static_cast<ConsExpr*>(clause[0].get())->isList())
+                  op = static_cast<ConsExpr*>(clause[0].get())->asList();
+
+              std::string opName = op.size() == 3 && op[0]->type() == Expr::Type::SYMBOL
+                                 ? static_cast<SymbolExpr*>(op[0].get())->getValue()
+                                 : "";
+
+              if (opName == "recv" && op[2]->type() != Expr::Type::SYMBOL)
+                  throw ProgramError("SELECT recv clause needs a variable name");
+              if (opName != "recv" && opName != "send")
+                  throw ProgramError("SELECT clauses must start with (recv CHANNEL VAR), "
+                                     "(send CHANNEL VALUE) or default");
+
+              Clause c;
+              c.isSend = opName == "send";
+
+              Eptr channelRef = op[1]->eval(env);
+              c.channel = channelParam(channelRef, "SELECT");
+              channelRefs.push_back(channelRef);
+              channels.push_back(c.channel);
+
+              if (c.isSend)
+                  c.value = channelValue(op[2]->eval(env));
+              else
+                  c.var = static_cast<SymbolExpr*>(op[2].get())->getValue();
+
+              c.body.assign(clause.begin() + 1, clause.end());
+              clauses.push_back(std::move(c));
+          }
+
+          Clause *chosen = nullptr;
+
+          auto attempt = [&]{
+              for (auto &clause : clauses) {
+                  if (clause.isSend ? clause.channel->trySend(clause.value)
+                                    : clause.channel->tryRecv(clause.value)) {
+                      chosen = &clause;
+                      return true;
+                  }
+              }
+              return false;
+          };
+
+          const Elist *body;
+          EnvPtr bodyEnv = env;
+
+          if (attempt() || !defaultBody) {
+              if (!chosen) {
+                  if (clauses.empty())
+                      throw ProgramError("SELECT without clauses would wait forever");
+                  waitOnChannels(channels, attempt);
+              }
+
+              body = &chosen->body;
+              if (!chosen->isSend) {
+                  bodyEnv = std::make_shared<Env>(env);
+                  bodyEnv->setHere(chosen->var, chosen->value);
+              }
+          } else {
+              body = defaultBody;
+          }
+
+          Eptr result = std::make_shared<SymbolExpr>("nil");
+          for (auto &expr : *body)
+              result = expr->eval(bodyEnv);
+
+          return result;
+      } },
+
+    { "await",
+      { {"future"} },
+      "",
+      "Wait for FUTURE to complete, return its result.\n"
+      "If evaluation failed, the error is raised again here.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+          return futureParam(parameters[0], "AWAIT")->await();
+      } },
+
+    { "await-all",
+      { {"futures"} },
+      "",
+      "Wait for all futures in the list FUTURES, return a list of their results.",
+      false,
+      [](Elist parameters, Emap kv, Elist rest, EnvPtr env) -> Eptr {
+
+          Elist futures = listParam(parameters[0], "AWAIT-ALL", "FUTURES");
+
+          // Check all parameters before blocking.
+          for (auto &future : futures)
+              futureParam(future, "AWAIT-ALL");
+
+          Elist results;
+          results.reserve(futures.size());
+
+          for (auto &future : futures)
+              results.push_back(static_cast<FutureExpr*>(future.get())->await());
+
+          return ConsExpr::fromList(results);
+      } },
+};
+
+const BuiltinTable parallelBuiltins = { std::begin(builtins), std::end(builtins) };
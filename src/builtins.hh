@@ -0,0 +1,22 @@
+/**
+ * \file
+ * \brief     Builtin function tables.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "function.hh"
+
+/**
+ * \brief A table of builtin function definitions.
+ */
+struct BuiltinTable {
+    const Builtin *begin;
+    const Builtin *end;
+};
+
+extern const BuiltinTable coreBuiltins;
+extern const BuiltinTable parallelBuiltins;
+extern const BuiltinTable collectionBuiltins;
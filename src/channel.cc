@@ -0,0 +1,340 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "channel.hh"
+#include "green-thread.hh"
+#include "rcu.hh"
+#include "thread-pool.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+
+namespace {
+
+/**
+ * \brief A bounded channel: an array-based MPMC queue.
+ *
+ * Positions are claimed with a CAS on the shared head or tail counter.
+ * Every cell carries a turn counter that says whose turn it is: on lap
+ * L a cell is written when its turn is 2L and read when it is 2L + 1.
+ * The claiming thread owns the cell's value until it bumps the turn.
+ */
+class BoundedChannel : public ChannelExpr {
+
+    struct Cell {
+        std::atomic<size_t> turn { 0 };
+        Eptr                value;
+    };
+
+    const size_t            capacity;
+    std::unique_ptr<Cell[]> cells;
+
+    // Padded onto separate cache lines, so that producers and
+    // consumers do not contend on the same line.
+    char                pad1[64];
+    std::atomic<size_t> tail { 0 };
+    char                pad2[64];
+    std::atomic<size_t> head { 0 };
+
+public:
+    bool trySend(const Eptr &value) override {
+        size_t pos = tail.load(std::memory_order_acquire);
+
+        while (true) {
+            Cell &cell = cells[pos % capacity];
+
+            if (cell.turn.load(std::memory_order_acquire) == 2 * (pos / capacity)) {
+                if (tail.compare_exchange_strong(pos, pos + 1)) {
+                    cell.value = value;
+                    cell.turn.store(2 * (pos / capacity) + 1, std::memory_order_release);
+                    notify();
+                    return true;
+                }
+            } else {
+                // The cell is still full, unless another sender moved on.
+                size_t previous = pos;
+                pos = tail.load(std::memory_order_acquire);
+                if (pos == previous)
+                    return false;
+            }
+        }
+    }
+
+    bool tryRecv(Eptr &value) override {
+        size_t pos = head.load(std::memory_order_acquire);
+
+        while (true) {
+            Cell &cell = cells[pos % capacity];
+
+            if (cell.turn.load(std::memory_order_acquire) == 2 * (pos / capacity) + 1) {
+                if (head.compare_exchange_strong(pos, pos + 1)) {
+                    value = std::move(cell.value);
+                    cell.turn.store(2 * (pos / capacity) + 2, std::memory_order_release);
+                    notify();
+                    return true;
+                }
+            } else {
+                size_t previous = pos;
+                pos = head.load(std::memory_order_acquire);
+                if (pos == previous)
+                    return false;
+            }
+        }
+    }
+
+    BoundedChannel(size_t capacity)
+        : capacity(capacity),
+          cells(new Cell[capacity]) {
+        profileAlloc(Type::CHANNEL, sizeof(*this) + capacity * sizeof(Cell));
+    }
+};
+
+/**
+ * \brief An unbounded channel: the Michael-Scott queue.
+ *
+ * A linked list with a dummy head node. Dequeued nodes are released
+ * through rcu, as other threads may still be looking at them.
+ */
+class UnboundedChannel : public ChannelExpr {
+
+    struct Node {
+        std::atomic<Node*> next { nullptr };
+        Eptr               value;
+    };
+
+    std::atomic<Node*> head;
+    std::atomic<Node*> tail;
+
+public:
+    bool trySend(const Eptr &value) override {
+        Node *node = new Node;
+        node->value = value;
+
+        {
+            rcu::ReadGuard guard;
+
+            while (true) {
+                Node *last = tail.load();
+                Node *next = last->next.load();
+
+                if (last != tail.load())
+                    continue;
+
+                if (next) {
+                    // Help a send that has not swung the tail yet.
+                    tail.compare_exchange_weak(last, next);
+
+                } else if (last->next.compare_exchange_weak(next, node)) {
+                    tail.compare_exchange_strong(last, node);
+                    break;
+                }
+            }
+        }
+
+        notify();
+        return true;
+    }
+
+    bool tryRecv(Eptr &value) override {
+        Node *first;
+        {
+            rcu::ReadGuard guard;
+
+            while (true) {
+                first = head.load();
+                Node *last = tail.load();
+                Node *next = first->next.load();
+
+                if (first != head.load())
+                    continue;
+
+                if (!next)
+                    return false;
+
+                if (first == last) {
+                    tail.compare_exchange_weak(last, next);
+
+                } else if (head.compare_exchange_weak(first, next)) {
+                    // Only the thread that dequeued NEXT touches its
+                    // value; it is the new dummy node.
+                    value = std::move(next->value);
+                    break;
+                }
+            }
+        }
+
+        rcu::retire(std::shared_ptr<const Node>(first));
+        notify();
+        return true;
+    }
+
+    UnboundedChannel() {
+        profileAlloc(Type::CHANNEL, sizeof(*this));
+
+        Node *dummy = new Node;
+        head = dummy;
+        tail = dummy;
+    }
+
+    ~UnboundedChannel() {
+        Node *node = head;
+        while (node) {
+            Node *next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+};
+
+/**
+ * \brief A one-shot wakeup for a waiting green thread or OS thread.
+ */
+class Wakeup {
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    bool                    fired = false;
+    std::function<void()>   resume;
+
+public:
+    void fire() {
+        std::function<void()> then;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fired)
+                return;
+            fired = true;
+            then  = std::move(resume);
+        }
+        cv.notify_all();
+
+        if (then)
+            then();
+    }
+
+    void wait() {
+        if (GreenThread *thread = GreenThread::current()) {
+            thread->suspend([this](std::function<void()> resumeThread) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!fired) {
+                        resume = std::move(resumeThread);
+                        return;
+                    }
+                }
+                resumeThread();
+            });
+
+        } else {
+            // Helping out keeps a pool task that waits here from
+            // starving the pool, like FutureExpr::await() does.
+            ThreadPool &pool = ThreadPool::instance();
+
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (fired)
+                        return;
+                }
+                if (pool.runOne())
+                    continue;
+
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait_for(lock, std::chrono::milliseconds(1),
+                            [this]{ return fired; });
+            }
+        }
+    }
+};
+
+}
+
+void ChannelExpr::notify() {
+    // Pairs with the fence in waitOnChannels(): either the waiter sees
+    // the change our caller just made, or we see the waiter. Without
+    // it, a release store of the change followed by this load may be
+    // reordered, and both sides miss each other.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (!waiterCount.load(std::memory_order_relaxed))
+        return;
+
+    std::vector<Waiter> woken;
+    {
+        std::lock_guard<std::mutex> lock(waitMutex);
+        woken.swap(waiters);
+        waiterCount = 0;
+    }
+
+    for (auto &waiter : woken)
+        waiter.wake();
+}
+
+unsigned ChannelExpr::addWaiter(std::function<void()> wake) {
+    std::lock_guard<std::mutex> lock(waitMutex);
+
+    unsigned id = nextWaiterId++;
+    waiters.push_back({ id, std::move(wake) });
+    waiterCount = waiters.size();
+
+    return id;
+}
+
+void ChannelExpr::removeWaiter(unsigned id) {
+    std::lock_guard<std::mutex> lock(waitMutex);
+
+    waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                 [id](const Waiter &waiter) {
+                                     return waiter.id == id; }),
+                  waiters.end());
+    waiterCount = waiters.size();
+}
+
+void ChannelExpr::send(const Eptr &value) {
+    waitOnChannels({ this }, [&]{ return trySend(value); });
+}
+
+Eptr ChannelExpr::recv() {
+    Eptr value;
+    waitOnChannels({ this }, [&]{ return tryRecv(value); });
+    return value;
+}
+
+void waitOnChannels(const std::vector<ChannelExpr*> &channels,
+                    std::function<bool()> attempt) {
+
+    while (!attempt()) {
+        auto wakeup = std::make_shared<Wakeup>();
+
+        std::vector<unsigned> ids;
+        for (auto channel : channels)
+            ids.push_back(channel->addWaiter([wakeup]{ wakeup->fire(); }));
+
+        // A change between the first attempt and registering would
+        // have gone unnoticed. The fence orders registering before the
+        // retry, see notify().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool done = attempt();
+        if (!done)
+            wakeup->wait();
+
+        for (size_t i = 0; i < channels.size(); i++)
+            channels[i]->removeWaiter(ids[i]);
+
+        if (done)
+            return;
+    }
+}
+
+ChannelEptr makeChannel(size_t capacity) {
+    if (capacity)
+        return std::make_shared<BoundedChannel>(capacity);
+    else
+        return std::make_shared<UnboundedChannel>();
+}
@@ -0,0 +1,98 @@
+/**
+ * \file
+ * \brief     Channels for passing values between concurrent evaluations.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * \brief Channel atom Expression type.
+ *
+ * A FIFO queue of values, bounded or unbounded. Values are passed by
+ * reference, which is safe because values cannot be mutated. Vectors,
+ * integer arrays and hash tables, which can, are copied by the
+ * builtins that send them.
+ *
+ * Sending and receiving take no locks. Unbounded channels hand
+ * dequeued nodes to rcu::retire(), which batches them per thread. Only
+ * threads that have to wait for a full or empty channel synchronize on
+ * a lock: green threads are suspended, other threads block.
+ */
+class ChannelExpr : public AtomExpr {
+
+    struct Waiter {
+        unsigned              id;
+        std::function<void()> wake;
+    };
+
+    std::atomic<size_t> waiterCount { 0 };
+    std::mutex          waitMutex;
+    std::vector<Waiter> waiters;
+    unsigned            nextWaiterId = 0;
+
+protected:
+    /**
+     * \brief Wake all waiters, after the channel has changed.
+     *
+     * Must be called after every change, however it was ordered: this
+     * orders the change before the check for waiters.
+     */
+    void notify();
+
+public:
+    Type type() const override { return Type::CHANNEL; }
+
+    std::string repr() const override { return "<channel>"; }
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    /**
+     * \return false if the channel is full
+     */
+    virtual bool trySend(const Eptr &value) = 0;
+
+    /**
+     * \return false if the channel is empty
+     */
+    virtual bool tryRecv(Eptr &value) = 0;
+
+    void send(const Eptr &value);
+    Eptr recv();
+
+    /**
+     * \brief Call WAKE on the next change to the channel.
+     *
+     * \return An id for removeWaiter()
+     */
+    unsigned addWaiter(std::function<void()> wake);
+    void removeWaiter(unsigned id);
+};
+
+typedef std::shared_ptr<ChannelExpr> ChannelEptr;
+
+/**
+ * \brief Create a channel.
+ *
+ * \param capacity The maximum number of queued values, 0 for no limit
+ */
+ChannelEptr makeChannel(size_t capacity);
+
+/**
+ * \brief Wait until ATTEMPT succeeds.
+ *
+ * ATTEMPT is retried whenever one of CHANNELS changes.
+ */
+void waitOnChannels(const std::vector<ChannelExpr*> &channels,
+                    std::function<bool()> attempt);
@@ -7,21 +7,90 @@
  */
 #include "environment.hh"
 #include "function.hh"
+#include "stats.hh"
+
+std::atomic<bool> Env::concurrent { false };
+
+thread_local EnvPtr Env::writeLayer;
+
+std::unique_lock<std::mutex> Env::lock() const {
+    if (shared.load(std::memory_order_relaxed)
+        && concurrent.load(std::memory_order_relaxed))
+        return std::unique_lock<std::mutex>(mutex);
+    else
+        return std::unique_lock<std::mutex>();
+}
+
+void Env::share() {
+    // Stop at the first shared frame: its ancestors are shared already.
+    for (Env *env = this; env && !env->shared; env = env->parent.get())
+        env->shared = true;
+}
+
+void Env::setConcurrent() {
+    concurrent = true;
+}
+
+void Env::freeze() {
+    if (!globals)
+        throw LogicError("Only root environments can be frozen");
+
+    globals->freeze();
+}
+
+EnvPtr Env::layer(EnvPtr base) {
+    base->freeze();
+    base->share();
+
+    auto env = std::make_shared<Env>();
+    env->base = std::move(base);
+    return env;
+}
+
+Env &Env::globalsOwner() {
+    if (!writeLayer || !globals->isFrozen())
+        return *this;
+
+    for (Env *env = writeLayer->base.get(); env; env = env->base.get()) {
+        if (env == this)
+            return *writeLayer;
+    }
+    return *this;
+}
 
 void Env::setHere(const std::string &name, Eptr expr) {
-    symbols[name] = expr;
+    if (globals) {
+        globalsOwner().globals->set(name, std::move(expr));
+        return;
+    }
+
+    Eptr old;
+    auto guard = lock();
+
+    // Let the previous value die outside the lock.
+    Eptr &slot = symbols[name];
+    old = std::move(slot);
+    slot = std::move(expr);
 }
 
 void Env::setDeepest(const std::string &name, Eptr expr) {
-    auto it = symbols.find(name);
-    if (it == symbols.end()) {
-        if (parent)
-            parent->setDeepest(name, expr);
-        else 
-            setHere(name, expr);
-    } else {
-        setHere(name, expr);
+    if (globals) {
+        globalsOwner().globals->set(name, std::move(expr));
+        return;
     }
+
+    {
+        Eptr old;
+        auto guard = lock();
+
+        auto it = symbols.find(name);
+        if (it != symbols.end()) {
+            old = std::move(it->second);
+            it->second = std::move(expr);
+            return;
+        }
+    }
+    parent->setDeepest(name, expr);
 }
 
 void Env::setHere(const std::string &name, Fptr func) {
@@ -32,26 +101,44 @@ void Env::setDeepest(const std::string &name, Fptr func) {
 }
 
 Eptr Env::lookup(const std::string &name) {
-    auto it = symbols.find(name);
-    if (it == symbols.end()) {
-        if (parent)
-            return parent->lookup(name);
-        else 
-            throw SymbolNotFound(name);
-    } else {
-        return it->second;
+    Env *env = this;
+    unsigned hops = 0;
+
+    for (; !env->globals; env = env->parent.get(), hops++) {
+        auto guard = env->lock();
+        auto it = env->symbols.find(name);
+        if (it != env->symbols.end()) {
+            stats::countLookup(hops);
+            return it->second;
+        }
     }
+
+    stats::countLookup(hops);
+
+    for (env = &env->globalsOwner(); env; env = env->base.get()) {
+        Eptr global = env->globals->lookup(name);
+        if (global)
+            return global;
+    }
+
+    // Builtins are shared by all root environments.
+    Eptr builtin = lookupBuiltin(name);
+    if (!builtin)
+        throw SymbolNotFound(name);
+
+    return builtin;
 }
 
-Env::Env(EnvPtr parent)
-    : parent(parent) {
+std::map<std::string, Eptr> Env::getSymbols() const {
+    if (globals)
+        return globals->snapshot();
 
-    if (!parent) {
-        registerBuiltinFunctions(*this);
+    auto guard = lock();
+    return symbols;
+}
 
-        setHere("nil",             std::make_shared<SymbolExpr>("nil"));
-        setHere("t",               std::make_shared<SymbolExpr>("t"));
-        setHere("*matig-version*", std::make_shared<NumericExpr>(0));
-        setHere("*magic*",         std::make_shared<NumericExpr>(539));
-    }
+Env::Env(EnvPtr parent)
+    : parent(parent),
+      globals(parent ? nullptr : new GlobalTable) {
+    stats::count(stats::Counter::ENV_FRAMES);
 }
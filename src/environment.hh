@@ -8,10 +8,11 @@
 #pragma once
 
 #include "common.hh"
-#include <map>
+#include "global-table.hh"
 
-class Expr;
-typedef std::shared_ptr<Expr> Eptr;
+#include <atomic>
+#include <map>
+#include <mutex>
 
 class Func;
 typedef std::shared_ptr<Func> Fptr;
@@ -19,6 +20,31 @@ typedef std::shared_ptr<Func> Fptr;
 class Env;
 typedef std::shared_ptr<Env> EnvPtr;
 
+/**
+ * \brief A scope of symbol bindings.
+ *
+ * Environments may be evaluated in concurrently (see spawn, pmap).
+ * Frames that other threads can reach are marked as shared: the
+ * frames a spawned evaluation starts from, and the context of every
+ * Lisp function, since closures can be passed between threads.
+ * Bindings in shared frames are read and written under the frame's
+ * lock once the process has gone concurrent. Closures capture their
+ * context by reference, so all threads see the same bindings.
+ *
+ * Frames created for a single function call are private to the
+ * thread evaluating the call and are accessed without locking.
+ *
+ * Root environments keep their bindings in a GlobalTable instead, so
+ * that looking up globals never takes a lock; setting them does. A
+ * root environment can be layered over a frozen root environment (see
+ * layer()): globals it does not bind itself are looked up in the
+ * frozen one, and globals it sets are bound in its own table.
+ *
+ * Closures created in a frozen environment still refer to it, not to
+ * any layer. Globals they set go to the current write layer of the
+ * thread instead (see WriteLayer), copy on write, and globals they look
+ * up are found there first.
+ */
 class Env {
 public:
     class SymbolNotFound : public ProgramError {
@@ -32,6 +58,27 @@ private:
     std::map<std::string, Eptr> symbols;
     EnvPtr parent;
 
+    /// Bindings of a root environment.
+    std::unique_ptr<GlobalTable> globals;
+
+    /// A frozen root environment under this root environment, if any.
+    EnvPtr base;
+
+    /// Shared frames have only shared ancestors.
+    std::atomic<bool>  shared { false };
+    mutable std::mutex mutex;
+
+    static std::atomic<bool> concurrent;
+
+    std::unique_lock<std::mutex> lock() const;
+
+    /**
+     * \brief Get the root environment that takes the globals of this
+     *        root environment: the current write layer if this one is
+     *        frozen and under it, this one otherwise.
+     */
+    Env &globalsOwner();
+
 public:
     Eptr lookup(const std::string &name);
 
@@ -41,5 +88,71 @@ public:
     void setHere(const std::string &name, Fptr func);
     void setDeepest(const std::string &name, Fptr func);
 
+    /**
+     * \brief Mark this frame and its ancestors as reachable by other threads.
+     */
+    void share();
+
+    /**
+     * \brief Start locking shared frames.
+     *
+     * Must be called before the first evaluation on another thread
+     * that can reach environments of this one.
+     */
+    static void setConcurrent();
+
+    /**
+     * \brief Freeze the bindings of this root environment.
+     *
+     * Globals set in a frozen environment go to the current write
+     * layer under which it lies; without one, setting them is a
+     * ProgramError.
+     */
+    void freeze();
+
+    /**
+     * \brief Create a root environment layered over BASE.
+     *
+     * BASE must be a root environment. It is frozen, so that any
+     * number of layers, on any number of threads, can share it.
+     */
+    static EnvPtr layer(EnvPtr base);
+
+    /**
+     * \brief The layer that globals set in frozen environments go to,
+     *        on this thread.
+     *
+     * Evaluations that continue on other threads (green threads,
+     * parallel builtins) carry it with them.
+     */
+    static thread_local EnvPtr writeLayer;
+
+    /**
+     * \brief Make LAYER the write layer of this thread for the lifetime
+     *        of this object.
+     */
+    class WriteLayer {
+
+        EnvPtr previous;
+
+    public:
+        WriteLayer(EnvPtr layer)
+            : previous(std::move(Env::writeLayer)) {
+            Env::writeLayer = std::move(layer);
+        }
+        WriteLayer(const WriteLayer&) = delete;
+        WriteLayer &operator=(const WriteLayer&) = delete;
+        ~WriteLayer() {
+            Env::writeLayer = std::move(previous);
+        }
+    };
+
+    EnvPtr getParent() const { return parent; }
+
+    /**
+     * \brief Get a copy of the bindings in this frame.
+     */
+    std::map<std::string, Eptr> getSymbols() const;
+
     Env(EnvPtr parent = nullptr);
 };
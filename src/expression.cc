@@ -7,6 +7,8 @@
  */
 #include "expression.hh"
 #include "function.hh"
+#include "profiler.hh"
+#include "trace.hh"
 
 Eptr Expr::quote(int count) {
 
@@ -126,6 +128,8 @@ std::string ConsExpr::repr() const {
 }
 
 Eptr ConsExpr::eval(EnvPtr env) {
+    stats::count(stats::Counter::FORM_EVALS);
+
     if (!car)
         throw LogicError("Null car");
     if (!cdr)
@@ -158,6 +162,10 @@ Eptr ConsExpr::eval(EnvPtr env) {
             parameters.push_back(std::move(cons->car));
     }
 
+    profiler::Frame frame(*symExpr);
+    heapprof::Scope site(location, *symExpr);
+    trace::Call     traceCall(*symExpr);
+
     return func->call(std::move(parameters), env);
 }
 
@@ -8,8 +8,12 @@
 #pragma once
 
 #include "common.hh"
+#include "budget.hh"
 #include "environment.hh"
+#include "heap-profile.hh"
+#include "stats.hh"
 
+#include <atomic>
 #include <vector>
 #include <unordered_map>
 
@@ -18,6 +22,18 @@ typedef std::shared_ptr<Expr> Eptr;
 typedef std::vector<Eptr> Elist;
 typedef std::unordered_map<std::string, Eptr> Emap;
 
+/**
+ * \brief A position in a source file.
+ *
+ * Line and column count from 1; a zero line means the position is
+ * unknown. File is an id given out by sourceFileId() (see read.hh).
+ */
+struct SourceLocation {
+    uint32_t line   = 0;
+    uint16_t column = 0;
+    uint16_t file   = 0;
+};
+
 /**
  * \brief S-Expression type.
  */
@@ -29,6 +45,15 @@ public:
         SYMBOL,
         CONS,
         FUNC,
+        FUTURE,
+        CHANNEL,
+        VECTOR,
+        INT_ARRAY,
+        HASH_TABLE,
+        IVECTOR,
+        IMAP,
+        STRUCT,
+        BIGNUM,
     };
 
     virtual Type type() const = 0;
@@ -63,7 +88,38 @@ public:
      */
     virtual std::string getDoc(const std::string &exprName) const { return ""; };
 
-    virtual ~Expr() = default;
+    virtual ~Expr() {
+        if (stats::enabled)
+            stats::objectDestroyed();
+    }
+
+protected:
+    Expr() {
+        budget::alloc();
+
+        if (stats::enabled)
+            stats::objectCreated();
+    }
+
+    /**
+     * \brief Report a new object of SIZE bytes to the heap profiler and
+     *        statistics.
+     *
+     * Called by the constructors of the concrete expression types.
+     */
+    static void profileAlloc(Type type, size_t size) {
+        if (heapprof::enabled)
+            heapprof::record((unsigned)type, size);
+
+        if (stats::enabled) {
+            if (type == Type::CONS)
+                stats::count(stats::Counter::CONS_ALLOCS);
+            else if (type == Type::NUMERIC)
+                stats::count(stats::Counter::NUMERIC_ALLOCS);
+            else if (type == Type::STRING)
+                stats::count(stats::Counter::STRING_ALLOCS);
+        }
+    }
 };
 
 /**
@@ -92,7 +148,9 @@ public:
     }
 
     NumericExpr(int64_t value)
-        : value(value) { }
+        : value(value) {
+        profileAlloc(Type::NUMERIC, sizeof(*this));
+    }
 };
 
 /**
@@ -118,7 +176,9 @@ public:
     }
 
     StringExpr(const std::string &value)
-        : value(value) { }
+        : value(value) {
+        profileAlloc(Type::STRING, sizeof(*this) + value.size());
+    }
 };
 
 /**
@@ -128,6 +188,8 @@ class SymbolExpr : public AtomExpr {
 
     std::string value;
 
+    mutable std::atomic<uint32_t> profileIdCache { 0 };
+
 public:
     Type type() const override { return Type::SYMBOL; }
 
@@ -140,7 +202,14 @@ public:
     const std::string &getValue() const { return value; }
           std::string &getValue()       { return value; }
 
+    /**
+     * \brief The profiler's id for this name, 0 until it assigns one.
+     */
+    std::atomic<uint32_t> &profileId() const { return profileIdCache; }
+
     Eptr eval(EnvPtr env) override {
+        stats::count(stats::Counter::SYMBOL_EVALS);
+
         Eptr expr = env->lookup(value);
         if (!expr)
             throw ProgramError("Symbols value as expression is void");
@@ -148,7 +217,9 @@ public:
     }
 
     SymbolExpr(const std::string &value)
-        : value(value) { }
+        : value(value) {
+        profileAlloc(Type::SYMBOL, sizeof(*this) + value.size());
+    }
 };
 
 /**
@@ -159,6 +230,8 @@ class ConsExpr : public Expr {
     Eptr car;
     Eptr cdr;
 
+    SourceLocation location;
+
     /**
      * \brief Cons iterator.
      *
@@ -230,6 +303,15 @@ public:
 
     Eptr operator[](size_t i) const;
 
+    /**
+     * \brief Where the reader found this cons, if it came from source.
+     *
+     * The first cons of a list is located at its opening parenthesis,
+     * the others at their car.
+     */
+    const SourceLocation &getLocation() const { return location; }
+    void setLocation(const SourceLocation &l) { location = l; }
+
     Eptr eval(EnvPtr env) override;
 
     Iterator<ConsExpr> begin();
@@ -240,6 +322,7 @@ public:
     ConsExpr(const Eptr car = nullptr,
              const Eptr cdr = nullptr)
         : car(car),
-          cdr(cdr)
-        { }
+          cdr(cdr) {
+        profileAlloc(Type::CONS, sizeof(*this));
+    }
 };
@@ -6,6 +6,7 @@
  * \license   MIT, see LICENSE.
  */
 #include "function.hh"
+#include "budget.hh"
 
 #include <algorithm>
 
@@ -68,10 +69,10 @@ std::string Func::getSynopsis(const std::string &exprName) const {
     return s + ")";
 }
 
-Eptr Func::call(Elist parametersIn, EnvPtr env) const {
+void Func::checkArity(size_t count) const {
     unsigned required = std::count_if(signature.positional.begin(),
                                       signature.positional.end(),
-                                      [](ParamSpec p) {
+                                      [](const ParamSpec &p) {
                                           return !p.defaultValue; });
 
     unsigned optional = signature.positional.size() - required;
@@ -79,57 +80,106 @@ Eptr Func::call(Elist parametersIn, EnvPtr env) const {
     unsigned minPositional = required;
     unsigned maxPositional = required + optional;
 
-    if (parametersIn.size() < (size_t)minPositional)
+    if (count < (size_t)minPositional)
         throw ProgramError("Function expects at least "s
                            + std::to_string(minPositional)
                            + (minPositional == 1 ? " parameter, " :" parameters, ")
-                           + std::to_string(parametersIn.size())
+                           + std::to_string(count)
                            + " given");
 
     if (!signature.haveRest()
-        && parametersIn.size() > (size_t)maxPositional)
+        && count > (size_t)maxPositional)
 
         throw ProgramError("Function expects at most "s
                            + std::to_string(maxPositional)
                            + (maxPositional == 1 ? " parameter, " : " parameters, ")
-                           + std::to_string(parametersIn.size())
+                           + std::to_string(count)
                            + " given");
+}
+
+Eptr Func::bind(Elist arguments, EnvPtr env) const {
+    size_t maxPositional = signature.positional.size();
 
     Elist positionals;
     Emap  keyValues;
     Elist rest;
 
-    for (unsigned i = 0; i < maxPositional; i++) {
-        auto value = i < parametersIn.size()
-                         ? isSpecial()
-                             ? parametersIn[i]
-                             : parametersIn[i]->eval(env)
+    positionals.reserve(maxPositional);
+
+    for (size_t i = 0; i < maxPositional; i++) {
+        auto value = i < arguments.size()
+                         ? std::move(arguments[i])
                          // Default parameter values are always evaluated.
                          : signature.positional[i].defaultValue;
 
         if (!value)
             value = std::make_shared<SymbolExpr>("nil");
 
-        positionals.push_back(value);
+        positionals.push_back(std::move(value));
     }
 
     // TODO: Key-value parameters.
 
-    for (unsigned i = positionals.size(); i < parametersIn.size(); i++) {
-        rest.push_back(isSpecial()
-                       ? parametersIn[i]
-                       : parametersIn[i]->eval(env));
+    for (size_t i = positionals.size(); i < arguments.size(); i++)
+        rest.push_back(std::move(arguments[i]));
+
+    return (*this)(std::move(positionals), std::move(keyValues), std::move(rest), env);
+}
+
+Eptr Func::call(Elist parametersIn, EnvPtr env) const {
+    budget::step();
+    budget::Call call;
+
+    checkArity(parametersIn.size());
+
+    if (!isSpecial()) {
+        for (auto &param : parametersIn)
+            param = param->eval(env);
     }
 
-    return (*this)(positionals, keyValues, rest, env);
+    return bind(std::move(parametersIn), env);
 }
 
+Eptr Func::apply(Elist arguments, EnvPtr env) const {
+    budget::step();
+    budget::Call call;
+
+    checkArity(arguments.size());
+
+    return bind(std::move(arguments), env);
+}
+
+static Func::Signature builtinSignature(const Builtin &builtin) {
+    Func::Signature signature;
+
+    for (const auto &param : builtin.positional) {
+        if (!param.name)
+            break;
+        signature.positional.emplace_back(param.name,
+                                          param.optional
+                                          ? std::make_shared<SymbolExpr>("nil")
+                                          : nullptr);
+    }
+    signature.rest = builtin.rest;
+
+    return signature;
+}
+
+FuncC::FuncC(const Builtin &builtin)
+    : Func(builtinSignature(builtin),
+           builtin.special,
+           builtin.doc),
+      builtin(builtin)
+    { }
+
 
 Eptr FuncLisp::operator()(Elist  positional,
                           Emap   keyValue,
                           Elist  rest,
                           EnvPtr env) const {
 
+    stats::count(stats::Counter::LISP_CALLS);
+
     if (!context)
         throw LogicError("Null Lisp function context");
 
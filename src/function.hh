@@ -27,8 +27,9 @@ public:
     Fptr getValue() { return func; }
 
     FuncExpr(Fptr func)
-        : func(func)
-        { }
+        : func(func) {
+        profileAlloc(Type::FUNC, sizeof(*this));
+    }
 };
 
 class Func {
@@ -64,6 +65,9 @@ private:
 
     std::unique_ptr<Env> env;
 
+    void checkArity(size_t count) const;
+    Eptr bind(Elist arguments, EnvPtr env) const;
+
 protected:
     virtual Eptr operator()(Elist  positional,
                             Emap   keyValue,
@@ -74,13 +78,28 @@ public:
     bool isSpecial() const { return special; }
     const Signature &getSignature() const { return signature; }
 
+    const std::string &getDocString() const { return doc; }
+
     std::string getSynopsis(const std::string &exprName = "<func>") const;
     std::string getDoc(const std::string &exprName = "<func>") const {
         return getSynopsis(exprName) + "\n" + doc;
     }
 
+    /**
+     * \brief Call the function with parameter expressions.
+     *
+     * Parameters are evaluated in ENV first, unless the function is
+     * special.
+     */
     Eptr call(Elist parameters, EnvPtr env) const;
 
+    /**
+     * \brief Call the function with argument values.
+     *
+     * Arguments are passed as-is, without evaluating them.
+     */
+    Eptr apply(Elist arguments, EnvPtr env) const;
+
     Func(const Signature &signature,
          bool special,
          const std::string &doc)
@@ -90,11 +109,33 @@ public:
         { }
 };
 
-class FuncC : public Func {
+/**
+ * \brief A builtin function definition.
+ *
+ * Builtins are defined in constant tables, and are instantiated once
+ * per process when they are first looked up.
+ */
+struct Builtin {
+    typedef Eptr (*Ftype)(Elist, Emap, Elist, EnvPtr);
+
+    static const int maxPositional = 4;
 
-    typedef std::function<Eptr(Elist, Emap, Elist, EnvPtr)> Ftype;
+    struct Param {
+        const char *name;
+        bool optional; ///< Optional parameters default to nil.
+    };
 
-    Ftype func;
+    const char *name;
+    Param       positional[maxPositional];
+    const char *rest;
+    const char *doc;
+    bool        special;
+    Ftype       func;
+};
+
+class FuncC : public Func {
+
+    const Builtin &builtin;
 
 public:
     Eptr operator()(Elist  positional,
@@ -102,20 +143,17 @@ public:
                     Elist  rest,
                     EnvPtr env) const override {
 
-        return func(positional, keyValue, rest, env);
+        stats::count(stats::Counter::BUILTIN_CALLS);
+
+        return builtin.func(std::move(positional),
+                            std::move(keyValue),
+                            std::move(rest),
+                            env);
     }
 
-    FuncC(const std::vector<ParamSpec> &positional,
-          const std::vector<ParamSpec> &keyValue,
-          const std::string &restName,
-          const std::string &doc,
-          bool special,
-          Ftype func)
-        : Func(Signature{positional, keyValue, restName},
-               special,
-               doc),
-          func(func)
-        { }
+    const char *getName() const { return builtin.name; }
+
+    FuncC(const Builtin &builtin);
 };
 
 class FuncLisp : public Func {
@@ -130,6 +168,9 @@ public:
                     Elist  rest,
                     EnvPtr env) const override;
 
+    const Elist &getBody()    const { return body;    }
+    EnvPtr       getContext() const { return context; }
+
     FuncLisp(EnvPtr context,
              const Signature &sig,
              const std::string &doc,
@@ -137,8 +178,17 @@ public:
              Elist body)
         : Func(sig, special, doc),
           body(body),
-          context(context)
-        { }
+          context(context) {
+
+        // The function may be called from any thread.
+        if (context)
+            context->share();
+    }
 };
 
-void registerBuiltinFunctions(Env &env);
+/**
+ * \brief Look up a builtin function or constant by name.
+ *
+ * \return The builtin value, or nullptr if NAME is not a builtin
+ */
+Eptr lookupBuiltin(const std::string &name);
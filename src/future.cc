@@ -0,0 +1,74 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "future.hh"
+#include "green-thread.hh"
+#include "thread-pool.hh"
+
+#include <chrono>
+
+void FutureExpr::complete(std::unique_lock<std::mutex> lock) {
+    ready = true;
+    auto waiting = std::move(callbacks);
+    lock.unlock();
+
+    done.notify_all();
+    for (auto &callback : waiting)
+        callback();
+}
+
+void FutureExpr::resolve(Eptr result) {
+    std::unique_lock<std::mutex> lock(mutex);
+    value = result;
+    complete(std::move(lock));
+}
+
+void FutureExpr::fail(std::exception_ptr exception) {
+    std::unique_lock<std::mutex> lock(mutex);
+    error = exception;
+    complete(std::move(lock));
+}
+
+void FutureExpr::whenReady(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ready) {
+            callbacks.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
+
+Eptr FutureExpr::await() {
+    ThreadPool &pool = ThreadPool::instance();
+
+    if (!ready && GreenThread::current())
+        GreenThread::current()->suspendUntil(*this);
+
+    while (!ready) {
+        // Helping out keeps nested awaits from starving the pool.
+        if (pool.runOne())
+            continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait_for(lock, std::chrono::milliseconds(1),
+                      [this]{ return (bool)ready; });
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error)
+        std::rethrow_exception(error);
+
+    return value;
+}
+
+FutureEptr spawn(Eptr expr, EnvPtr env) {
+    // A spawned evaluation that waits for a channel or future must not
+    // hold on to its worker, so it gets a stack of its own to park.
+    return GreenThread::start(expr, env, false);
+}
@@ -0,0 +1,87 @@
+/**
+ * \file
+ * \brief     Results of asynchronous evaluation.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * \brief Future atom Expression type.
+ *
+ * Holds the result of an expression that is evaluated on another
+ * thread, once it is available.
+ */
+class FutureExpr : public AtomExpr {
+
+    std::atomic<bool>  ready { false };
+    Eptr               value;
+    std::exception_ptr error;
+
+    std::mutex              mutex;
+    std::condition_variable done;
+
+    std::vector<std::function<void()>> callbacks;
+
+    void complete(std::unique_lock<std::mutex> lock);
+
+public:
+    Type type() const override { return Type::FUTURE; }
+
+    std::string repr() const override {
+        return ready ? "<future (ready)>" : "<future>";
+    }
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    bool isReady() const { return ready; }
+
+    void resolve(Eptr result);
+    void fail(std::exception_ptr exception);
+
+    /**
+     * \brief Run CALLBACK once the result is available.
+     *
+     * It runs immediately if the result is already available, else on
+     * the thread that completes the future.
+     */
+    void whenReady(std::function<void()> callback);
+
+    /**
+     * \brief Wait for the result.
+     *
+     * Green threads are suspended until the result is available. Other
+     * threads run pending pool tasks in the meantime.
+     *
+     * \throw The exception the evaluation failed with, if any
+     */
+    Eptr await();
+
+    FutureExpr() {
+        profileAlloc(Type::FUTURE, sizeof(*this));
+    }
+};
+
+typedef std::shared_ptr<FutureExpr> FutureEptr;
+
+/**
+ * \brief Evaluate EXPR in a child environment of ENV on the thread pool.
+ *
+ * The evaluation runs in a green thread that does not yield at budget
+ * checks, so that it is suspended rather than blocking a worker when
+ * it waits.
+ */
+FutureEptr spawn(Eptr expr, EnvPtr env);
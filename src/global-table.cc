@@ -0,0 +1,106 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "global-table.hh"
+#include "expression.hh"
+#include "rcu.hh"
+
+GlobalTable::Slots::Slots(size_t size)
+    : mask(size - 1),
+      nodes(new std::atomic<Node*>[size]) {
+
+    for (size_t i = 0; i < size; i++)
+        nodes[i].store(nullptr, std::memory_order_relaxed);
+}
+
+GlobalTable::Node *GlobalTable::find(const Slots *table,
+                                     const std::string &name,
+                                     size_t hash) const {
+
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        Node *node = table->nodes[i].load(std::memory_order_acquire);
+        if (!node)
+            return nullptr;
+        if (node->hash == hash && node->name == name)
+            return node;
+    }
+}
+
+Eptr GlobalTable::lookup(const std::string &name) const {
+    size_t hash = std::hash<std::string>()(name);
+
+    rcu::ReadGuard guard;
+
+    Node *node = find(slots.load(std::memory_order_acquire), name, hash);
+    if (!node)
+        return nullptr;
+
+    // Safe while in the read section: a replaced value is only
+    // released once all readers that could have seen it are done.
+    return node->value.load(std::memory_order_acquire)->shared_from_this();
+}
+
+void GlobalTable::set(const std::string &name, Eptr value) {
+    if (frozen)
+        throw ProgramError("Cannot set global '"s + name + "' in a frozen environment");
+
+    size_t hash = std::hash<std::string>()(name);
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+
+    Slots *table = currentSlots.get();
+    Node  *node  = find(table, name, hash);
+
+    if (node) {
+        node->value.store(value.get(), std::memory_order_release);
+        std::swap(node->owner, value);
+        rcu::retire(std::move(value));
+        return;
+    }
+
+    allNodes.emplace_back(new Node(name, hash, std::move(value)));
+    node = allNodes.back().get();
+
+    // Keep the load factor under one half, so that probes stay short
+    // and always hit an empty slot.
+    if (allNodes.size() * 2 > table->mask + 1) {
+        auto grown = std::make_shared<Slots>((table->mask + 1) * 2);
+
+        for (auto &existing : allNodes) {
+            size_t i = existing->hash & grown->mask;
+            while (grown->nodes[i].load(std::memory_order_relaxed))
+                i = (i + 1) & grown->mask;
+            grown->nodes[i].store(existing.get(), std::memory_order_relaxed);
+        }
+
+        slots.store(grown.get(), std::memory_order_release);
+        std::swap(currentSlots, grown);
+        rcu::retire(std::move(grown));
+
+    } else {
+        size_t i = hash & table->mask;
+        while (table->nodes[i].load(std::memory_order_relaxed))
+            i = (i + 1) & table->mask;
+        table->nodes[i].store(node, std::memory_order_release);
+    }
+}
+
+std::map<std::string, Eptr> GlobalTable::snapshot() const {
+    std::lock_guard<std::mutex> lock(writeMutex);
+
+    std::map<std::string, Eptr> bindings;
+    for (auto &node : allNodes)
+        bindings.emplace(node->name, node->owner);
+
+    return bindings;
+}
+
+GlobalTable::GlobalTable()
+    : currentSlots(std::make_shared<Slots>(64)) {
+
+    slots.store(currentSlots.get());
+}
@@ -0,0 +1,92 @@
+/**
+ * \file
+ * \brief     Concurrent table of global bindings.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class Expr;
+typedef std::shared_ptr<Expr> Eptr;
+
+/**
+ * \brief A hash table of bindings with lock-free lookups.
+ *
+ * Lookups never block: they probe an open-addressed slot array and
+ * read the bound value under an rcu::ReadGuard. Writers serialize on
+ * a mutex. Bindings are never removed, so a name's node lives as long
+ * as the table. Replaced values and outgrown slot arrays are retired
+ * through rcu, so readers can finish with them safely.
+ *
+ * A frozen table rejects all writes, so that it can be used as a
+ * read-only layer under other tables (see Env::layer()).
+ */
+class GlobalTable {
+
+    struct Node {
+        const std::string name;
+        const size_t      hash;
+
+        /// Readers load the raw pointer, `owner` keeps it alive.
+        std::atomic<Expr*> value;
+        Eptr               owner;
+
+        Node(const std::string &name, size_t hash, Eptr value)
+            : name(name),
+              hash(hash),
+              value(value.get()),
+              owner(std::move(value))
+            { }
+    };
+
+    struct Slots {
+        const size_t mask;
+        std::unique_ptr<std::atomic<Node*>[]> nodes;
+
+        Slots(size_t size);
+    };
+
+    std::atomic<Slots*>    slots;
+    std::shared_ptr<Slots> currentSlots;
+
+    std::vector<std::unique_ptr<Node>> allNodes;
+    mutable std::mutex                 writeMutex;
+
+    std::atomic<bool> frozen { false };
+
+    Node *find(const Slots *table, const std::string &name, size_t hash) const;
+
+public:
+    /**
+     * \return The bound value, or nullptr if NAME is unbound
+     */
+    Eptr lookup(const std::string &name) const;
+
+    /**
+     * \throw ProgramError if the table is frozen
+     */
+    void set(const std::string &name, Eptr value);
+
+    /**
+     * \brief Reject all further writes.
+     */
+    void freeze() { frozen = true; }
+    bool isFrozen() const { return frozen; }
+
+    /**
+     * \brief Get a copy of all bindings.
+     */
+    std::map<std::string, Eptr> snapshot() const;
+
+    GlobalTable();
+    GlobalTable(const GlobalTable&) = delete;
+    GlobalTable &operator=(const GlobalTable&) = delete;
+};
@@ -0,0 +1,166 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "green-thread.hh"
+#include "print.hh"
+#include "thread-pool.hh"
+
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * \brief Stack allocator for green threads.
+ *
+ * Reserves address space without committing memory; pages are backed
+ * when first touched. A guard page catches overflows that the call
+ * depth limit does not prevent.
+ */
+struct LazyStack {
+    size_t reserveSize;
+
+    boost::context::stack_context allocate() {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t size     = reserveSize + pageSize;
+
+        void *base = mmap(nullptr, size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                          -1, 0);
+        if (base == MAP_FAILED)
+            throw std::bad_alloc();
+
+        mprotect(base, pageSize, PROT_NONE);
+
+        boost::context::stack_context stack;
+        stack.size = size;
+        stack.sp   = static_cast<char*>(base) + size;
+        return stack;
+    }
+
+    void deallocate(boost::context::stack_context &stack) {
+        munmap(static_cast<char*>(stack.sp) - stack.size, stack.size);
+    }
+
+    explicit LazyStack(size_t reserveSize)
+        : reserveSize(reserveSize)
+        { }
+};
+
+}
+
+thread_local GreenThread *GreenThread::running = nullptr;
+
+void GreenThread::run() {
+    GreenThread *previous = running;
+    running = this;
+    runCount++;
+
+    std::ostream *workerOut = swapOutput(out);
+    std::swap(budget::state, budgetState);
+    auto workerStack = profiler::swapStack(&shadowStack);
+    std::swap(heapprof::site, heapSite);
+    std::swap(trace::depth, traceDepth);
+    std::swap(Env::writeLayer, writeLayer);
+
+    context = std::move(context).resume();
+
+    std::swap(Env::writeLayer, writeLayer);
+    std::swap(trace::depth, traceDepth);
+    std::swap(heapprof::site, heapSite);
+    profiler::swapStack(workerStack);
+    std::swap(budget::state, budgetState);
+    out = swapOutput(workerOut);
+
+    running = previous;
+
+    // A finished green thread leaves no context behind.
+    if (context) {
+        auto then = std::move(afterSwitch);
+        then();
+    }
+}
+
+void GreenThread::schedule() {
+    auto self = shared_from_this();
+    ThreadPool::instance().defer([self]{ self->run(); });
+}
+
+void GreenThread::switchOut(std::function<void()> then) {
+    afterSwitch = std::move(then);
+    worker      = std::move(worker).resume();
+}
+
+void GreenThread::yield() {
+    if (pinCount)
+        return;
+
+    auto self = shared_from_this();
+    switchOut([self]{ self->schedule(); });
+}
+
+void GreenThread::suspend(std::function<void(std::function<void()>)> arm) {
+    auto self = shared_from_this();
+
+    // Arm only once suspended, so that the thread cannot be resumed
+    // while it is still running.
+    switchOut([self, arm]{
+        arm([self]{ self->schedule(); });
+    });
+}
+
+void GreenThread::suspendUntil(FutureExpr &future) {
+    suspend([&future](std::function<void()> resume) {
+        future.whenReady(resume);
+    });
+}
+
+FutureEptr GreenThread::start(Eptr expr, EnvPtr env, bool preemptible) {
+    auto future = std::make_shared<FutureExpr>();
+
+    env->share();
+    Env::setConcurrent();
+
+    const budget::Limits &limits = budget::currentLimits();
+    size_t stackSize = budget::stackSize(limits);
+
+    std::shared_ptr<GreenThread> thread(new GreenThread(&output(), limits));
+    GreenThread *self = thread.get();
+
+    if (!preemptible)
+        thread->pinCount++;
+
+    thread->writeLayer = Env::writeLayer;
+
+    thread->context = boost::context::fiber(
+        std::allocator_arg, LazyStack(stackSize),
+        [self, expr, env, future, stackSize](boost::context::fiber &&worker) {
+            self->worker = std::move(worker);
+
+            char top;
+            budget::setStack(&top, stackSize);
+
+            try {
+                future->resolve(expr->eval(std::make_shared<Env>(env)));
+
+            } catch (boost::context::detail::forced_unwind&) {
+                // Destroyed while suspended: let the stack unwind.
+                throw;
+            } catch (...) {
+                future->fail(std::current_exception());
+            }
+
+            return std::move(self->worker);
+        });
+
+    thread->schedule();
+
+    return future;
+}
@@ -0,0 +1,150 @@
+/**
+ * \file
+ * \brief     Green threads, multiplexed over the thread pool.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "budget.hh"
+#include "expression.hh"
+#include "future.hh"
+#include "heap-profile.hh"
+#include "profiler.hh"
+#include "trace.hh"
+
+#include <functional>
+
+#include <boost/context/fiber.hpp>
+
+/**
+ * \brief An interpreter-level thread.
+ *
+ * A green thread evaluates one expression on a stack of its own. It
+ * runs as a thread pool task until it yields, which happens at every
+ * budget check (see budget.hh) and when it waits for a future or a
+ * channel. A yielded thread is queued behind the work already waiting
+ * on its worker, and may resume on another worker.
+ *
+ * Stacks reserve a large address range, but memory is only committed
+ * as they grow, so idle green threads are cheap.
+ */
+class GreenThread : public std::enable_shared_from_this<GreenThread> {
+
+    /// The green thread, while it is suspended.
+    boost::context::fiber context;
+
+    /// The worker running the green thread, while it runs.
+    boost::context::fiber worker;
+
+    /// Run by the worker once the green thread is suspended.
+    std::function<void()> afterSwitch;
+
+    /// Where the green thread prints to, while it is suspended.
+    std::ostream *out;
+
+    /// Budget accounting, while the green thread is suspended.
+    budget::State budgetState;
+
+    profiler::ShadowStack shadowStack;
+
+    /// The heap profiler's call site, while the green thread is suspended.
+    heapprof::Site heapSite;
+
+    unsigned traceDepth = 0;
+
+    /// The thread's write layer (see Env::writeLayer), while it is suspended.
+    EnvPtr writeLayer;
+
+    /// Yields are skipped while pinned (see Pin).
+    unsigned pinCount = 0;
+
+    /// The number of times the green thread was (re)started.
+    uint64_t runCount = 0;
+
+    static thread_local GreenThread *running;
+
+    void run();
+    void schedule();
+    void switchOut(std::function<void()> then);
+
+    GreenThread(std::ostream *out, const budget::Limits &limits)
+        : out(out),
+          budgetState() {
+
+        budgetState.limits = limits;
+    }
+
+public:
+    /**
+     * \brief Get the green thread running on this OS thread, if any.
+     */
+    static GreenThread *current() { return running; }
+
+    /**
+     * \brief Keep the running green thread, if any, on its OS thread
+     *        for the lifetime of this object.
+     *
+     * Yields are skipped while pinned. Waiting for a future or a
+     * channel still suspends the green thread, after which it may
+     * resume on another OS thread; wasSuspended() tells whether that
+     * happened.
+     */
+    class Pin {
+
+        GreenThread *thread;
+        uint64_t     runCount;
+
+    public:
+        bool wasSuspended() const {
+            return thread && thread->runCount != runCount;
+        }
+
+        Pin()
+            : thread(running),
+              runCount(thread ? thread->runCount : 0) {
+            if (thread)
+                thread->pinCount++;
+        }
+        Pin(const Pin&) = delete;
+        Pin &operator=(const Pin&) = delete;
+        ~Pin() {
+            if (thread)
+                thread->pinCount--;
+        }
+    };
+
+    /**
+     * \brief Let other green threads and pool tasks run.
+     *
+     * Does nothing while the green thread is pinned.
+     */
+    void yield();
+
+    /**
+     * \brief Suspend until resumed.
+     *
+     * Once the green thread is suspended, ARM is called on the worker
+     * with a function that resumes it. That must be called exactly
+     * once, from any thread.
+     */
+    void suspend(std::function<void(std::function<void()> resume)> arm);
+
+    /**
+     * \brief Suspend until FUTURE has completed.
+     */
+    void suspendUntil(FutureExpr &future);
+
+    /**
+     * \brief Evaluate EXPR in a child environment of ENV in a new green thread.
+     *
+     * The green thread runs with the budget limits of the caller.
+     *
+     * \param preemptible Whether the green thread yields at budget
+     *                    checks. If not, it holds on to its worker
+     *                    until it finishes or waits.
+     */
+    static FutureEptr start(Eptr expr, EnvPtr env, bool preemptible = true);
+};
@@ -0,0 +1,254 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "hash-table.hh"
+#include "bignum.hh"
+#include "persistent.hh"
+
+#include <algorithm>
+#include <functional>
+
+/**
+ * \brief Scramble the bits of X (the splitmix64 finalizer).
+ */
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t combine(uint64_t seed, uint64_t hash) {
+    return mix(seed * 31 + hash);
+}
+
+size_t structuralHash(const Expr &expr) {
+    // Per-type seeds, so that e.g. a string and a symbol with the same
+    // name hash differently.
+    switch (expr.type()) {
+    case Expr::Type::NUMERIC:
+        return mix(static_cast<const NumericExpr&>(expr).getValue());
+
+    case Expr::Type::BIGNUM:
+        return combine(6, static_cast<const BignumExpr&>(expr).getValue().hash());
+
+    case Expr::Type::STRING:
+        return combine(1, std::hash<std::string>()(static_cast<const StringExpr&>(expr).getValue()));
+
+    case Expr::Type::SYMBOL:
+        return combine(2, std::hash<std::string>()(static_cast<const SymbolExpr&>(expr).getValue()));
+
+    case Expr::Type::CONS: {
+        // Iterate over cdrs, so that long lists need no deep recursion.
+        uint64_t hash = 3;
+        const Expr *tail = &expr;
+
+        while (tail->type() == Expr::Type::CONS) {
+            auto cons = static_cast<const ConsExpr*>(tail);
+            hash = combine(hash, structuralHash(*cons->getCar()));
+            tail = cons->getCdr().get();
+        }
+        return combine(hash, structuralHash(*tail));
+    }
+
+    case Expr::Type::IVECTOR: {
+        uint64_t hash = 4;
+        static_cast<const IVectorExpr&>(expr).forEach([&](const Eptr &item) {
+            hash = combine(hash, structuralHash(*item));
+        });
+        return hash;
+    }
+
+    case Expr::Type::IMAP: {
+        // Independent of the order of the entries.
+        uint64_t sum = 0;
+        static_cast<const IMapExpr&>(expr).forEach([&](const IMapExpr::Entry &entry) {
+            sum += combine(entry.hash, structuralHash(*entry.value));
+        });
+        return combine(5, sum);
+    }
+
+    default:
+        return mix((uintptr_t)&expr);
+    }
+}
+
+bool structuralEqual(const Expr &a, const Expr &b) {
+    const Expr *x = &a;
+    const Expr *y = &b;
+
+    while (x->type() == Expr::Type::CONS && y->type() == Expr::Type::CONS) {
+        auto consX = static_cast<const ConsExpr*>(x);
+        auto consY = static_cast<const ConsExpr*>(y);
+
+        if (consX == consY)
+            return true;
+        if (!structuralEqual(*consX->getCar(), *consY->getCar()))
+            return false;
+
+        x = consX->getCdr().get();
+        y = consY->getCdr().get();
+    }
+
+    if (x->type() != y->type())
+        return false;
+
+    switch (x->type()) {
+    case Expr::Type::NUMERIC:
+        return static_cast<const NumericExpr*>(x)->getValue()
+            == static_cast<const NumericExpr*>(y)->getValue();
+
+    case Expr::Type::BIGNUM:
+        return static_cast<const BignumExpr*>(x)->getValue()
+            == static_cast<const BignumExpr*>(y)->getValue();
+
+    case Expr::Type::STRING:
+        return static_cast<const StringExpr*>(x)->getValue()
+            == static_cast<const StringExpr*>(y)->getValue();
+
+    case Expr::Type::SYMBOL:
+        return static_cast<const SymbolExpr*>(x)->getValue()
+            == static_cast<const SymbolExpr*>(y)->getValue();
+
+    case Expr::Type::IVECTOR: {
+        if (x == y)
+            return true;
+
+        Elist itemsX = static_cast<const IVectorExpr*>(x)->items();
+        Elist itemsY = static_cast<const IVectorExpr*>(y)->items();
+
+        return itemsX.size() == itemsY.size()
+            && std::equal(itemsX.begin(), itemsX.end(), itemsY.begin(),
+                          [](const Eptr &a, const Eptr &b) {
+                              return structuralEqual(*a, *b); });
+    }
+
+    case Expr::Type::IMAP: {
+        if (x == y)
+            return true;
+
+        auto mapX = static_cast<const IMapExpr*>(x);
+        auto mapY = static_cast<const IMapExpr*>(y);
+
+        if (mapX->size() != mapY->size())
+            return false;
+
+        bool equal = true;
+        mapX->forEach([&](const IMapExpr::Entry &entry) {
+            if (equal) {
+                Eptr value = mapY->get(entry.key);
+                equal = value && structuralEqual(*value, *entry.value);
+            }
+        });
+        return equal;
+    }
+
+    default:
+        return x == y;
+    }
+}
+
+size_t HashTableExpr::find(const Expr &key, size_t hash) const {
+    size_t i = hash & mask();
+
+    while (slots[i].key
+           && !(slots[i].hash == hash && structuralEqual(*slots[i].key, key)))
+        i = (i + 1) & mask();
+
+    return i;
+}
+
+void HashTableExpr::grow() {
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+
+    for (auto &slot : old) {
+        if (!slot.key)
+            continue;
+
+        size_t i = slot.hash & mask();
+        while (slots[i].key)
+            i = (i + 1) & mask();
+
+        slots[i] = std::move(slot);
+    }
+}
+
+std::string HashTableExpr::repr() const {
+    return "<hash-table (" + std::to_string(count)
+        + (count == 1 ? " entry)>" : " entries)>");
+}
+
+Eptr HashTableExpr::get(const Eptr &key) const {
+    const auto &slot = slots[find(*key, structuralHash(*key))];
+    return slot.key ? slot.value : nullptr;
+}
+
+void HashTableExpr::put(const Eptr &key, const Eptr &value) {
+    // Keep the load factor at most 3/4.
+    if ((count + 1) * 4 > slots.size() * 3)
+        grow();
+
+    size_t hash = structuralHash(*key);
+    auto  &slot = slots[find(*key, hash)];
+
+    if (!slot.key) {
+        slot.key  = key;
+        slot.hash = hash;
+        count++;
+    }
+    slot.value = value;
+}
+
+bool HashTableExpr::remove(const Eptr &key) {
+    size_t i = find(*key, structuralHash(*key));
+    if (!slots[i].key)
+        return false;
+
+    // Move back entries that would no longer be found past the hole.
+    // An entry may stay if its home slot lies cyclically in (i, j].
+    for (size_t j = (i + 1) & mask(); slots[j].key; j = (j + 1) & mask()) {
+        size_t home = slots[j].hash & mask();
+
+        bool stays = i < j ? (home > i && home <= j)
+                           : (home > i || home <= j);
+        if (!stays) {
+            slots[i] = std::move(slots[j]);
+            i = j;
+        }
+    }
+
+    slots[i].key   = nullptr;
+    slots[i].value = nullptr;
+    count--;
+
+    return true;
+}
+
+std::vector<std::pair<Eptr, Eptr>> HashTableExpr::entries() const {
+    std::vector<std::pair<Eptr, Eptr>> result;
+    result.reserve(count);
+
+    for (const auto &slot : slots) {
+        if (slot.key)
+            result.emplace_back(slot.key, slot.value);
+    }
+
+    return result;
+}
+
+HashTableExpr::HashTableExpr(size_t capacity) {
+    size_t size = 8;
+    while (size * 3 < capacity * 4)
+        size *= 2;
+
+    slots.resize(size);
+
+    profileAlloc(Type::HASH_TABLE, sizeof(*this) + size * sizeof(Slot));
+}
@@ -0,0 +1,98 @@
+/**
+ * \file
+ * \brief     Hash tables.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief Hash an expression structurally.
+ *
+ * Numerics, bignums, strings and symbols hash by value, conses by
+ * their car and cdr, and persistent collections by their contents.
+ * Other expressions hash by identity: they are either mutable
+ * (vectors, hash tables, structures) or have no useful notion of value
+ * equality (functions, futures, channels). As the structures followed
+ * cannot be modified, this never follows a cycle.
+ */
+size_t structuralHash(const Expr &expr);
+
+/**
+ * \brief Compare expressions the way structuralHash() hashes them.
+ */
+bool structuralEqual(const Expr &a, const Expr &b);
+
+/**
+ * \brief Hash table Expression type.
+ *
+ * Maps keys to values, comparing keys with structuralEqual(). Uses
+ * open addressing with linear probing; removal shifts later entries
+ * back instead of leaving tombstones. Like vectors, hash tables are
+ * not synchronized.
+ */
+class HashTableExpr : public Expr {
+
+    struct Slot {
+        Eptr   key;   ///< nullptr for empty slots.
+        Eptr   value;
+        size_t hash;
+    };
+
+    std::vector<Slot> slots;
+    size_t            count = 0;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    /**
+     * \brief Find the slot of KEY, or the empty slot where it would go.
+     */
+    size_t find(const Expr &key, size_t hash) const;
+
+    void grow();
+
+public:
+    Type type() const override { return Type::HASH_TABLE; }
+
+    std::string repr() const override;
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    size_t size() const { return count; }
+
+    /**
+     * \brief Get the value of KEY, nullptr if there is none.
+     */
+    Eptr get(const Eptr &key) const;
+
+    void put(const Eptr &key, const Eptr &value);
+
+    /**
+     * \return false if KEY was not in the table
+     */
+    bool remove(const Eptr &key);
+
+    /**
+     * \brief Get all keys and values, in no particular order.
+     */
+    std::vector<std::pair<Eptr, Eptr>> entries() const;
+
+    /**
+     * \param capacity The number of entries to make room for
+     */
+    HashTableExpr(size_t capacity = 0);
+
+    HashTableExpr(const HashTableExpr &other)
+        : slots(other.slots),
+          count(other.count) {
+        profileAlloc(Type::HASH_TABLE, sizeof(*this) + slots.size() * sizeof(Slot));
+    }
+};
+
+typedef std::shared_ptr<HashTableExpr> HashTableEptr;
@@ -0,0 +1,147 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "heap-profile.hh"
+#include "expression.hh"
+#include "profiler.hh"
+#include "read.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace heapprof {
+
+bool enabled = false;
+
+thread_local Site site;
+
+namespace {
+
+const char *typeNames[] = {
+    "numeric", "string", "symbol", "cons", "function", "future", "channel",
+    "vector", "int-array", "hash-table", "ivector", "imap", "struct", "bignum",
+};
+
+constexpr size_t typeCount = sizeof(typeNames) / sizeof(*typeNames);
+
+struct Counts {
+    uint64_t objects = 0;
+    uint64_t bytes   = 0;
+};
+
+struct AtomicCounts {
+    std::atomic<uint64_t> objects { 0 };
+    std::atomic<uint64_t> bytes   { 0 };
+};
+
+AtomicCounts byType[typeCount];
+
+typedef std::pair<uint64_t, uint32_t> SiteKey;
+
+std::mutex               sitesMutex;
+std::map<SiteKey, Counts> bySite;
+
+uint64_t pack(const SourceLocation &location) {
+    return (uint64_t)location.line
+         | (uint64_t)location.column << 32
+         | (uint64_t)location.file   << 48;
+}
+
+std::string formatLocation(uint64_t packed) {
+    uint32_t line   = packed & 0xffffffff;
+    uint16_t column = (packed >> 32) & 0xffff;
+    uint16_t file   = packed >> 48;
+
+    if (!line)
+        return "?";
+
+    std::string name = sourceFileName(file);
+    return (name.size() ? name : "?"s)
+        + ":" + std::to_string(line)
+        + ":" + std::to_string(column);
+}
+
+}
+
+void record(unsigned type, size_t size) {
+    if (type < typeCount) {
+        byType[type].objects.fetch_add(1,    std::memory_order_relaxed);
+        byType[type].bytes  .fetch_add(size, std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(sitesMutex);
+    auto &counts = bySite[SiteKey(site.location, site.name)];
+    counts.objects++;
+    counts.bytes += size;
+}
+
+void enter(const SourceLocation &location,
+           const SymbolExpr &function,
+           Site &saved) {
+    saved = site;
+    site.location = pack(location);
+    site.name     = profiler::nameId(function);
+}
+
+void start() {
+    enabled = true;
+}
+
+std::string report(size_t siteCount) {
+    std::ostringstream out;
+
+    Counts total;
+    for (auto &counts : byType) {
+        total.objects += counts.objects;
+        total.bytes   += counts.bytes;
+    }
+
+    out << "Heap profile: " << total.objects << " objects, "
+        << total.bytes << " bytes\n\n";
+
+    out << "By type:\n";
+    for (size_t i = 0; i < typeCount; i++) {
+        if (!byType[i].objects)
+            continue;
+        out << "  " << std::left  << std::setw(10) << typeNames[i]
+                    << std::right << std::setw(12) << byType[i].objects << " objects"
+                    << std::setw(14) << byType[i].bytes << " bytes\n";
+    }
+
+    std::vector<std::pair<SiteKey, Counts>> sites;
+    {
+        std::lock_guard<std::mutex> lock(sitesMutex);
+        sites.assign(bySite.begin(), bySite.end());
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const auto &a, const auto &b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    if (sites.size() > siteCount)
+        sites.resize(siteCount);
+
+    out << "\nBy call site:\n";
+    for (auto &entry : sites) {
+        std::string where = entry.first.second
+                          ? formatLocation(entry.first.first)
+                            + " (" + profiler::name(entry.first.second) + ")"
+                          : "(toplevel)"s;
+
+        out << std::right << std::setw(12) << entry.second.objects << " objects"
+            << std::setw(14) << entry.second.bytes << " bytes  "
+            << where << "\n";
+    }
+
+    return out.str();
+}
+
+}
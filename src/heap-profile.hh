@@ -0,0 +1,90 @@
+/**
+ * \file
+ * \brief     Allocation profiler for expressions.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <cstdint>
+
+struct SourceLocation;
+class SymbolExpr;
+
+/**
+ * While enabled, every new expression is counted (objects and bytes)
+ * per expression type, and per call site: the innermost form being
+ * evaluated when it was allocated, named by its source location and
+ * the function (builtin or Lisp) it calls.
+ *
+ * Bytes are the size of the expression object plus its string
+ * payload, excluding shared_ptr control blocks and allocator overhead.
+ */
+namespace heapprof {
+
+extern bool enabled;
+
+/**
+ * \brief The form the current thread is evaluating.
+ */
+struct Site {
+    uint64_t location = 0; ///< A packed SourceLocation.
+    uint32_t name     = 0; ///< A profiler::nameId().
+};
+
+/**
+ * \brief The current site of this thread (green threads swap it).
+ */
+extern thread_local Site site;
+
+/**
+ * \brief Count a new expression of type TYPE (an Expr::Type).
+ */
+void record(unsigned type, size_t size);
+
+void enter(const SourceLocation &location,
+           const SymbolExpr &function,
+           Site &saved);
+
+/**
+ * \brief Makes a call the current site for the lifetime of this object,
+ *        if profiling.
+ */
+class Scope {
+
+    bool active;
+    Site saved;
+
+public:
+    Scope(const SourceLocation &location,
+          const SymbolExpr &function)
+        : active(enabled) {
+        if (active)
+            enter(location, function, saved);
+    }
+
+    ~Scope() {
+        if (active)
+            site = saved;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+};
+
+/**
+ * \brief Start counting allocations.
+ */
+void start();
+
+/**
+ * \brief Get a report of the allocations counted so far.
+ *
+ * \param siteCount The number of call sites to list, largest first
+ */
+std::string report(size_t siteCount = 25);
+
+}
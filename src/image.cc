@@ -0,0 +1,672 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "image.hh"
+#include "bignum.hh"
+#include "function.hh"
+#include "hash-table.hh"
+#include "persistent.hh"
+#include "read.hh"
+#include "serialize.hh"
+#include "struct.hh"
+#include "vector.hh"
+
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+// File layout:
+//
+//   "MATIGIMG" version:u64
+//   name-count:varint    { name:string }
+//   env-count:varint     { parent-env:varint }  (env 0 is the root)
+//   object-count:varint  { object }
+//   { binding-count:varint { name:varint object:varint } } (one per env)
+//
+// Names (symbols, binding names, builtin and parameter names) are
+// stored once and referred to by index. Objects are stored in
+// post-order, so objects only refer to objects stored before them.
+// Environments only refer to objects through their bindings, which
+// come last. This breaks the cycles between closures and the
+// environments they live in.
+//
+// Bignums are stored as their sign (u8), limb count and limbs (u64s).
+//
+// Conses keep their source location: line and column (varints), and
+// the file, as a name. Vectors are stored as their item count and
+// items, hash tables as their entry count and keys and values. Since
+// these can be modified, they are the only objects that can form
+// cycles, which images cannot store. Integer arrays are stored as
+// their value count and values (svarints). Persistent vectors and maps
+// are stored like vectors and hash tables; the structure they share
+// with other versions of themselves is not preserved.
+//
+// Structures and the functions DEFSTRUCT generates refer to their type
+// by index. A type is stored where it is first referred to: by its
+// index, which is then the number of types stored so far, followed by
+// its name and slot names (names). Structures then store their slots,
+// structure functions their kind and slot index. Like vectors and hash
+// tables, structures can form cycles.
+
+static const char     magic[8] = { 'M', 'A', 'T', 'I', 'G', 'I', 'M', 'G' };
+static const uint64_t version  = 2;
+
+enum class Tag : uint8_t {
+    NUMERIC,
+    STRING,
+    SYMBOL,
+    CONS,
+    BUILTIN,
+    LISP,
+    VECTOR,
+    INT_ARRAY,
+    HASH_TABLE,
+    IVECTOR,
+    IMAP,
+    STRUCT,
+    STRUCT_FUNC,
+    BIGNUM,
+};
+
+namespace {
+
+class ImageWriter {
+
+    ByteWriter objects;
+    uint64_t   objectCount = 0;
+
+    std::unordered_map<const Expr*, uint64_t> objectIds;
+
+    std::unordered_map<const Env*, uint64_t> envIds;
+    std::vector<const Env*> envs;
+    std::vector<uint64_t>   envParents;
+
+    std::unordered_map<std::string, uint64_t> nameIds;
+    std::vector<const std::string*> names;
+
+    std::unordered_map<const StructType*, uint64_t> structTypeIds;
+
+    uint64_t name(const std::string &s) {
+        auto it = nameIds.find(s);
+        if (it != nameIds.end())
+            return it->second;
+
+        auto result = nameIds.emplace(s, names.size());
+        names.push_back(&result.first->first);
+        return result.first->second;
+    }
+
+    uint64_t envId(const Env *env) {
+        auto it = envIds.find(env);
+        if (it != envIds.end())
+            return it->second;
+
+        // Parents are always stored before their children.
+        uint64_t parent = env->getParent() ? envId(env->getParent().get()) : 0;
+
+        uint64_t id = envs.size();
+        envIds[env] = id;
+        envs.push_back(env);
+        envParents.push_back(parent);
+
+        return id;
+    }
+
+    void structType(const StructType *type) {
+        auto it = structTypeIds.find(type);
+        if (it != structTypeIds.end()) {
+            objects.varint(it->second);
+            return;
+        }
+
+        uint64_t id = structTypeIds.size();
+        structTypeIds[type] = id;
+
+        objects.varint(id);
+        objects.varint(name(type->name));
+        objects.varint(type->slotNames.size());
+        for (const auto &slotName : type->slotNames)
+            objects.varint(name(slotName));
+    }
+
+    static const FuncLisp *asLisp(const Expr *expr) {
+        if (expr->type() != Expr::Type::FUNC)
+            return nullptr;
+        auto func = const_cast<FuncExpr*>(static_cast<const FuncExpr*>(expr))->getValue();
+        return dynamic_cast<const FuncLisp*>(func.get());
+    }
+
+    /**
+     * \brief Get the expressions an object refers to.
+     */
+    static void children(const Expr *expr, std::vector<const Expr*> &out) {
+        if (expr->type() == Expr::Type::CONS) {
+            auto cons = static_cast<const ConsExpr*>(expr);
+            out.push_back(cons->getCar().get());
+            out.push_back(cons->getCdr().get());
+
+        } else if (expr->type() == Expr::Type::VECTOR) {
+            for (const auto &item : static_cast<const VectorExpr*>(expr)->getItems())
+                out.push_back(item.get());
+
+        } else if (expr->type() == Expr::Type::HASH_TABLE) {
+            for (const auto &entry : static_cast<const HashTableExpr*>(expr)->entries()) {
+                out.push_back(entry.first.get());
+                out.push_back(entry.second.get());
+            }
+
+        } else if (expr->type() == Expr::Type::IVECTOR) {
+            static_cast<const IVectorExpr*>(expr)->forEach([&](const Eptr &item) {
+                out.push_back(item.get());
+            });
+
+        } else if (expr->type() == Expr::Type::IMAP) {
+            static_cast<const IMapExpr*>(expr)->forEach([&](const IMapExpr::Entry &entry) {
+                out.push_back(entry.key.get());
+                out.push_back(entry.value.get());
+            });
+
+        } else if (expr->type() == Expr::Type::STRUCT) {
+            auto instance = static_cast<const StructExpr*>(expr);
+            for (size_t i = 0; i < instance->size(); i++)
+                out.push_back(instance->slot(i).get());
+
+        } else if (auto lisp = asLisp(expr)) {
+            for (const auto &param : lisp->getSignature().positional) {
+                if (param.defaultValue)
+                    out.push_back(param.defaultValue.get());
+            }
+            for (const auto &bodyExpr : lisp->getBody())
+                out.push_back(bodyExpr.get());
+        }
+    }
+
+    void writeObject(const Expr *expr) {
+        switch (expr->type()) {
+        case Expr::Type::NUMERIC:
+            objects.u8((uint8_t)Tag::NUMERIC);
+            objects.svarint(static_cast<const NumericExpr*>(expr)->getValue());
+            break;
+
+        case Expr::Type::BIGNUM: {
+            const auto &value = static_cast<const BignumExpr*>(expr)->getValue();
+
+            objects.u8((uint8_t)Tag::BIGNUM);
+            objects.u8(value.isNegative());
+            objects.varint(value.getLimbs().size());
+            for (uint64_t limb : value.getLimbs())
+                objects.u64(limb);
+            break;
+        }
+
+        case Expr::Type::STRING:
+            objects.u8((uint8_t)Tag::STRING);
+            objects.string(static_cast<const StringExpr*>(expr)->getValue());
+            break;
+
+        case Expr::Type::SYMBOL:
+            objects.u8((uint8_t)Tag::SYMBOL);
+            objects.varint(name(static_cast<const SymbolExpr*>(expr)->getValue()));
+            break;
+
+        case Expr::Type::CONS: {
+            auto cons = static_cast<const ConsExpr*>(expr);
+            objects.u8((uint8_t)Tag::CONS);
+            objects.varint(objectIds.at(cons->getCar().get()));
+            objects.varint(objectIds.at(cons->getCdr().get()));
+
+            const auto &location = cons->getLocation();
+            objects.varint(location.line);
+            objects.varint(location.column);
+            objects.varint(name(sourceFileName(location.file)));
+            break;
+        }
+
+        case Expr::Type::FUNC: {
+            auto func = const_cast<FuncExpr*>(static_cast<const FuncExpr*>(expr))->getValue();
+
+            if (auto builtin = dynamic_cast<const FuncC*>(func.get())) {
+                objects.u8((uint8_t)Tag::BUILTIN);
+                objects.varint(name(builtin->getName()));
+
+            } else if (auto lisp = dynamic_cast<const FuncLisp*>(func.get())) {
+                const auto &sig = lisp->getSignature();
+
+                objects.u8((uint8_t)Tag::LISP);
+                objects.varint(envId(lisp->getContext().get()));
+                objects.u8(lisp->isSpecial());
+                objects.string(lisp->getDocString());
+
+                objects.varint(sig.positional.size());
+                for (const auto &param : sig.positional) {
+                    objects.varint(name(param.name));
+                    objects.u8(!!param.defaultValue);
+                    if (param.defaultValue)
+                        objects.varint(objectIds.at(param.defaultValue.get()));
+                }
+                objects.string(sig.rest);
+
+                objects.varint(lisp->getBody().size());
+                for (const auto &bodyExpr : lisp->getBody())
+                    objects.varint(objectIds.at(bodyExpr.get()));
+
+            } else if (auto structFunc = dynamic_cast<const FuncStruct*>(func.get())) {
+                objects.u8((uint8_t)Tag::STRUCT_FUNC);
+                structType(structFunc->getStructType().get());
+                objects.u8((uint8_t)structFunc->getKind());
+                objects.varint(structFunc->getSlotIndex());
+
+            } else {
+                throw ProgramError("Cannot store function of unknown kind in image");
+            }
+            break;
+        }
+
+        case Expr::Type::VECTOR: {
+            const auto &items = static_cast<const VectorExpr*>(expr)->getItems();
+
+            objects.u8((uint8_t)Tag::VECTOR);
+            objects.varint(items.size());
+            for (const auto &item : items)
+                objects.varint(objectIds.at(item.get()));
+            break;
+        }
+
+        case Expr::Type::INT_ARRAY: {
+            const auto &values = static_cast<const IntArrayExpr*>(expr)->getValues();
+
+            objects.u8((uint8_t)Tag::INT_ARRAY);
+            objects.varint(values.size());
+            for (int64_t value : values)
+                objects.svarint(value);
+            break;
+        }
+
+        case Expr::Type::HASH_TABLE: {
+            auto entries = static_cast<const HashTableExpr*>(expr)->entries();
+
+            objects.u8((uint8_t)Tag::HASH_TABLE);
+            objects.varint(entries.size());
+            for (const auto &entry : entries) {
+                objects.varint(objectIds.at(entry.first.get()));
+                objects.varint(objectIds.at(entry.second.get()));
+            }
+            break;
+        }
+
+        case Expr::Type::IVECTOR: {
+            auto vector = static_cast<const IVectorExpr*>(expr);
+
+            objects.u8((uint8_t)Tag::IVECTOR);
+            objects.varint(vector->size());
+            vector->forEach([&](const Eptr &item) {
+                objects.varint(objectIds.at(item.get()));
+            });
+            break;
+        }
+
+        case Expr::Type::IMAP: {
+            auto map = static_cast<const IMapExpr*>(expr);
+
+            objects.u8((uint8_t)Tag::IMAP);
+            objects.varint(map->size());
+            map->forEach([&](const IMapExpr::Entry &entry) {
+                objects.varint(objectIds.at(entry.key.get()));
+                objects.varint(objectIds.at(entry.value.get()));
+            });
+            break;
+        }
+
+        case Expr::Type::STRUCT: {
+            auto instance = static_cast<const StructExpr*>(expr);
+
+            objects.u8((uint8_t)Tag::STRUCT);
+            structType(instance->getStructType().get());
+            for (size_t i = 0; i < instance->size(); i++)
+                objects.varint(objectIds.at(instance->slot(i).get()));
+            break;
+        }
+
+        default:
+            throw ProgramError("Cannot store expression <"s + expr->repr() + "> in image");
+        }
+    }
+
+    /**
+     * \brief Store an object and everything it refers to.
+     */
+    void addObject(const Expr *root) {
+        // Iterative post-order traversal, long lists would overflow
+        // the call stack otherwise.
+        std::vector<std::pair<const Expr*, bool>> stack { { root, false } };
+        std::vector<const Expr*> refs;
+
+        // Objects whose children are being stored.
+        std::unordered_set<const Expr*> pending;
+
+        while (stack.size()) {
+            auto &top = stack.back();
+            const Expr *expr = top.first;
+
+            if (objectIds.count(expr)) {
+                stack.pop_back();
+
+            } else if (!top.second) {
+                if (!pending.insert(expr).second)
+                    throw ProgramError("Cannot store cyclic structure in image");
+
+                top.second = true;
+
+                refs.clear();
+                children(expr, refs);
+                for (auto it = refs.rbegin(); it != refs.rend(); it++) {
+                    if (!objectIds.count(*it))
+                        stack.emplace_back(*it, false);
+                }
+
+            } else {
+                stack.pop_back();
+                pending.erase(expr);
+                writeObject(expr);
+                objectIds[expr] = objectCount++;
+            }
+        }
+    }
+
+public:
+    std::string write(const Env *root) {
+        envId(root);
+
+        // Storing objects may discover more environments.
+        for (size_t i = 0; i < envs.size(); i++) {
+            for (const auto &binding : envs[i]->getSymbols())
+                addObject(binding.second.get());
+        }
+
+        ByteWriter bindings;
+        for (auto env : envs) {
+            bindings.varint(env->getSymbols().size());
+            for (const auto &binding : env->getSymbols()) {
+                bindings.varint(name(binding.first));
+                bindings.varint(objectIds.at(binding.second.get()));
+            }
+        }
+
+        ByteWriter out;
+        out.bytes(magic, sizeof(magic));
+        out.u64(version);
+
+        out.varint(names.size());
+        for (auto s : names)
+            out.string(*s);
+
+        out.varint(envs.size());
+        for (auto parent : envParents)
+            out.varint(parent);
+
+        out.varint(objectCount);
+        out.data() += objects.data();
+        out.data() += bindings.data();
+
+        return std::move(out.data());
+    }
+};
+
+class ImageReader {
+
+    ByteReader in;
+
+    std::vector<std::string> names;
+    std::vector<EnvPtr>      envs;
+    Elist                    objects;
+
+    std::vector<StructTypePtr> structTypes;
+
+    const std::string &readName() {
+        uint64_t id = in.varint();
+        if (id >= names.size())
+            throw FormatError("Name index out of range");
+        return names[id];
+    }
+
+    const Eptr &readRef() {
+        uint64_t id = in.varint();
+        if (id >= objects.size())
+            throw FormatError("Object reference out of range");
+        return objects[id];
+    }
+
+    const EnvPtr &readEnvRef() {
+        uint64_t id = in.varint();
+        if (id >= envs.size())
+            throw FormatError("Environment reference out of range");
+        return envs[id];
+    }
+
+    const StructTypePtr &readStructType() {
+        uint64_t id = in.varint();
+
+        if (id == structTypes.size()) {
+            auto type  = std::make_shared<StructType>();
+            type->name = readName();
+
+            uint64_t slotCount = in.varint();
+            for (uint64_t i = 0; i < slotCount; i++)
+                type->slotNames.push_back(readName());
+
+            structTypes.push_back(type);
+
+        } else if (id > structTypes.size()) {
+            throw FormatError("Structure type reference out of range");
+        }
+
+        return structTypes[id];
+    }
+
+    Eptr readObject() {
+        auto tag = (Tag)in.u8();
+
+        if (tag == Tag::NUMERIC) {
+            return std::make_shared<NumericExpr>(in.svarint());
+
+        } else if (tag == Tag::BIGNUM) {
+            bool negative = in.u8();
+
+            Bignum::Limbs limbs;
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++)
+                limbs.push_back(in.u64());
+
+            return makeIntegerExpr(Bignum::fromLimbs(std::move(limbs), negative));
+
+        } else if (tag == Tag::STRING) {
+            size_t size = in.varint();
+            return std::make_shared<StringExpr>(std::string(in.bytes(size), size));
+
+        } else if (tag == Tag::SYMBOL) {
+            return std::make_shared<SymbolExpr>(readName());
+
+        } else if (tag == Tag::CONS) {
+            Eptr car = readRef();
+            Eptr cdr = readRef();
+            auto cons = std::make_shared<ConsExpr>(car, cdr);
+
+            SourceLocation location;
+            location.line   = in.varint();
+            location.column = in.varint();
+            const std::string &file = readName();
+            if (file.size())
+                location.file = sourceFileId(file);
+
+            cons->setLocation(location);
+            return cons;
+
+        } else if (tag == Tag::BUILTIN) {
+            Eptr builtin = lookupBuiltin(readName());
+            if (!builtin || builtin->type() != Expr::Type::FUNC)
+                throw FormatError("Unknown builtin function");
+            return builtin;
+
+        } else if (tag == Tag::LISP) {
+            EnvPtr context  = readEnvRef();
+            bool special    = in.u8();
+            std::string doc = in.string();
+
+            Func::Signature sig;
+            uint64_t positionalCount = in.varint();
+            for (uint64_t i = 0; i < positionalCount; i++) {
+                const std::string &paramName = readName();
+                Eptr defaultValue = in.u8() ? readRef() : nullptr;
+                sig.positional.emplace_back(paramName, defaultValue);
+            }
+            sig.rest = in.string();
+
+            Elist body;
+            uint64_t bodyCount = in.varint();
+            for (uint64_t i = 0; i < bodyCount; i++)
+                body.push_back(readRef());
+
+            return std::make_shared<FuncExpr>(
+                std::make_shared<FuncLisp>(context, sig, doc, special, body));
+
+        } else if (tag == Tag::VECTOR) {
+            Elist items;
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++)
+                items.push_back(readRef());
+
+            return std::make_shared<VectorExpr>(std::move(items));
+
+        } else if (tag == Tag::INT_ARRAY) {
+            std::vector<int64_t> values;
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++)
+                values.push_back(in.svarint());
+
+            return std::make_shared<IntArrayExpr>(std::move(values));
+
+        } else if (tag == Tag::HASH_TABLE) {
+            auto table = std::make_shared<HashTableExpr>();
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++) {
+                Eptr key = readRef();
+                table->put(key, readRef());
+            }
+
+            return table;
+
+        } else if (tag == Tag::IVECTOR) {
+            Elist items;
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++)
+                items.push_back(readRef());
+
+            return IVectorExpr::fromList(items);
+
+        } else if (tag == Tag::IMAP) {
+            IMapEptr map = std::make_shared<IMapExpr>();
+            uint64_t count = in.varint();
+            for (uint64_t i = 0; i < count; i++) {
+                Eptr key = readRef();
+                map = map->put(key, readRef());
+            }
+
+            return map;
+
+        } else if (tag == Tag::STRUCT) {
+            StructTypePtr type = readStructType();
+
+            Elist values;
+            for (size_t i = 0; i < type->slotNames.size(); i++)
+                values.push_back(readRef());
+
+            return std::make_shared<StructExpr>(type, std::move(values));
+
+        } else if (tag == Tag::STRUCT_FUNC) {
+            StructTypePtr type = readStructType();
+            auto kind          = (FuncStruct::Kind)in.u8();
+            uint64_t slot      = in.varint();
+
+            if (kind > FuncStruct::Kind::SETTER
+                || ((kind == FuncStruct::Kind::GETTER || kind == FuncStruct::Kind::SETTER)
+                    && slot >= type->slotNames.size()))
+                throw FormatError("Invalid structure function");
+
+            return std::make_shared<FuncExpr>(std::make_shared<FuncStruct>(type, kind, slot));
+
+        } else {
+            throw FormatError("Unknown object tag");
+        }
+    }
+
+public:
+    EnvPtr read() {
+        if (memcmp(in.bytes(sizeof(magic)), magic, sizeof(magic)))
+            throw FormatError("Not an image file");
+        if (in.u64() != version)
+            throw FormatError("Unsupported image version");
+
+        uint64_t nameCount = in.varint();
+        for (uint64_t i = 0; i < nameCount; i++)
+            names.push_back(in.string());
+
+        uint64_t envCount = in.varint();
+        if (!envCount)
+            throw FormatError("Missing root environment");
+
+        for (uint64_t i = 0; i < envCount; i++) {
+            uint64_t parent = in.varint();
+
+            if (i == 0) {
+                envs.push_back(std::make_shared<Env>());
+            } else if (parent < i) {
+                envs.push_back(std::make_shared<Env>(envs[parent]));
+            } else {
+                throw FormatError("Environment parent out of order");
+            }
+        }
+
+        uint64_t objectCount = in.varint();
+        objects.reserve(objectCount);
+        for (uint64_t i = 0; i < objectCount; i++)
+            objects.push_back(readObject());
+
+        for (auto &env : envs) {
+            uint64_t bindingCount = in.varint();
+            for (uint64_t i = 0; i < bindingCount; i++) {
+                const std::string &bindingName = readName();
+                env->setHere(bindingName, readRef());
+            }
+        }
+
+        if (!in.atEnd())
+            throw FormatError("Trailing data");
+
+        return envs[0];
+    }
+
+    ImageReader(const char *data, size_t size)
+        : in(data, size)
+        { }
+};
+
+}
+
+void dumpImage(const std::string &path, const EnvPtr &root) {
+    std::string data = ImageWriter().write(root.get());
+
+    if (!writeFileAtomic(path, data))
+        throw ProgramError("Could not write image '"s + path + "'");
+}
+
+EnvPtr loadImage(const std::string &path) {
+    MappedFile file;
+    if (!file.open(path))
+        throw ProgramError("Could not open image '"s + path + "'");
+
+    return ImageReader(file.data(), file.size()).read();
+}
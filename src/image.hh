@@ -0,0 +1,33 @@
+/**
+ * \file
+ * \brief     Heap images of initialized environments.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief Write a root environment and everything reachable from it to
+ *        an image file.
+ *
+ * This includes global bindings, Lisp functions with the environments
+ * they were closed over, and all data they refer to. Builtin
+ * functions are stored by name.
+ *
+ * \throw ProgramError if the image could not be written, or contains
+ *        values that cannot be stored
+ */
+void dumpImage(const std::string &path, const EnvPtr &root);
+
+/**
+ * \brief Recreate a root environment from an image file.
+ *
+ * The file is mapped into memory and decoded in a single linear pass.
+ *
+ * \throw ProgramError if the image could not be read
+ */
+EnvPtr loadImage(const std::string &path);
@@ -9,52 +9,219 @@
 
 #include <cstdio>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include "read.hh"
 #include "eval.hh"
 #include "print.hh"
+#include "ast-cache.hh"
+#include "image.hh"
+#include "server.hh"
+#include "batch.hh"
+#include "budget.hh"
+#include "heap-profile.hh"
+#include "perf-counters.hh"
+#include "profiler.hh"
+#include "serialize.hh"
+#include "stats.hh"
+#include "trace.hh"
+
+#include <climits>
+#include <cstdlib>
+#include <thread>
 
 #include <unistd.h>
 
 /**
- * \brief Remove an optional shebang (#! line) from the beginning of a
- *        stream.
- *
- * \param stream
+ * \brief Run F, reporting any errors it throws.
  */
-static void slurpShebang(std::istream &stream) {
-    char c, c2;
-    if (!stream.get(c)) throw ProgramError("Unexpected EOF");
-    if (c == '#') {
-        if (!stream.get(c2)) throw ProgramError("Unexpected EOF");
-        if (c2 == '!') {
-            do {
-                stream.get(c);
-            } while (c != '\n' && stream);
-        } else {
-            if (!stream.putback(c2)) throw std::runtime_error("Could not istream::putback char 2");
-            if (!stream.putback(c)) throw std::runtime_error("Could not istream::putback char 1");
+template<typename F>
+static void guarded(F f) {
+    try {
+        f();
+    } catch (ProgramError &e) {
+        std::cerr << "Program error: " << e.what() << "\n";
+    } catch (LogicError &e) {
+        std::cerr << "BUG (LogicError): " << e.what() << "\n";
+    } catch (std::exception &e) {
+        std::cerr << "BUG (other): " << e.what() << "\n";
+    }
+}
+
+/**
+ * \brief Describe a top-level expression for the trace.
+ */
+static std::string traceArgs(const Eptr &expr) {
+    std::string args;
+
+    if (expr->type() == Expr::Type::CONS) {
+        auto cons = static_cast<const ConsExpr*>(expr.get());
+        const auto &location = cons->getLocation();
+
+        if (location.line)
+            args = "\"location\":" + trace::jsonString(sourceFileName(location.file)
+                                                      + ":" + std::to_string(location.line)
+                                                      + ":" + std::to_string(location.column))
+                 + ",";
+
+        if (cons->getCar()->type() == Expr::Type::SYMBOL)
+            args += "\"head\":" + trace::jsonString(cons->getCar()->repr()) + ",";
+    }
+
+    return args.size() ? args.substr(0, args.size() - 1) : args;
+}
+
+/**
+ * \brief Evaluate a top-level expression, reporting any errors.
+ */
+static void evalTopLevel(Eptr expr, EnvPtr env, bool isRepl) {
+    trace::Span form("form");
+    if (trace::enabled)
+        form.setArgs(traceArgs(expr));
+
+    guarded([&]{
+        budget::Scope scope(budget::defaultLimits());
+
+        Eptr result;
+        {
+            trace::Span span("eval");
+            result = eval(expr, env);
         }
+
+        if (isRepl) {
+            trace::Span span("print");
+            print(result);
+        }
+    });
+}
+
+/**
+ * \brief Read and evaluate expressions from a stream until EOF.
+ */
+static void evalStream(std::istream &in,
+                       EnvPtr env,
+                       bool isRepl,
+                       bool isInteractive,
+                       SourceLocation position) {
+
+    std::string prompt = "\x1b[1;36m" "Matig" "\x1b[0m" "> ";
+
+    while (true) {
+        if (isInteractive) {
+            std::cout << prompt;
+            std::cout.flush();
+        }
+
+        Eptr expr;
+        bool eof = false;
+
+        guarded([&]{
+            trace::Span span("read");
+            expr = read(in, position);
+
+            // Stop once no more expressions can be read (EOF / IO error).
+            eof = !expr;
+        });
+
+        if (eof)
+            break;
+
+        if (expr)
+            evalTopLevel(expr, env, isRepl);
+    }
+}
+
+/**
+ * \brief Evaluate a source file, using its AST cache if enabled.
+ */
+static void evalFile(const std::string &path,
+                     std::istream &file,
+                     EnvPtr env,
+                     bool isRepl,
+                     bool useCache) {
+
+    if (useCache) {
+        std::string source{std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>()};
+        Elist forms;
+        bool readable;
+        {
+            trace::Span span("read-source");
+            if (trace::enabled)
+                span.setArgs("\"file\":" + trace::jsonString(path));
+
+            readable = readSource(path, source, forms);
+        }
+
+        if (readable) {
+            for (auto &expr : forms)
+                evalTopLevel(expr, env, isRepl);
+            return;
+        }
+
+        // Syntax errors are reported in order by the streaming
+        // reader.
+        std::istringstream stream(source);
+        SourceLocation position = sourceStart(path);
+        if (slurpShebang(stream))
+            position.line++;
+        evalStream(stream, env, isRepl, false, position);
+
     } else {
-        if (!stream.putback(c)) throw std::runtime_error("Could not istream::putback char 1");
+        SourceLocation position = sourceStart(path);
+        if (slurpShebang(file))
+            position.line++;
+        evalStream(file, env, isRepl, false, position);
     }
 }
 
-int main(int argc, char **argv) {
+static int run(int argc, char **argv) {
 
-    std::istream  *in = &std::cin;
     std::ifstream file;
 
-    std::string prompt = "\x1b[1;36m" "Matig" "\x1b[0m" "> ";
+    std::string filePath;
+    std::string imagePath;
+    std::string dumpImagePath;
+    std::string servePath;
+    std::string connectPath;
+    std::string profilePath;
+    std::string heapProfilePath;
+    std::vector<perf::Event> perfEvents;
+    std::string tracePath;
+    unsigned traceDepth = 16;
+    unsigned workerCount = std::thread::hardware_concurrency();
+    unsigned jobCount = 0;
+    budget::Limits limits;
+    limits.depth = budget::defaultMaxDepth;
+    std::vector<std::string> paths;
+    bool useCache = true;
 
     bool isRepl = false;
 
     {
         auto printUsage = [argv]{
             std::cerr << "usage: " << argv[0]
-                      << " [-r] [--] [file|-]\n";
+                      << " [-r] [--no-cache] [--image FILE] [--dump-image FILE]"
+                         " [--serve SOCKET [--workers N]] [--connect SOCKET]"
+                         " [--] [file|-]\n"
+                      << "       " << argv[0]
+                      << " [--no-cache] [--image FILE] --jobs N [--] file...\n"
+                      << "budget options, per top-level expression:"
+                         " [--max-steps N] [--max-allocs N] [--max-depth N ("
+                      << budget::defaultMaxDepth << ")] [--check-interval N]\n"
+                      << "profiling: [--profile=FILE] writes folded stacks of"
+                         " sampled Lisp calls to FILE\n"
+                      << "           [--heap-profile[=FILE]] reports allocations"
+                         " per type and call site at exit (default: stderr)\n"
+                      << "           [--stats] reports interpreter statistics"
+                         " to stderr at exit\n"
+                      << "           [--perf-counters[=EVENT,...]] reports hardware"
+                         " performance counters to stderr at exit\n"
+                      << "           [--trace=FILE [--trace-depth N]] writes a Chrome"
+                         " trace of top-level forms and calls up to N deep (16)\n";
         };
 
         // Parse arguments.
@@ -68,18 +235,102 @@ int main(int argc, char **argv) {
             } else if (!dashed && arg == "-r") {
                 isRepl = true;
 
-            } else if (dashed || (arg.length() && arg[0] != '-')) {
-                if (file.is_open()) {
+            } else if (!dashed && arg == "--no-cache") {
+                useCache = false;
+
+            } else if (!dashed && (arg == "--image"
+                                   || arg == "--dump-image"
+                                   || arg == "--serve"
+                                   || arg == "--connect")) {
+                if (i + 1 >= argc) {
+                    printUsage();
+                    return 1;
+                }
+                (  arg == "--image"      ? imagePath
+                 : arg == "--dump-image" ? dumpImagePath
+                 : arg == "--serve"      ? servePath
+                 :                         connectPath) = argv[++i];
+
+            } else if (!dashed && arg == "--workers") {
+                if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                    printUsage();
+                    return 1;
+                }
+                workerCount = atoi(argv[++i]);
+
+            } else if (!dashed && (arg == "--max-steps"
+                                   || arg == "--max-allocs"
+                                   || arg == "--max-depth"
+                                   || arg == "--check-interval")) {
+                if (i + 1 >= argc || atoll(argv[i + 1]) <= 0) {
+                    printUsage();
+                    return 1;
+                }
+                uint64_t value = atoll(argv[++i]);
+
+                if (arg == "--max-steps")
+                    limits.steps = value;
+                else if (arg == "--max-allocs")
+                    limits.allocs = value;
+                else if (arg == "--max-depth")
+                    limits.depth = value;
+                else
+                    budget::setCheckInterval(value);
+
+            } else if (!dashed && arg.compare(0, 10, "--profile=") == 0
+                                   && arg.length() > 10) {
+                profilePath = arg.substr(10);
+
+            } else if (!dashed && arg.compare(0, 14, "--heap-profile") == 0
+                                   && (arg.length() == 14
+                                       || (arg[14] == '=' && arg.length() > 15))) {
+                heapprof::start();
+                if (arg.length() > 14)
+                    heapProfilePath = arg.substr(15);
+
+            } else if (!dashed && arg.compare(0, 8, "--trace=") == 0
+                                   && arg.length() > 8) {
+                tracePath = arg.substr(8);
+
+            } else if (!dashed && arg == "--trace-depth") {
+                if (i + 1 >= argc || atoi(argv[i + 1]) < 0) {
                     printUsage();
                     return 1;
                 }
+                traceDepth = atoi(argv[++i]);
+
+            } else if (!dashed && arg == "--stats") {
+                stats::start();
+
+            } else if (!dashed && (arg == "--perf-counters"
+                                   || arg.compare(0, 16, "--perf-counters=") == 0)) {
+                std::string names = arg.length() > 16
+                                  ? arg.substr(16)
+                                  : "cycles,instructions,cache-misses,branch-misses";
+                try {
+                    std::istringstream stream(names);
+                    std::string name;
+                    while (std::getline(stream, name, ','))
+                        perfEvents.push_back(perf::eventByName(name));
+
+                } catch (ProgramError &e) {
+                    std::cerr << e.what() << "\n";
+                    printUsage();
+                    return 1;
+                }
+
+            } else if (!dashed && arg == "--jobs") {
+                if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+                    printUsage();
+                    return 1;
+                }
+                jobCount = atoi(argv[++i]);
+
+            } else if (dashed || (arg.length() && arg[0] != '-')) {
+                paths.push_back(arg);
 
-                file.open(arg);
-                if (!file)
-                    throw std::runtime_error("Could not open file '"s
-                                            + arg + "' for reading.");
             } else if (!dashed && arg == "-"){
-                if (file.is_open()) {
+                if (paths.size()) {
                     printUsage();
                     return 1;
                 }
@@ -88,46 +339,205 @@ int main(int argc, char **argv) {
                 return 1;
             }
         }
+
+        // Without --jobs, only a single file is evaluated.
+        if (jobCount ? paths.empty() : paths.size() > 1) {
+            printUsage();
+            return 1;
+        }
+
+        budget::setDefaultLimits(limits);
+
+        if (profilePath.length())
+            profiler::start();
+
+        if (tracePath.length())
+            trace::start(traceDepth);
+
+        if (!jobCount && paths.size()) {
+            file.open(paths[0]);
+            if (!file)
+                throw std::runtime_error("Could not open file '"s
+                                        + paths[0] + "' for reading.");
+            filePath = paths[0];
+        }
+    }
+
+    // Count all threads, including pool workers that are yet to start.
+    std::unique_ptr<perf::Counters> perfCounters;
+    if (perfEvents.size()) {
+        try {
+            perfCounters.reset(new perf::Counters(perfEvents, true));
+        } catch (ProgramError &e) {
+            std::cerr << "Program error: " << e.what() << "\n";
+            return 1;
+        }
     }
 
+    // Write the profiles however main returns.
+    struct ProfileWriter {
+        const std::string &path;
+        const std::string &heapPath;
+        const std::unique_ptr<perf::Counters> &perfCounters;
+        const std::string &tracePath;
 
-    if (file.is_open())
-        in = &file;
+        ~ProfileWriter() {
+            if (path.length())
+                guarded([this]{ profiler::stop(path); });
 
-    bool isInteractive = in == &std::cin && isatty(fileno(stdin));
-    isRepl |= isInteractive;
+            if (heapprof::enabled) {
+                guarded([this]{
+                    if (heapPath.empty())
+                        std::cerr << heapprof::report();
+                    else if (!writeFileAtomic(heapPath, heapprof::report()))
+                        throw ProgramError("Could not write heap profile to '"s
+                                           + heapPath + "'");
+                });
+            }
 
-    if (!isInteractive)
-        slurpShebang(*in);
+            if (stats::enabled)
+                std::cerr << stats::report();
 
-    EnvPtr rootEnv = std::make_shared<Env>();
+            if (perfCounters)
+                guarded([this]{ writePerfCounters(); });
 
-    while (true) {
-        if (isInteractive) {
-            std::cout << prompt;
-            std::cout.flush();
+            if (tracePath.length())
+                guarded([this]{ trace::write(tracePath); });
+        }
+
+        void writePerfCounters() {
+            const auto &events = perfCounters->getEvents();
+            auto counts = perfCounters->read();
+
+            uint64_t cycles = 0, instructions = 0;
+
+            std::cerr << "Performance counters:\n";
+            for (size_t i = 0; i < events.size(); i++) {
+                std::cerr << "  " << std::left  << std::setw(20) << perf::name(events[i])
+                                  << std::right << std::setw(16) << counts[i] << "\n";
+
+                if (events[i] == perf::Event::CYCLES)
+                    cycles = counts[i];
+                else if (events[i] == perf::Event::INSTRUCTIONS)
+                    instructions = counts[i];
+            }
+
+            if (cycles && instructions)
+                std::cerr << "  " << std::left  << std::setw(20) << "instructions/cycle"
+                                  << std::right << std::setw(16) << std::fixed
+                                  << std::setprecision(2) << (double)instructions / cycles
+                                  << "\n";
+        }
+    } profileWriter { profilePath, heapProfilePath, perfCounters, tracePath };
+
+    if (connectPath.length()) {
+        // Let the server read files itself, so that it can use their
+        // AST caches.
+        if (file.is_open()) {
+            char path[PATH_MAX];
+            if (!realpath(filePath.c_str(), path)) {
+                std::cerr << "Could not resolve path '" << filePath << "'\n";
+                return 1;
+            }
+            return sendRequest(connectPath, "file "s + path + "\n");
+
+        } else {
+            std::string source{std::istreambuf_iterator<char>(std::cin),
+                               std::istreambuf_iterator<char>()};
+            return sendRequest(connectPath, "eval\n" + source);
+        }
+    }
+
+    if (servePath.length()) {
+        // The input file, if any, is a prelude that is evaluated once,
+        // in the environment that all requests are layered over.
+        Elist prelude;
+        if (file.is_open()) {
+            std::string source{std::istreambuf_iterator<char>(file),
+                               std::istreambuf_iterator<char>()};
+
+            if (!readSource(filePath, source, prelude)) {
+                std::cerr << "Program error: Syntax error in prelude '" << filePath << "'\n";
+                return 1;
+            }
         }
+
+        EnvPtr env;
         try {
-            Eptr expr = read(*in);
+            env = imagePath.length()
+                ? loadImage(imagePath)
+                : std::make_shared<Env>();
 
-            // Stop once no more expressions can be read (EOF / IO error).
-            if (!expr)
-                break;
+        } catch (ProgramError &e) {
+            std::cerr << "Program error: " << e.what() << "\n";
+            return 1;
+        }
+
+        for (auto &expr : prelude)
+            evalTopLevel(expr, env, false);
+
+        return serve(servePath, workerCount, env);
+    }
 
-            // Eptr result = expr;
-            Eptr result = eval(expr, rootEnv);
+    EnvPtr rootEnv;
 
-            if (isRepl)
-                print(result);
+    try {
+        rootEnv = imagePath.length()
+                ? loadImage(imagePath)
+                : std::make_shared<Env>();
+
+    } catch (ProgramError &e) {
+        std::cerr << "Program error: " << e.what() << "\n";
+        return 1;
+    }
+
+    if (jobCount) {
+        // Every file runs in a fork of the environment set up above.
+        return runBatch(paths, jobCount, [&](const std::string &path) {
+            std::ifstream batchFile(path);
+            if (!batchFile) {
+                std::cerr << "Program error: Could not open file '" << path << "' for reading.\n";
+                return;
+            }
+            evalFile(path, batchFile, rootEnv, false, useCache);
+        });
+    }
+
+    if (file.is_open()) {
+        evalFile(filePath, file, rootEnv, isRepl, useCache);
+
+    } else {
+        bool isInteractive = isatty(fileno(stdin));
+        isRepl |= isInteractive;
+
+        if (!isInteractive)
+            slurpShebang(std::cin);
+
+        evalStream(std::cin, rootEnv, isRepl, isInteractive, sourceStart("<stdin>"));
+    }
+
+    if (dumpImagePath.length()) {
+        try {
+            dumpImage(dumpImagePath, rootEnv);
 
         } catch (ProgramError &e) {
             std::cerr << "Program error: " << e.what() << "\n";
-        } catch (LogicError &e) {
-            std::cerr << "BUG (LogicError): " << e.what() << "\n";
-        } catch (std::exception &e) {
-            std::cerr << "BUG (other): " << e.what() << "\n";
+            return 1;
         }
     }
 
     return 0;
 }
+
+int main(int argc, char **argv) {
+    int status = run(argc, argv);
+
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(nullptr);
+
+    // Pool tasks may still wait for something that never comes, e.g.
+    // a spawned RECV on an abandoned channel. Exit without running
+    // static destructors, which would wait for them.
+    _exit(status);
+}
@@ -0,0 +1,250 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "matig.hh"
+#include "function.hh"
+#include "read.hh"
+#include "ast-cache.hh"
+#include "image.hh"
+#include "bignum.hh"
+#include "vector.hh"
+
+#include <fstream>
+#include <sstream>
+
+namespace matig {
+
+namespace {
+
+/**
+ * \brief A native function registered by the host.
+ */
+class FuncNative : public Func {
+
+    NativeFunction func;
+
+public:
+    Eptr operator()(Elist  positional,
+                    Emap   keyValue,
+                    Elist  rest,
+                    EnvPtr env) const override {
+
+        stats::count(stats::Counter::BUILTIN_CALLS);
+
+        Values arguments;
+        arguments.reserve(rest.size());
+        for (auto &expr : rest)
+            arguments.emplace_back(std::move(expr));
+
+        Value result = func(std::move(arguments));
+        if (!result)
+            throw ProgramError("Native function returned no value");
+
+        return result.get();
+    }
+
+    FuncNative(NativeFunction func, const std::string &doc)
+        : Func(Signature({ }, { }, "arguments"), false, doc),
+          func(func)
+        { }
+};
+
+const Eptr &exprOf(const Value &value) {
+    if (!value)
+        throw LogicError("Empty value handle");
+    return value.get();
+}
+
+Elist toElist(const Values &values) {
+    Elist list;
+    list.reserve(values.size());
+    for (const auto &value : values)
+        list.push_back(exprOf(value));
+    return list;
+}
+
+Values toValues(const Elist &list) {
+    Values values;
+    values.reserve(list.size());
+    for (const auto &item : list)
+        values.emplace_back(item);
+    return values;
+}
+
+}
+
+std::string Value::repr() const {
+    return exprOf(*this)->repr();
+}
+
+Value Interpreter::eval(const std::string &source) {
+    std::istringstream stream(source);
+
+    Eptr result = nil().get();
+
+    while (Eptr expr = ::read(stream))
+        result = expr->eval(root);
+
+    return Value(result);
+}
+
+Value Interpreter::eval(const Value &value) {
+    return Value(exprOf(value)->eval(root));
+}
+
+Value Interpreter::evalFile(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw ProgramError("Could not open file '"s + path + "' for reading");
+
+    std::string source{std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>()};
+
+    Elist forms;
+    if (!readSource(path, source, forms)) {
+        // Re-read without the cache to get at the syntax error.
+        std::istringstream stream(source);
+        slurpShebang(stream);
+        while (::read(stream));
+
+        throw LogicError("Source could not be read, but has no syntax errors");
+    }
+
+    Eptr result = nil().get();
+
+    for (auto &expr : forms)
+        result = expr->eval(root);
+
+    return Value(result);
+}
+
+Value Interpreter::lookup(const std::string &name) const {
+    try {
+        return Value(root->lookup(name));
+    } catch (Env::SymbolNotFound &e) {
+        return Value();
+    }
+}
+
+void Interpreter::define(const std::string &name, Value value) {
+    root->setHere(name, exprOf(value));
+}
+
+void Interpreter::define(const std::string &name,
+                         NativeFunction func,
+                         const std::string &doc) {
+    root->setHere(name, std::make_shared<FuncExpr>(std::make_shared<FuncNative>(func, doc)));
+}
+
+Value Interpreter::call(const Value &func, Values arguments) {
+    const Eptr &funcExpr = exprOf(func);
+    if (funcExpr->type() != Expr::Type::FUNC)
+        throw ProgramError("Called value is not a function");
+
+    return Value(static_cast<FuncExpr*>(funcExpr.get())->getValue()
+                 ->apply(toElist(arguments), root));
+}
+
+Value Interpreter::call(const std::string &name, Values arguments) {
+    return call(Value(root->lookup(name)), std::move(arguments));
+}
+
+Interpreter::Interpreter()
+    : root(std::make_shared<Env>())
+    { }
+
+Interpreter::Interpreter(const std::string &imagePath)
+    : root(loadImage(imagePath))
+    { }
+
+
+Value nil() {
+    static const Value value(lookupBuiltin("nil"));
+    return value;
+}
+
+Value t() {
+    static const Value value(lookupBuiltin("t"));
+    return value;
+}
+
+Value makeBool(bool value) {
+    return value ? t() : nil();
+}
+
+Value makeInteger(int64_t value) {
+    return Value(std::make_shared<NumericExpr>(value));
+}
+
+Value makeString(const std::string &value) {
+    return Value(std::make_shared<StringExpr>(value));
+}
+
+Value makeSymbol(const std::string &name) {
+    return Value(std::make_shared<SymbolExpr>(name));
+}
+
+Value makeList(const Values &items) {
+    return Value(ConsExpr::fromList(toElist(items)));
+}
+
+Value makeVector(const Values &items) {
+    return Value(std::make_shared<VectorExpr>(toElist(items)));
+}
+
+Value read(const std::string &source) {
+    std::istringstream stream(source);
+    return Value(::read(stream));
+}
+
+bool isTrue(const Value &value) {
+    return !exprOf(value)->isNil();
+}
+
+int64_t toInteger(const Value &value) {
+    const Eptr &e = exprOf(value);
+    if (e->type() == Expr::Type::BIGNUM)
+        throw ProgramError("Value <"s + e->repr() + "> does not fit in 64 bits");
+    if (e->type() != Expr::Type::NUMERIC)
+        throw ProgramError("Value <"s + e->repr() + "> is not numeric");
+    return static_cast<const NumericExpr*>(e.get())->getValue();
+}
+
+const std::string &toString(const Value &value) {
+    const Eptr &e = exprOf(value);
+    if (e->type() != Expr::Type::STRING)
+        throw ProgramError("Value <"s + e->repr() + "> is not a string");
+    return static_cast<const StringExpr*>(e.get())->getValue();
+}
+
+const std::string &toSymbol(const Value &value) {
+    const Eptr &e = exprOf(value);
+    if (e->type() != Expr::Type::SYMBOL)
+        throw ProgramError("Value <"s + e->repr() + "> is not a symbol");
+    return static_cast<const SymbolExpr*>(e.get())->getValue();
+}
+
+Values toList(const Value &value) {
+    const Eptr &e = exprOf(value);
+    if (e->isNil())
+        return { };
+
+    if (e->type() != Expr::Type::CONS
+        || !static_cast<const ConsExpr*>(e.get())->isList())
+        throw ProgramError("Value <"s + e->repr() + "> is not a list");
+
+    return toValues(static_cast<ConsExpr*>(e.get())->asList());
+}
+
+Values toVector(const Value &value) {
+    const Eptr &e = exprOf(value);
+    if (e->type() != Expr::Type::VECTOR)
+        throw ProgramError("Value <"s + e->repr() + "> is not a vector");
+    return toValues(static_cast<const VectorExpr*>(e.get())->getItems());
+}
+
+}
@@ -0,0 +1,153 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "perf-counters.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace perf {
+
+namespace {
+
+struct EventSpec {
+    const char *name;
+    uint64_t    config;
+};
+
+// Indexed by Event.
+const EventSpec specs[] = {
+    { "cycles",           PERF_COUNT_HW_CPU_CYCLES          },
+    { "instructions",     PERF_COUNT_HW_INSTRUCTIONS        },
+    { "cache-references", PERF_COUNT_HW_CACHE_REFERENCES    },
+    { "cache-misses",     PERF_COUNT_HW_CACHE_MISSES        },
+    { "branches",         PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+    { "branch-misses",    PERF_COUNT_HW_BRANCH_MISSES       },
+};
+
+/**
+ * \brief Open a counter for EVENT in the group led by GROUPFD, or as
+ *        a new group leader if GROUPFD is -1.
+ */
+int openCounter(Event event, bool inherit, int groupFd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = specs[(size_t)event].config;
+    attr.disabled       = groupFd < 0; // Members follow their leader.
+    attr.inherit        = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED
+                        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // Inherited counters can not be read as a group on older kernels.
+    if (!inherit)
+        attr.read_format |= PERF_FORMAT_GROUP;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+/**
+ * \brief Scale up COUNT if the kernel multiplexed its counter.
+ */
+uint64_t scale(uint64_t count, uint64_t enabled, uint64_t running) {
+    // A group that does not fit in the hardware never runs.
+    if (enabled && !running)
+        throw ProgramError("Performance counters could not be scheduled together,"
+                           " try counting fewer events");
+
+    if (running < enabled)
+        return (double)count * enabled / running;
+    return count;
+}
+
+}
+
+const char *name(Event event) {
+    return specs[(size_t)event].name;
+}
+
+Event eventByName(const std::string &name) {
+    for (size_t i = 0; i < sizeof(specs) / sizeof(*specs); i++) {
+        if (name == specs[i].name)
+            return (Event)i;
+    }
+    throw ProgramError("Unknown performance counter '"s + name + "'");
+}
+
+std::vector<uint64_t> Counters::read() const {
+    std::vector<uint64_t> counts;
+
+    if (fds.empty())
+        return counts;
+
+    if (!inherit) {
+        // Read the whole group at once:
+        // count, time enabled, time running, one value per counter.
+        std::vector<uint64_t> values(3 + fds.size());
+        ssize_t size = values.size() * sizeof(uint64_t);
+
+        if (::read(fds[0], values.data(), size) != size)
+            throw ProgramError("Could not read performance counters: "s + strerror(errno));
+
+        for (size_t i = 0; i < fds.size(); i++)
+            counts.push_back(scale(values[3 + i], values[1], values[2]));
+
+        return counts;
+    }
+
+    // The group is scheduled as a whole, so every counter in it
+    // covers the same time.
+    for (int fd : fds) {
+        uint64_t values[3]; // value, time enabled, time running
+        if (::read(fd, values, sizeof(values)) != sizeof(values))
+            throw ProgramError("Could not read performance counter: "s + strerror(errno));
+
+        counts.push_back(scale(values[0], values[1], values[2]));
+    }
+
+    return counts;
+}
+
+Counters::Counters(const std::vector<Event> &events, bool inherit)
+    : events(events),
+      inherit(inherit) {
+
+    for (auto event : events) {
+        int fd = openCounter(event, inherit, fds.empty() ? -1 : fds[0]);
+        if (fd < 0) {
+            int error = errno;
+            for (int open : fds)
+                close(open);
+
+            throw ProgramError("Performance counter '"s + name(event)
+                               + "' is not available: " + strerror(error)
+                               + (error == EACCES || error == EPERM
+                                  ? " (see /proc/sys/kernel/perf_event_paranoid)"
+                                  : ""));
+        }
+        fds.push_back(fd);
+    }
+
+    // Enabling the leader starts the whole group.
+    if (fds.size())
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+Counters::~Counters() {
+    for (int fd : fds)
+        close(fd);
+}
+
+}
@@ -0,0 +1,86 @@
+/**
+ * \file
+ * \brief     Hardware performance counters.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Counters are read through Linux' perf_event_open(2), counting user
+ * space only. Whether they are available depends on the hardware (or
+ * hypervisor) and on kernel.perf_event_paranoid.
+ */
+namespace perf {
+
+enum class Event {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_REFERENCES,
+    CACHE_MISSES,
+    BRANCHES,
+    BRANCH_MISSES,
+};
+
+/**
+ * \brief Get the name of an event, e.g. "cache-misses".
+ */
+const char *name(Event event);
+
+/**
+ * \brief Find an event by name.
+ *
+ * \throw ProgramError if NAME is not a known event
+ */
+Event eventByName(const std::string &name);
+
+/**
+ * \brief A set of running counters.
+ *
+ * The counters are opened as one group, which the kernel schedules as
+ * a whole: when it has to multiplex counters, all counters in the set
+ * still count over the same time, so ratios between them (such as
+ * instructions per cycle) remain meaningful.
+ *
+ * Counters count the OS thread that opened them. An evaluation that
+ * moves to another OS thread, as green threads may do when they yield,
+ * is no longer counted.
+ */
+class Counters {
+
+    std::vector<Event> events;
+    std::vector<int>   fds; ///< The first is the group leader.
+    bool               inherit;
+
+public:
+    const std::vector<Event> &getEvents() const { return events; }
+
+    /**
+     * \brief Get the counts since the counters were opened.
+     *
+     * Counts are scaled up when the kernel had to multiplex the group.
+     */
+    std::vector<uint64_t> read() const;
+
+    /**
+     * \brief Open and start counters for EVENTS.
+     *
+     * \param inherit Whether threads started later by the calling
+     *                thread are counted as well. Otherwise, only the
+     *                calling thread is counted.
+     *
+     * \throw ProgramError if a counter is not available
+     */
+    Counters(const std::vector<Event> &events, bool inherit = false);
+    Counters(const Counters&) = delete;
+    Counters &operator=(const Counters&) = delete;
+    ~Counters();
+};
+
+}
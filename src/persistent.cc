@@ -0,0 +1,506 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "persistent.hh"
+#include "hash-table.hh"
+
+// Persistent vectors {{{
+
+typedef IVectorExpr::Node    VectorNode;
+typedef IVectorExpr::NodePtr VectorNodePtr;
+
+static const VectorNodePtr &emptyVectorNode() {
+    static const VectorNodePtr node = std::make_shared<const VectorNode>();
+    return node;
+}
+
+/**
+ * \brief Wrap LEAF in LEVEL / 5 single-child nodes.
+ */
+static VectorNodePtr newPath(unsigned level, const VectorNodePtr &leaf) {
+    if (!level)
+        return leaf;
+
+    auto node = std::make_shared<VectorNode>();
+    node->children.push_back(newPath(level - 5, leaf));
+    return node;
+}
+
+/**
+ * \brief Copy the path to index I, with the item at I set to VALUE.
+ */
+static VectorNodePtr assoc(unsigned level, const VectorNodePtr &node,
+                           size_t i, const Eptr &value) {
+
+    auto copy = std::make_shared<VectorNode>(*node);
+
+    if (level)
+        copy->children[(i >> level) & 31] = assoc(level - 5, node->children[(i >> level) & 31],
+                                                  i, value);
+    else
+        copy->items[i & 31] = value;
+
+    return copy;
+}
+
+const VectorNodePtr &IVectorExpr::leafFor(size_t i) const {
+    if (i >= tailOffset())
+        return tail;
+
+    const VectorNodePtr *node = &root;
+    for (unsigned level = shift; level; level -= 5)
+        node = &(*node)->children[(i >> level) & 31];
+
+    return *node;
+}
+
+VectorNodePtr IVectorExpr::pushTail(unsigned level,
+                                    const VectorNodePtr &parent,
+                                    const VectorNodePtr &tailNode) const {
+
+    // The index of the child that gets the tail.
+    size_t subIndex = ((count - 1) >> level) & 31;
+    auto copy = std::make_shared<VectorNode>(*parent);
+
+    VectorNodePtr child;
+    if (level == 5)
+        child = tailNode;
+    else if (subIndex < parent->children.size())
+        child = pushTail(level - 5, parent->children[subIndex], tailNode);
+    else
+        child = newPath(level - 5, tailNode);
+
+    if (subIndex < copy->children.size())
+        copy->children[subIndex] = child;
+    else
+        copy->children.push_back(child);
+
+    return copy;
+}
+
+VectorNodePtr IVectorExpr::popTail(unsigned level, const VectorNodePtr &node) const {
+    // The index of the child holding the leaf that becomes the tail.
+    size_t subIndex = ((count - 2) >> level) & 31;
+
+    if (level > 5) {
+        VectorNodePtr child = popTail(level - 5, node->children[subIndex]);
+        if (!child && !subIndex)
+            return nullptr;
+
+        auto copy = std::make_shared<VectorNode>(*node);
+        if (child)
+            copy->children[subIndex] = child;
+        else
+            copy->children.pop_back();
+        return copy;
+
+    } else if (!subIndex) {
+        return nullptr;
+
+    } else {
+        auto copy = std::make_shared<VectorNode>(*node);
+        copy->children.pop_back();
+        return copy;
+    }
+}
+
+IVectorEptr IVectorExpr::withTail(const VectorNodePtr &leaf) const {
+    if (!count)
+        return IVectorEptr(new IVectorExpr(leaf->items.size(), shift, root, leaf));
+
+    VectorNodePtr newRoot;
+    unsigned      newShift = shift;
+
+    if ((count >> 5) > ((size_t)1 << shift)) {
+        // The trie is full: add a level.
+        auto node = std::make_shared<VectorNode>();
+        node->children = { root, newPath(shift, tail) };
+        newRoot   = node;
+        newShift += 5;
+    } else {
+        newRoot = pushTail(shift, root, tail);
+    }
+
+    return IVectorEptr(new IVectorExpr(count + leaf->items.size(), newShift, newRoot, leaf));
+}
+
+std::string IVectorExpr::repr() const {
+    std::string s = "#ivector(";
+    bool first = true;
+
+    forEach([&](const Eptr &item) {
+        if (!first)
+            s += " ";
+        s += item->repr();
+        first = false;
+    });
+
+    return s + ")";
+}
+
+const Eptr &IVectorExpr::at(int64_t i) const {
+    if (i < 0 || (uint64_t)i >= count)
+        throw ProgramError("Index "s + std::to_string(i)
+                           + " out of range for vector of length "
+                           + std::to_string(count));
+
+    return leafFor(i)->items[i & 31];
+}
+
+IVectorEptr IVectorExpr::set(int64_t i, const Eptr &value) const {
+    at(i);
+
+    if ((size_t)i >= tailOffset()) {
+        auto newTail = std::make_shared<VectorNode>(*tail);
+        newTail->items[i & 31] = value;
+        return IVectorEptr(new IVectorExpr(count, shift, root, newTail));
+    }
+
+    return IVectorEptr(new IVectorExpr(count, shift, assoc(shift, root, i, value), tail));
+}
+
+IVectorEptr IVectorExpr::push(const Eptr &value) const {
+    auto leaf = std::make_shared<VectorNode>();
+
+    if (count - tailOffset() < 32 && count) {
+        *leaf = *tail;
+        leaf->items.push_back(value);
+        return IVectorEptr(new IVectorExpr(count + 1, shift, root, leaf));
+    }
+
+    leaf->items.push_back(value);
+    return withTail(leaf);
+}
+
+IVectorEptr IVectorExpr::pop() const {
+    if (!count)
+        throw ProgramError("Cannot pop from an empty vector");
+
+    if (count == 1)
+        return std::make_shared<IVectorExpr>();
+
+    if (count - tailOffset() > 1) {
+        auto newTail = std::make_shared<VectorNode>(*tail);
+        newTail->items.pop_back();
+        return IVectorEptr(new IVectorExpr(count - 1, shift, root, newTail));
+    }
+
+    // The tail becomes empty: the last leaf in the trie replaces it.
+    VectorNodePtr newTail  = leafFor(count - 2);
+    VectorNodePtr newRoot  = popTail(shift, root);
+    unsigned      newShift = shift;
+
+    if (!newRoot)
+        newRoot = emptyVectorNode();
+
+    if (shift > 5 && newRoot->children.size() == 1) {
+        newRoot   = newRoot->children[0];
+        newShift -= 5;
+    }
+
+    return IVectorEptr(new IVectorExpr(count - 1, newShift, newRoot, newTail));
+}
+
+void IVectorExpr::forEach(const std::function<void(const Eptr&)> &f) const {
+    for (size_t i = 0; i < count; i += 32) {
+        for (const auto &item : leafFor(i)->items)
+            f(item);
+    }
+}
+
+Elist IVectorExpr::items() const {
+    Elist result;
+    result.reserve(count);
+    forEach([&](const Eptr &item) { result.push_back(item); });
+    return result;
+}
+
+IVectorEptr IVectorExpr::fromList(const Elist &items) {
+    auto vector = std::make_shared<IVectorExpr>();
+
+    // Build leaves directly, rather than copying the tail for every
+    // item.
+    for (size_t i = 0; i < items.size(); i += 32) {
+        auto leaf = std::make_shared<VectorNode>();
+        leaf->items.assign(items.begin() + i,
+                           items.begin() + std::min(i + 32, items.size()));
+        vector = vector->withTail(leaf);
+    }
+
+    return vector;
+}
+
+IVectorExpr::IVectorExpr(size_t count, unsigned shift,
+                         VectorNodePtr root, VectorNodePtr tail)
+    : count(count),
+      shift(shift),
+      root(std::move(root)),
+      tail(std::move(tail)) {
+    profileAlloc(Type::IVECTOR, sizeof(*this));
+}
+
+IVectorExpr::IVectorExpr()
+    : root(emptyVectorNode()),
+      tail(emptyVectorNode()) {
+    profileAlloc(Type::IVECTOR, sizeof(*this));
+}
+
+// }}}
+// Persistent maps {{{
+
+typedef IMapExpr::Entry   MapEntry;
+typedef IMapExpr::Node    MapNode;
+typedef IMapExpr::NodePtr MapNodePtr;
+
+/// At this shift, hashes have no bits left: nodes are collision nodes.
+static constexpr unsigned hashBits = 64;
+
+static const MapNodePtr &emptyMapNode() {
+    static const MapNodePtr node = std::make_shared<const MapNode>();
+    return node;
+}
+
+static uint32_t slotBit(size_t hash, unsigned shift) {
+    return 1u << ((hash >> shift) & 31);
+}
+
+/**
+ * \brief Get the index in a node's entries or children of the slot
+ *        BIT, given the slots in use, MAP.
+ */
+static size_t slotIndex(uint32_t map, uint32_t bit) {
+    return __builtin_popcount(map & (bit - 1));
+}
+
+static bool sameKey(const MapEntry &entry, const Expr &key, size_t hash) {
+    return entry.hash == hash && structuralEqual(*entry.key, key);
+}
+
+/**
+ * \brief Make a node for two entries with different keys.
+ */
+static MapNodePtr mergeEntries(const MapEntry &a, const MapEntry &b, unsigned shift) {
+    auto node = std::make_shared<MapNode>();
+
+    if (shift >= hashBits) {
+        node->entries = { a, b };
+        return node;
+    }
+
+    uint32_t bitA = slotBit(a.hash, shift);
+    uint32_t bitB = slotBit(b.hash, shift);
+
+    if (bitA == bitB) {
+        node->childMap = bitA;
+        node->children = { mergeEntries(a, b, shift + 5) };
+    } else {
+        node->entryMap = bitA | bitB;
+        node->entries  = bitA < bitB ? std::vector<MapEntry> { a, b }
+                                     : std::vector<MapEntry> { b, a };
+    }
+
+    return node;
+}
+
+static MapNodePtr putEntry(const MapNodePtr &node, const MapEntry &entry,
+                           unsigned shift, bool &added) {
+
+    if (shift >= hashBits) {
+        auto copy = std::make_shared<MapNode>(*node);
+        for (auto &existing : copy->entries) {
+            if (sameKey(existing, *entry.key, entry.hash)) {
+                existing.value = entry.value;
+                return copy;
+            }
+        }
+        copy->entries.push_back(entry);
+        added = true;
+        return copy;
+    }
+
+    uint32_t bit = slotBit(entry.hash, shift);
+
+    if (node->entryMap & bit) {
+        size_t index = slotIndex(node->entryMap, bit);
+        const MapEntry &existing = node->entries[index];
+
+        if (sameKey(existing, *entry.key, entry.hash)) {
+            if (existing.value == entry.value)
+                return node;
+
+            auto copy = std::make_shared<MapNode>(*node);
+            copy->entries[index].value = entry.value;
+            return copy;
+        }
+
+        // Move both entries down into a new child.
+        auto copy  = std::make_shared<MapNode>(*node);
+        auto child = mergeEntries(existing, entry, shift + 5);
+
+        copy->entries.erase(copy->entries.begin() + index);
+        copy->entryMap ^= bit;
+        copy->childMap |= bit;
+        copy->children.insert(copy->children.begin() + slotIndex(copy->childMap, bit), child);
+
+        added = true;
+        return copy;
+    }
+
+    if (node->childMap & bit) {
+        size_t index = slotIndex(node->childMap, bit);
+        auto child = putEntry(node->children[index], entry, shift + 5, added);
+        if (child == node->children[index])
+            return node;
+
+        auto copy = std::make_shared<MapNode>(*node);
+        copy->children[index] = child;
+        return copy;
+    }
+
+    auto copy = std::make_shared<MapNode>(*node);
+    copy->entryMap |= bit;
+    copy->entries.insert(copy->entries.begin() + slotIndex(copy->entryMap, bit), entry);
+
+    added = true;
+    return copy;
+}
+
+static MapNodePtr removeEntry(const MapNodePtr &node, const Expr &key, size_t hash,
+                              unsigned shift, bool &removed) {
+
+    if (shift >= hashBits) {
+        for (size_t i = 0; i < node->entries.size(); i++) {
+            if (sameKey(node->entries[i], key, hash)) {
+                auto copy = std::make_shared<MapNode>(*node);
+                copy->entries.erase(copy->entries.begin() + i);
+                removed = true;
+                return copy;
+            }
+        }
+        return node;
+    }
+
+    uint32_t bit = slotBit(hash, shift);
+
+    if (node->entryMap & bit) {
+        size_t index = slotIndex(node->entryMap, bit);
+        if (!sameKey(node->entries[index], key, hash))
+            return node;
+
+        auto copy = std::make_shared<MapNode>(*node);
+        copy->entries.erase(copy->entries.begin() + index);
+        copy->entryMap ^= bit;
+
+        removed = true;
+        return copy;
+    }
+
+    if (node->childMap & bit) {
+        size_t index = slotIndex(node->childMap, bit);
+        auto child = removeEntry(node->children[index], key, hash, shift + 5, removed);
+        if (!removed)
+            return node;
+
+        auto copy = std::make_shared<MapNode>(*node);
+
+        if (child->children.empty() && child->entries.size() <= 1) {
+            // Keep the trie compact: a child with one entry left is
+            // replaced by that entry.
+            copy->children.erase(copy->children.begin() + index);
+            copy->childMap ^= bit;
+
+            if (child->entries.size()) {
+                copy->entryMap |= bit;
+                copy->entries.insert(copy->entries.begin() + slotIndex(copy->entryMap, bit),
+                                     child->entries[0]);
+            }
+        } else {
+            copy->children[index] = child;
+        }
+
+        return copy;
+    }
+
+    return node;
+}
+
+static void forEachEntry(const MapNode &node,
+                         const std::function<void(const MapEntry&)> &f) {
+    for (const auto &entry : node.entries)
+        f(entry);
+    for (const auto &child : node.children)
+        forEachEntry(*child, f);
+}
+
+std::string IMapExpr::repr() const {
+    std::string s = "#imap(";
+    bool first = true;
+
+    forEach([&](const Entry &entry) {
+        if (!first)
+            s += " ";
+        s += "(" + entry.key->repr() + " . " + entry.value->repr() + ")";
+        first = false;
+    });
+
+    return s + ")";
+}
+
+Eptr IMapExpr::get(const Eptr &key) const {
+    size_t hash = structuralHash(*key);
+    const MapNode *node = root.get();
+
+    for (unsigned shift = 0; shift < hashBits; shift += 5) {
+        uint32_t bit = slotBit(hash, shift);
+
+        if (node->entryMap & bit) {
+            const auto &entry = node->entries[slotIndex(node->entryMap, bit)];
+            return sameKey(entry, *key, hash) ? entry.value : nullptr;
+        }
+        if (!(node->childMap & bit))
+            return nullptr;
+
+        node = node->children[slotIndex(node->childMap, bit)].get();
+    }
+
+    for (const auto &entry : node->entries) {
+        if (sameKey(entry, *key, hash))
+            return entry.value;
+    }
+    return nullptr;
+}
+
+IMapEptr IMapExpr::put(const Eptr &key, const Eptr &value) const {
+    bool added = false;
+    auto newRoot = putEntry(root, MapEntry { key, value, structuralHash(*key) }, 0, added);
+
+    return IMapEptr(new IMapExpr(count + added, newRoot));
+}
+
+IMapEptr IMapExpr::remove(const Eptr &key) const {
+    bool removed = false;
+    auto newRoot = removeEntry(root, *key, structuralHash(*key), 0, removed);
+
+    return IMapEptr(new IMapExpr(count - removed, newRoot));
+}
+
+void IMapExpr::forEach(const std::function<void(const Entry&)> &f) const {
+    forEachEntry(*root, f);
+}
+
+IMapExpr::IMapExpr(size_t count, MapNodePtr root)
+    : count(count),
+      root(std::move(root)) {
+    profileAlloc(Type::IMAP, sizeof(*this));
+}
+
+IMapExpr::IMapExpr()
+    : root(emptyMapNode()) {
+    profileAlloc(Type::IMAP, sizeof(*this));
+}
+
+// }}}
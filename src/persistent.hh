@@ -0,0 +1,174 @@
+/**
+ * \file
+ * \brief     Persistent (immutable) collections.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+#include <functional>
+
+/**
+ * \brief Persistent vector Expression type.
+ *
+ * An immutable vector. Updates return a new vector that shares all but
+ * O(log32 n) nodes with the old one, which makes them cheap, and makes
+ * the vector safe to share between threads.
+ *
+ * Items are kept in a trie of 32-way nodes, indexed by the bits of
+ * their index, five at a time. The last (up to) 32 items are kept
+ * outside the trie in a tail, so that appending is usually a copy of
+ * the tail only.
+ */
+class IVectorExpr : public Expr {
+
+public:
+    struct Node {
+        std::vector<std::shared_ptr<const Node>> children; ///< Internal nodes.
+        Elist items;                                       ///< Leaves.
+    };
+    typedef std::shared_ptr<const Node> NodePtr;
+
+private:
+    size_t  count = 0;
+    unsigned shift = 5;  ///< The index bits above the root's children.
+    NodePtr root;
+    NodePtr tail;
+
+    size_t tailOffset() const { return count < 32 ? 0 : ((count - 1) >> 5) << 5; }
+
+    /**
+     * \brief Get the leaf that holds index I.
+     */
+    const NodePtr &leafFor(size_t i) const;
+
+    NodePtr pushTail(unsigned level, const NodePtr &parent, const NodePtr &tailNode) const;
+    NodePtr popTail(unsigned level, const NodePtr &node) const;
+
+    /**
+     * \brief Get a vector with LEAF as its tail, moving the current
+     *        tail into the trie.
+     *
+     * The current tail must be full, or the vector empty.
+     */
+    std::shared_ptr<IVectorExpr> withTail(const NodePtr &leaf) const;
+
+    IVectorExpr(size_t count, unsigned shift, NodePtr root, NodePtr tail);
+
+public:
+    Type type() const override { return Type::IVECTOR; }
+
+    std::string repr() const override;
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    size_t size() const { return count; }
+
+    /**
+     * \throw ProgramError if I is out of range
+     */
+    const Eptr &at(int64_t i) const;
+
+    /**
+     * \brief Get a vector with the item at index I replaced by VALUE.
+     */
+    std::shared_ptr<IVectorExpr> set(int64_t i, const Eptr &value) const;
+
+    /**
+     * \brief Get a vector with VALUE appended.
+     */
+    std::shared_ptr<IVectorExpr> push(const Eptr &value) const;
+
+    /**
+     * \brief Get a vector without its last item.
+     */
+    std::shared_ptr<IVectorExpr> pop() const;
+
+    /**
+     * \brief Call F for every item, in order.
+     */
+    void forEach(const std::function<void(const Eptr&)> &f) const;
+
+    Elist items() const;
+
+    static std::shared_ptr<IVectorExpr> fromList(const Elist &items);
+
+    IVectorExpr();
+};
+
+typedef std::shared_ptr<IVectorExpr> IVectorEptr;
+
+/**
+ * \brief Persistent map Expression type.
+ *
+ * An immutable hash map, comparing keys with structuralEqual(). It is
+ * a hash array mapped trie: every node has up to 32 slots, indexed by
+ * five bits of the key's hash, that either hold an entry or a child
+ * node for the next five bits. Updates copy only the path to the
+ * changed slot. Keys whose hashes are equal in all 64 bits share a
+ * collision node at the bottom of the trie.
+ */
+class IMapExpr : public Expr {
+
+public:
+    struct Entry {
+        Eptr   key;
+        Eptr   value;
+        size_t hash;
+    };
+
+    struct Node {
+        uint32_t entryMap = 0; ///< Slots holding an entry.
+        uint32_t childMap = 0; ///< Slots holding a child node.
+        std::vector<Entry> entries;  ///< In slot order; unordered in collision nodes.
+        std::vector<std::shared_ptr<const Node>> children;
+    };
+    typedef std::shared_ptr<const Node> NodePtr;
+
+private:
+    size_t  count = 0;
+    NodePtr root;
+
+    IMapExpr(size_t count, NodePtr root);
+
+public:
+    Type type() const override { return Type::IMAP; }
+
+    std::string repr() const override;
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    size_t size() const { return count; }
+
+    /**
+     * \brief Get the value of KEY, nullptr if there is none.
+     */
+    Eptr get(const Eptr &key) const;
+
+    /**
+     * \brief Get a map with KEY set to VALUE.
+     */
+    std::shared_ptr<IMapExpr> put(const Eptr &key, const Eptr &value) const;
+
+    /**
+     * \brief Get a map without KEY.
+     */
+    std::shared_ptr<IMapExpr> remove(const Eptr &key) const;
+
+    /**
+     * \brief Call F for every entry, in no particular order.
+     */
+    void forEach(const std::function<void(const Entry&)> &f) const;
+
+    IMapExpr();
+};
+
+typedef std::shared_ptr<IMapExpr> IMapEptr;
@@ -7,9 +7,29 @@
  */
 #include "print.hh"
 
+static thread_local std::ostream *outputStream = nullptr;
+
+std::ostream &output() {
+    return outputStream ? *outputStream : std::cout;
+}
+
+std::ostream *swapOutput(std::ostream *stream) {
+    std::swap(stream, outputStream);
+    return stream;
+}
+
+OutputRedirect::OutputRedirect(std::ostream &stream)
+    : previous(outputStream) {
+    outputStream = &stream;
+}
+
+OutputRedirect::~OutputRedirect() {
+    outputStream = previous;
+}
+
 void print(Eptr expr, int depth) {
     std::string indent;
     indent.resize(depth, ' ');
 
-    std::cout << expr->repr() << "\n";
+    output() << expr->repr() << "\n";
 }
@@ -12,6 +12,40 @@
 
 #include <iostream>
 
+/**
+ * \brief Get the stream printed output is written to.
+ *
+ * This is std::cout, unless output is redirected in the current
+ * thread.
+ */
+std::ostream &output();
+
+/**
+ * \brief Redirects printed output of the current thread for the
+ *        lifetime of this object.
+ */
+class OutputRedirect {
+
+    std::ostream *previous;
+
+public:
+    OutputRedirect(std::ostream &stream);
+    OutputRedirect(const OutputRedirect&) = delete;
+    OutputRedirect &operator=(const OutputRedirect&) = delete;
+    ~OutputRedirect();
+};
+
+/**
+ * \brief Replace the output target of the current thread.
+ *
+ * For switching between green threads; use OutputRedirect otherwise.
+ *
+ * \param stream The new target, nullptr for std::cout
+ *
+ * \return The previous target
+ */
+std::ostream *swapOutput(std::ostream *stream);
+
 /**
  * \brief Print an expression.
  */
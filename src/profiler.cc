@@ -0,0 +1,219 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "profiler.hh"
+#include "expression.hh"
+#include "serialize.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/time.h>
+
+namespace profiler {
+
+bool enabled = false;
+
+namespace {
+
+// Read from the signal handler: must not need lazy TLS allocation.
+__attribute__((tls_model("initial-exec")))
+thread_local ShadowStack *currentStack = nullptr;
+
+__attribute__((tls_model("initial-exec")))
+thread_local ShadowStack threadStack;
+
+// Function names {{{
+
+std::mutex                                namesMutex;
+std::deque<std::string>                   names { "(unknown)" };
+std::unordered_map<std::string, uint32_t> nameIds;
+
+// }}}
+
+}
+
+uint32_t nameId(const SymbolExpr &symbol) {
+    uint32_t id = symbol.profileId().load(std::memory_order_relaxed);
+    if (id)
+        return id;
+
+    std::lock_guard<std::mutex> lock(namesMutex);
+
+    auto result = nameIds.emplace(symbol.getValue(), names.size());
+    if (result.second)
+        names.push_back(symbol.getValue());
+
+    id = result.first->second;
+    symbol.profileId().store(id, std::memory_order_relaxed);
+    return id;
+}
+
+std::string name(uint32_t id) {
+    std::lock_guard<std::mutex> lock(namesMutex);
+    return id < names.size() ? names[id] : names[0];
+}
+
+namespace {
+
+// Sampling {{{
+
+struct Sample {
+    enum State : uint32_t { FREE, WRITING, READY };
+
+    std::atomic<uint32_t> state { FREE };
+    uint32_t              depth;
+    uint32_t              frames[maxDepth];
+};
+
+constexpr size_t ringSize = 1024;
+
+Sample                ring[ringSize];
+std::atomic<uint64_t> nextSample { 0 };
+std::atomic<uint64_t> dropped    { 0 };
+
+void onSample(int) {
+    ShadowStack *stack = currentStack;
+    if (!stack)
+        return;
+
+    int savedErrno = errno;
+
+    Sample &sample = ring[nextSample.fetch_add(1, std::memory_order_relaxed) % ringSize];
+
+    uint32_t expected = Sample::FREE;
+    if (sample.state.compare_exchange_strong(expected, Sample::WRITING,
+                                             std::memory_order_acquire)) {
+
+        sample.depth = std::min<uint32_t>(stack->depth.load(std::memory_order_relaxed),
+                                          maxDepth);
+        memcpy(sample.frames, stack->frames, sample.depth * sizeof(uint32_t));
+
+        sample.state.store(Sample::READY, std::memory_order_release);
+    } else {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    errno = savedErrno;
+}
+
+// }}}
+// Aggregation {{{
+
+std::map<std::vector<uint32_t>, uint64_t> counts;
+
+std::atomic<bool> stopping { false };
+std::thread       drainThread;
+
+void drain() {
+    for (auto &sample : ring) {
+        if (sample.state.load(std::memory_order_acquire) != Sample::READY)
+            continue;
+
+        counts[std::vector<uint32_t>(sample.frames, sample.frames + sample.depth)]++;
+        sample.state.store(Sample::FREE, std::memory_order_release);
+    }
+}
+
+// }}}
+
+}
+
+void push(const SymbolExpr &symbol) {
+    ShadowStack *stack = currentStack;
+    if (!stack)
+        stack = currentStack = &threadStack;
+
+    uint32_t depth = stack->depth.load(std::memory_order_relaxed);
+    if (depth < maxDepth)
+        stack->frames[depth] = nameId(symbol);
+
+    // The frame must be complete before a signal handler can see it.
+    std::atomic_signal_fence(std::memory_order_release);
+    stack->depth.store(depth + 1, std::memory_order_relaxed);
+}
+
+void pop() {
+    ShadowStack *stack = currentStack;
+    stack->depth.store(stack->depth.load(std::memory_order_relaxed) - 1,
+                       std::memory_order_relaxed);
+}
+
+ShadowStack *swapStack(ShadowStack *stack) {
+    ShadowStack *previous = currentStack;
+    currentStack = stack;
+    return previous;
+}
+
+void start(unsigned hz) {
+    enabled = true;
+
+    drainThread = std::thread([]{
+        while (!stopping) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSample;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    itimerval timer;
+    timer.it_interval.tv_sec  = 0;
+    timer.it_interval.tv_usec = 1000000 / std::max(hz, 1u);
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void stop(const std::string &path) {
+    itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    stopping = true;
+    if (drainThread.joinable())
+        drainThread.join();
+    drain();
+
+    std::ostringstream out;
+    {
+        std::lock_guard<std::mutex> lock(namesMutex);
+
+        for (auto &entry : counts) {
+            if (entry.first.empty())
+                out << "(toplevel)";
+
+            for (size_t i = 0; i < entry.first.size(); i++)
+                out << (i ? ";" : "") << names[entry.first[i]];
+
+            out << " " << entry.second << "\n";
+        }
+    }
+
+    if (dropped)
+        std::cerr << "profiler: dropped " << dropped << " samples\n";
+
+    if (!writeFileAtomic(path, out.str()))
+        throw ProgramError("Could not write profile to '"s + path + "'");
+}
+
+}
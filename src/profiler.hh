@@ -0,0 +1,99 @@
+/**
+ * \file
+ * \brief     Sampling profiler for Lisp function calls.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <atomic>
+#include <cstdint>
+
+class SymbolExpr;
+
+/**
+ * While profiling, every thread keeps a shadow stack of the functions
+ * it is calling, named by the symbol they were called through. A
+ * SIGPROF handler copies the stack of the interrupted thread into a
+ * ring of samples, which a background thread aggregates. The result is
+ * written in the folded stack format of flamegraph.pl:
+ *
+ *   outer;inner;innermost <sample count>
+ */
+namespace profiler {
+
+constexpr size_t maxDepth = 128;
+
+/**
+ * \brief The functions a thread (or green thread) is calling.
+ *
+ * Frames deeper than maxDepth are counted, but not recorded.
+ */
+struct ShadowStack {
+    std::atomic<uint32_t> depth { 0 };
+    uint32_t              frames[maxDepth];
+};
+
+extern bool enabled;
+
+/**
+ * \brief Get the id of the function name SYMBOL, assigning one if needed.
+ *
+ * Ids are small and dense. Id 0 is "(unknown)".
+ */
+uint32_t nameId(const SymbolExpr &symbol);
+
+/**
+ * \brief Get the function name with id ID.
+ */
+std::string name(uint32_t id);
+
+void push(const SymbolExpr &symbol);
+void pop();
+
+/**
+ * \brief Make STACK the shadow stack of the current thread.
+ *
+ * \return The previous stack
+ */
+ShadowStack *swapStack(ShadowStack *stack);
+
+/**
+ * \brief Records a call for the lifetime of this object, if profiling.
+ */
+class Frame {
+
+    bool active;
+
+public:
+    Frame(const SymbolExpr &symbol)
+        : active(enabled) {
+        if (active)
+            push(symbol);
+    }
+
+    ~Frame() {
+        if (active)
+            pop();
+    }
+
+    Frame(const Frame&) = delete;
+    Frame &operator=(const Frame&) = delete;
+};
+
+/**
+ * \brief Start sampling, about HZ times per second of CPU time.
+ */
+void start(unsigned hz = 997);
+
+/**
+ * \brief Stop sampling and write the folded stacks to PATH.
+ *
+ * \throw ProgramError if the file could not be written
+ */
+void stop(const std::string &path);
+
+}
@@ -0,0 +1,160 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "rcu.hh"
+
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace rcu {
+
+namespace {
+
+/// Incremented on every scan. Starts at 1: 0 marks idle threads.
+std::atomic<uint64_t> globalEpoch { 1 };
+
+/**
+ * \brief Per-thread reader state.
+ *
+ * Records are never freed. They are linked into a push-only list, and
+ * reused by new threads once their owner exits.
+ */
+struct Record {
+    std::atomic<uint64_t> epoch { 0 };
+    std::atomic<bool>     inUse { true };
+    unsigned              depth = 0;
+    Record               *next  = nullptr;
+};
+
+std::atomic<Record*> records { nullptr };
+
+Record *acquireRecord() {
+    for (Record *r = records.load(); r; r = r->next) {
+        bool expected = false;
+        if (!r->inUse && r->inUse.compare_exchange_strong(expected, true))
+            return r;
+    }
+
+    Record *r = new Record;
+    r->next = records.load();
+    while (!records.compare_exchange_weak(r->next, r))
+        ;
+    return r;
+}
+
+struct Retired {
+    std::shared_ptr<const void> object;
+    uint64_t                    epoch;
+};
+
+/// Retired objects are scanned once a thread has this many pending.
+const size_t scanThreshold = 64;
+
+/// Objects left behind by threads that exited, adopted by the next scan.
+std::mutex           orphanMutex;
+std::vector<Retired> orphans;
+std::atomic<bool>    haveOrphans { false };
+
+struct ThreadRecord {
+    Record *record = acquireRecord();
+
+    /// Objects retired by this thread that may still be in use.
+    std::vector<Retired> pending;
+
+    ~ThreadRecord() {
+        record->epoch = 0;
+        record->depth = 0;
+        record->inUse = false;
+
+        if (pending.size()) {
+            std::lock_guard<std::mutex> lock(orphanMutex);
+            for (auto &item : pending)
+                orphans.push_back(std::move(item));
+            haveOrphans = true;
+        }
+    }
+};
+
+thread_local ThreadRecord threadRecord;
+
+/**
+ * \brief Get the oldest epoch a reader is currently in.
+ */
+uint64_t oldestReader() {
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+
+    for (Record *r = records.load(); r; r = r->next) {
+        uint64_t epoch = r->epoch.load();
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
+
+/**
+ * \brief Release the pending objects of this thread that no reader can
+ *        still refer to.
+ */
+void scan() {
+    auto &pending = threadRecord.pending;
+
+    if (haveOrphans) {
+        std::lock_guard<std::mutex> lock(orphanMutex);
+        for (auto &item : orphans)
+            pending.push_back(std::move(item));
+        orphans.clear();
+        haveOrphans = false;
+    }
+
+    // Readers that enter from now on can not see any pending object.
+    globalEpoch.fetch_add(1);
+    uint64_t oldest = oldestReader();
+
+    std::vector<Retired> freed;
+
+    auto live = pending.begin();
+    for (auto &item : pending) {
+        if (item.epoch <= oldest)
+            freed.push_back(std::move(item));
+        else
+            *live++ = std::move(item);
+    }
+    pending.erase(live, pending.end());
+
+    // Destructors may retire more objects.
+}
+
+}
+
+ReadGuard::ReadGuard() {
+    Record *r = threadRecord.record;
+    if (!r->depth++)
+        r->epoch.store(globalEpoch.load());
+}
+
+ReadGuard::~ReadGuard() {
+    Record *r = threadRecord.record;
+    if (!--r->depth)
+        r->epoch.store(0, std::memory_order_release);
+}
+
+void retire(std::shared_ptr<const void> object) {
+    // Readers that entered before the next epoch may hold the object.
+    uint64_t epoch = globalEpoch.load() + 1;
+
+    auto &pending = threadRecord.pending;
+    pending.push_back({ std::move(object), epoch });
+
+    // Scanning costs time linear in the number of threads, so it is
+    // only done once every scanThreshold retirements.
+    if (pending.size() >= scanThreshold)
+        scan();
+}
+
+}
@@ -0,0 +1,48 @@
+/**
+ * \file
+ * \brief     Epoch-based reclamation for lock-free readers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+/**
+ * Lock-free readers announce themselves with a ReadGuard. Writers
+ * that unlink an object readers may still be looking at hand their
+ * reference to retire(), which keeps the object alive until every
+ * reader that could have seen it has left its read section.
+ */
+namespace rcu {
+
+/**
+ * \brief Marks a read section on the current thread.
+ *
+ * Read sections may nest. They must be short: objects retired while
+ * any reader is inside a section are not freed until it leaves.
+ */
+class ReadGuard {
+public:
+    ReadGuard();
+    ~ReadGuard();
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard &operator=(const ReadGuard&) = delete;
+};
+
+/**
+ * \brief Release OBJECT once no reader can still refer to it.
+ *
+ * The object must already be unreachable for new readers.
+ *
+ * Retired objects are kept in a list per thread, which is only
+ * scanned for objects that can be released once it has grown past a
+ * threshold, so retiring is cheap and takes no lock. The flip side is
+ * that up to a threshold's worth of objects per thread outlive their
+ * last reader until that thread retires more.
+ */
+void retire(std::shared_ptr<const void> object);
+
+}
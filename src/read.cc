@@ -6,20 +6,38 @@
  * \license   MIT, see LICENSE.
  */
 #include "read.hh"
+#include "bignum.hh"
+#include "persistent.hh"
+#include "vector.hh"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 /**
  * \brief Tokenize one textual expression.
  */
-static std::vector<Token> tokenize(std::istream &stream) {
+static std::vector<Token> tokenize(std::istream &stream,
+                                   SourceLocation &position) {
 
     std::vector<Token> tokens;
     int listLevel = 0;
 
+    // The location of the last character read.
+    SourceLocation location = position;
+
     class EndOfInput { };
 
     auto next = [&](bool required) {
         char c;
         if (stream.get(c)) {
+            location = position;
+            if (c == '\n') {
+                position.line++;
+                position.column = 1;
+            } else if (position.column < UINT16_MAX) {
+                position.column++;
+            }
             return c;
         } else if (listLevel) {
             throw SyntaxError("Unexpected EOF while reading list expression");
@@ -61,6 +79,7 @@ static std::vector<Token> tokenize(std::istream &stream) {
         }
 
         Token token;
+        token.location = location;
 
         try {
             // Parse one token.
@@ -146,6 +165,16 @@ static std::vector<Token> tokenize(std::istream &stream) {
                 while (!isBreak((c = next(false))))
                     token.content += c;
 
+                // Vector syntax: #( or a #TYPE( prefix.
+                if (token.content[0] == '#' && c == '(') {
+                    token.type     = Token::Type::VECTOR_START;
+                    token.content += c;
+
+                    listLevel++;
+
+                    c = next(false);
+                }
+
             } else {
                 throw SyntaxError("Unexpected text: char "s + std::to_string(c));
             }
@@ -158,6 +187,7 @@ static std::vector<Token> tokenize(std::istream &stream) {
                 // We have a complete expression (a complete list or one atom).
                 // We haven't reached the end of the stream yet.
                 stream.putback(c);
+                position = location;
                 break;
             }
 
@@ -181,7 +211,11 @@ static std::vector<Token> tokenize(std::istream &stream) {
  */
 static Eptr readAtom(const Token &token) {
     if (token.type == Token::Type::ATOM_NUMERIC) {
-        return std::make_shared<NumericExpr>(std::stoll(token.content));
+        // Up to 18 digits always fit in a numeric.
+        if (token.content.size() <= 18)
+            return std::make_shared<NumericExpr>(std::stoll(token.content));
+
+        return makeIntegerExpr(Bignum::parse(token.content));
 
     } else if (token.type == Token::Type::ATOM_STRING) {
         return std::make_shared<StringExpr>(token.content);
@@ -195,22 +229,76 @@ static Eptr readAtom(const Token &token) {
 }
 
 /**
- * \brief Create a nested cons from a series of tokens.
+ * \brief Create a vector of ITEMS, of the kind its opening token says.
+ */
+static Eptr makeVector(const std::string &start, Elist items) {
+    if (start == "#(")
+        return std::make_shared<VectorExpr>(std::move(items));
+
+    if (start == "#ivector(")
+        return IVectorExpr::fromList(items);
+
+    if (start == "#imap(") {
+        // Items are (KEY . VALUE) pairs.
+        IMapEptr map = std::make_shared<IMapExpr>();
+
+        for (const auto &item : items) {
+            if (item->type() != Expr::Type::CONS)
+                throw SyntaxError("Persistent map items must be (key . value) pairs");
+
+            auto pair = static_cast<ConsExpr*>(item.get());
+            map = map->put(pair->getCar(), pair->getCdr());
+        }
+
+        return map;
+    }
+
+    std::vector<int64_t> values;
+    values.reserve(items.size());
+
+    for (const auto &item : items) {
+        if (item->type() != Expr::Type::NUMERIC)
+            throw SyntaxError("Integer arrays may only contain numerics");
+        values.push_back(static_cast<NumericExpr*>(item.get())->getValue());
+    }
+
+    return std::make_shared<IntArrayExpr>(std::move(values));
+}
+
+/**
+ * \brief Create a nested cons, or a vector, from a series of tokens.
  */
 template<typename It>
 static Eptr readCons(const It &start, const It &end) {
 
-    if (start->type != Token::Type::LIST_START)
+    if (!start->isListStart())
         throw LogicError("Tokens do not specify a cons (start))");
     if ((end-1)->type != Token::Type::LIST_END)
         throw LogicError("Tokens do not specify a cons (end)");
 
     auto size = std::distance(start, end);
 
-    if (size > 2) {
-        auto rootCons         = std::make_shared<ConsExpr>();
+    // Vector items are collected here instead of in conses.
+    bool  isVector = start->type == Token::Type::VECTOR_START;
+    Elist items;
+
+    if (isVector
+        && start->content != "#("
+        && start->content != "#i64("
+        && start->content != "#ivector("
+        && start->content != "#imap(")
+        throw SyntaxError("Unknown vector syntax '"s + start->content + "'");
+
+    if (isVector && size == 2) {
+        return makeVector(start->content, { });
+
+    } else if (size > 2) {
+        auto rootCons         = isVector ? nullptr : std::make_shared<ConsExpr>();
         ConsExpr *currentCons = rootCons.get();
 
+        if (rootCons)
+            rootCons->setLocation(start->location);
+
         bool haveDot = false; // Whether the previous token was a dot.
         int quotes = 0;
 
@@ -218,8 +306,11 @@ static Eptr readCons(const It &start, const It &end) {
         for (auto it = start + 1; it != end - 1; it++) {
 
             Eptr currentExpr = nullptr;
+            auto exprLocation = it->location;
 
             if (it->type == Token::Type::CONS_DOT) {
+                if (isVector)
+                    throw SyntaxError("Invalid dot syntax (in vector)");
                 if (haveDot)
                     throw SyntaxError("Invalid dot syntax (second dot)");
                 if (!currentCons->getCar())
@@ -235,14 +326,14 @@ static Eptr readCons(const It &start, const It &end) {
 
                 currentExpr = readAtom(*it);
 
-            } else if (it->type == Token::Type::LIST_START) {
+            } else if (it->isListStart()) {
                 auto subListStart = it;
                 int depth = 1;
                 do {
                     it++;
                     if (it == end - 1)
                         break;
-                    if (it->type == Token::Type::LIST_START)
+                    if (it->isListStart())
                         depth++;
                     if (it->type == Token::Type::LIST_END)
                         depth--;
@@ -270,7 +361,9 @@ static Eptr readCons(const It &start, const It &end) {
                 currentExpr = currentExpr->quote(quotes);
                 quotes = 0;
 
-                if (haveDot) {
+                if (isVector) {
+                    items.push_back(std::move(currentExpr));
+                } else if (haveDot) {
                     currentCons->getCdr() = currentExpr;
                     haveDot = false;
                 } else {
@@ -278,6 +371,7 @@ static Eptr readCons(const It &start, const It &end) {
                         // Make next cons.
                         currentCons->getCdr() = std::make_shared<ConsExpr>();
                         currentCons = static_cast<ConsExpr*>(currentCons->getCdr().get());
+                        currentCons->setLocation(exprLocation);
                     }
                     currentCons->getCar() = currentExpr;
                 }
@@ -288,6 +382,9 @@ static Eptr readCons(const It &start, const It &end) {
         if (quotes)
             throw SyntaxError("Invalid quote syntax");
 
+        if (isVector)
+            return makeVector(start->content, std::move(items));
+
         if (!currentCons->getCar())
             currentCons->getCdr() = std::make_shared<SymbolExpr>("nil");
 
@@ -324,7 +421,7 @@ static Eptr read(const std::vector<Token> &tokens) {
 
         return readAtom(tokens[i])->quote(quotes);
 
-    } else if (tokens[i].type == Token::Type::LIST_START) {
+    } else if (tokens[i].isListStart()) {
         
         return readCons(tokens.begin()+i, tokens.end())->quote(quotes);
 
@@ -334,5 +431,65 @@ static Eptr read(const std::vector<Token> &tokens) {
 }
 
 Eptr read(std::istream &stream) {
-    return read(tokenize(stream));
+    SourceLocation position;
+    position.line   = 1;
+    position.column = 1;
+
+    return read(tokenize(stream, position));
+}
+
+Eptr read(std::istream &stream, SourceLocation &position) {
+    return read(tokenize(stream, position));
+}
+
+static std::mutex                                sourceFilesMutex;
+static std::deque<std::string>                   sourceFiles { "" };
+static std::unordered_map<std::string, uint16_t> sourceFileIds;
+
+uint16_t sourceFileId(const std::string &path) {
+    std::lock_guard<std::mutex> lock(sourceFilesMutex);
+
+    auto it = sourceFileIds.find(path);
+    if (it != sourceFileIds.end())
+        return it->second;
+
+    // Beyond 64k files, locations no longer name their file.
+    if (sourceFiles.size() > UINT16_MAX)
+        return 0;
+
+    sourceFiles.push_back(path);
+    return sourceFileIds[path] = sourceFiles.size() - 1;
+}
+
+std::string sourceFileName(uint16_t id) {
+    std::lock_guard<std::mutex> lock(sourceFilesMutex);
+    return id < sourceFiles.size() ? sourceFiles[id] : "";
+}
+
+SourceLocation sourceStart(const std::string &path) {
+    SourceLocation location;
+    location.line   = 1;
+    location.column = 1;
+    location.file   = sourceFileId(path);
+    return location;
+}
+
+bool slurpShebang(std::istream &stream) {
+    char c, c2;
+    if (!stream.get(c)) throw ProgramError("Unexpected EOF");
+    if (c == '#') {
+        if (!stream.get(c2)) throw ProgramError("Unexpected EOF");
+        if (c2 == '!') {
+            do {
+                stream.get(c);
+            } while (c != '\n' && stream);
+            return true;
+        } else {
+            if (!stream.putback(c2)) throw std::runtime_error("Could not istream::putback char 2");
+            if (!stream.putback(c)) throw std::runtime_error("Could not istream::putback char 1");
+        }
+    } else {
+        if (!stream.putback(c)) throw std::runtime_error("Could not istream::putback char 1");
+    }
+    return false;
 }
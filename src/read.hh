@@ -31,6 +31,7 @@ struct Token {
     enum class Type {
         NONE,
         LIST_START,
+        VECTOR_START,
         CONS_DOT,
         LIST_END,
         ATOM_STRING,
@@ -41,11 +42,18 @@ struct Token {
 
     std::string content;
 
+    SourceLocation location;
+
     bool isAtomish() const {
         return type == Type::ATOM_STRING
             || type == Type::ATOM_NUMERIC
             || type == Type::ATOM_SYMBOL;
     }
+
+    bool isListStart() const {
+        return type == Type::LIST_START
+            || type == Type::VECTOR_START;
+    }
 };
 
 /**
@@ -56,3 +64,43 @@ struct Token {
  * \return An expression pointer
  */
 Eptr read(std::istream &stream);
+
+/**
+ * \brief Read one textual expression, recording source locations.
+ *
+ * Every cons read is given its location (see ConsExpr::getLocation()).
+ *
+ * \param stream   The stream to read an expression from
+ * \param position The location of the next character in the stream,
+ *                 advanced past the expression read
+ *
+ * \return An expression pointer
+ */
+Eptr read(std::istream &stream, SourceLocation &position);
+
+/**
+ * \brief Get the id of a source file name, for SourceLocation::file.
+ *
+ * Id 0 is reserved for unknown sources.
+ */
+uint16_t sourceFileId(const std::string &path);
+
+/**
+ * \brief Get the source file name with id ID, "" if unknown.
+ */
+std::string sourceFileName(uint16_t id);
+
+/**
+ * \brief Get the location of the first character of a source file.
+ */
+SourceLocation sourceStart(const std::string &path);
+
+/**
+ * \brief Remove an optional shebang (#! line) from the beginning of a
+ *        stream.
+ *
+ * \param stream
+ *
+ * \return true if a shebang line was removed
+ */
+bool slurpShebang(std::istream &stream);
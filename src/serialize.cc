@@ -0,0 +1,78 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "serialize.hh"
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint64_t hashBytes(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool MappedFile::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+        return false;
+
+    mapping = static_cast<const char*>(p);
+    length  = st.st_size;
+
+    return true;
+}
+
+MappedFile::~MappedFile() {
+    if (mapping)
+        munmap(const_cast<char*>(mapping), length);
+}
+
+bool writeFileAtomic(const std::string &path, const std::string &data) {
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) {
+            close(fd);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        done += n;
+    }
+
+    if (close(fd) || rename(tmpPath.c_str(), path.c_str())) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,168 @@
+/**
+ * \file
+ * \brief     Binary serialization primitives.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <cstdint>
+
+/**
+ * \brief An error in a binary file (truncated or corrupt data).
+ */
+class FormatError : public ProgramError {
+public:
+    FormatError(const std::string &s)
+        : ProgramError("Invalid binary file: " + s) { }
+};
+
+/**
+ * \brief Compute a 64-bit FNV-1a hash over a range of bytes.
+ */
+uint64_t hashBytes(const char *data, size_t size);
+
+/**
+ * \brief Appends binary encoded values to a byte string.
+ *
+ * Integers are stored as LEB128 varints, signed integers are
+ * zigzag-encoded first.
+ */
+class ByteWriter {
+
+    std::string buffer;
+
+public:
+    void u8(uint8_t value) { buffer += (char)value; }
+
+    void u64(uint64_t value) {
+        for (int i = 0; i < 8; i++)
+            buffer += (char)(value >> (i * 8));
+    }
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer += (char)(value | 0x80);
+            value >>= 7;
+        }
+        buffer += (char)value;
+    }
+
+    void svarint(int64_t value) {
+        varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+    void bytes(const char *data, size_t size) { buffer.append(data, size); }
+
+    void string(const std::string &s) {
+        varint(s.size());
+        buffer += s;
+    }
+
+    const std::string &data() const { return buffer; }
+          std::string &data()       { return buffer; }
+};
+
+/**
+ * \brief Decodes values written by ByteWriter from a memory range.
+ *
+ * All reads are bounds-checked, a FormatError is thrown when reading
+ * past the end of the range.
+ */
+class ByteReader {
+
+    const uint8_t *current;
+    const uint8_t *end;
+
+    void need(size_t n) const {
+        if ((size_t)(end - current) < n)
+            throw FormatError("Unexpected end of data");
+    }
+
+public:
+    bool atEnd() const { return current == end; }
+
+    uint8_t u8() {
+        need(1);
+        return *current++;
+    }
+
+    uint64_t u64() {
+        need(8);
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++)
+            value |= (uint64_t)*current++ << (i * 8);
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = u8();
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw FormatError("Varint too long");
+    }
+
+    int64_t svarint() {
+        uint64_t value = varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    const char *bytes(size_t size) {
+        need(size);
+        auto p = reinterpret_cast<const char*>(current);
+        current += size;
+        return p;
+    }
+
+    std::string string() {
+        size_t size = varint();
+        return std::string(bytes(size), size);
+    }
+
+    ByteReader(const char *data, size_t size)
+        : current(reinterpret_cast<const uint8_t*>(data)),
+          end(current + size)
+        { }
+};
+
+/**
+ * \brief A read-only memory mapping of a file.
+ */
+class MappedFile {
+
+    const char *mapping = nullptr;
+    size_t      length  = 0;
+
+public:
+    /**
+     * \brief Map a file into memory.
+     *
+     * \return false if the file could not be opened or mapped
+     */
+    bool open(const std::string &path);
+
+    const char *data() const { return mapping; }
+    size_t      size() const { return length; }
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+    ~MappedFile();
+};
+
+/**
+ * \brief Atomically replace a file with the given contents.
+ *
+ * The data is written to a temporary file in the same directory,
+ * which is then renamed over PATH.
+ *
+ * \return false if the file could not be written
+ */
+bool writeFileAtomic(const std::string &path, const std::string &data);
@@ -0,0 +1,363 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "server.hh"
+#include "read.hh"
+#include "print.hh"
+#include "ast-cache.hh"
+#include "budget.hh"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace {
+
+/**
+ * \brief Buffered output to a file descriptor.
+ */
+class FdOutBuf : public std::streambuf {
+
+    int  fd;
+    char buffer[4096];
+
+    bool writeAll(const char *data, size_t size) {
+        while (size) {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (sync())
+            return traits_type::eof();
+
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+        size_t size = pptr() - pbase();
+        setp(buffer, buffer + sizeof(buffer));
+        return writeAll(buffer, size) ? 0 : -1;
+    }
+
+public:
+    FdOutBuf(int fd)
+        : fd(fd) {
+        setp(buffer, buffer + sizeof(buffer));
+    }
+};
+
+/**
+ * \brief A queue of accepted connections, shared by the workers.
+ */
+class ConnectionQueue {
+
+    std::mutex              mutex;
+    std::condition_variable available;
+    std::deque<int>         fds;
+    bool                    closed = false;
+
+public:
+    void push(int fd) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fds.push_back(fd);
+        }
+        available.notify_one();
+    }
+
+    /**
+     * \brief Get the next connection, -1 once the queue is closed.
+     */
+    int pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]{ return closed || fds.size(); });
+
+        if (fds.empty())
+            return -1;
+
+        int fd = fds.front();
+        fds.pop_front();
+        return fd;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        available.notify_all();
+    }
+};
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+bool readAll(int fd, std::string &data) {
+    char buffer[4096];
+    while (true) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+            return true;
+        data.append(buffer, n);
+    }
+}
+
+/**
+ * \brief Evaluate one expression, printing its result or error.
+ */
+void evalForm(const Eptr &expr, const EnvPtr &env) {
+    try {
+        budget::Scope scope(budget::defaultLimits());
+        print(expr->eval(env));
+
+    } catch (ProgramError &e) {
+        output() << "Program error: " << e.what() << "\n";
+    } catch (LogicError &e) {
+        output() << "BUG (LogicError): " << e.what() << "\n";
+    } catch (std::exception &e) {
+        output() << "BUG (other): " << e.what() << "\n";
+    }
+    output().flush();
+}
+
+/**
+ * \brief Read and evaluate expressions from a stream until EOF.
+ */
+void evalStream(std::istream &in, const EnvPtr &env, SourceLocation position) {
+    while (true) {
+        Eptr expr;
+        try {
+            expr = read(in, position);
+        } catch (ProgramError &e) {
+            output() << "Program error: " << e.what() << "\n";
+            continue;
+        }
+
+        if (!expr)
+            break;
+
+        evalForm(expr, env);
+    }
+}
+
+void handleRequest(int fd, const EnvPtr &env) {
+    std::string request;
+    if (!readAll(fd, request))
+        return;
+
+    FdOutBuf buffer(fd);
+    std::ostream out(&buffer);
+    OutputRedirect redirect(out);
+
+    size_t headerEnd = request.find('\n');
+    std::string header = request.substr(0, headerEnd);
+    std::string body   = headerEnd == std::string::npos
+                         ? "" : request.substr(headerEnd + 1);
+
+    if (header == "eval") {
+        std::istringstream stream(body);
+        evalStream(stream, env, sourceStart("<request>"));
+
+    } else if (header.compare(0, 5, "file ") == 0) {
+        std::string path = header.substr(5);
+
+        std::ifstream file(path);
+        if (!file) {
+            out << "Program error: Could not open file '" << path << "' for reading.\n";
+            out.flush();
+            return;
+        }
+
+        std::string source{std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>()};
+        Elist forms;
+
+        if (readSource(path, source, forms)) {
+            for (auto &expr : forms)
+                evalForm(expr, env);
+        } else {
+            std::istringstream stream(source);
+            SourceLocation position = sourceStart(path);
+            if (slurpShebang(stream))
+                position.line++;
+            evalStream(stream, env, position);
+        }
+
+    } else {
+        out << "Protocol error: Unknown request '" << header << "'\n";
+    }
+
+    out.flush();
+}
+
+void runWorker(ConnectionQueue &queue, EnvPtr sharedEnv) {
+    int fd;
+    while ((fd = queue.pop()) >= 0) {
+        // Every request gets a fresh layer for the globals it sets,
+        // including those set by closures from the shared environment.
+        EnvPtr          env = Env::layer(sharedEnv);
+        Env::WriteLayer writeLayer(env);
+
+        handleRequest(fd, env);
+        close(fd);
+    }
+}
+
+}
+
+int serve(const std::string &socketPath,
+          unsigned workerCount,
+          EnvPtr sharedEnv) {
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path '" << socketPath << "' is too long\n";
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "Could not create socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    unlink(socketPath.c_str());
+
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+        || listen(listenFd, 128)) {
+        std::cerr << "Could not listen on '" << socketPath << "': "
+                  << strerror(errno) << "\n";
+        close(listenFd);
+        return 1;
+    }
+
+    // Clients that hang up early must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    // No SA_RESTART, so that accept() is interrupted.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT,  &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    sharedEnv->freeze();
+    sharedEnv->share();
+    Env::setConcurrent();
+
+    ConnectionQueue queue;
+    std::vector<std::thread> workers;
+
+    // Workers inherit a signal mask that leaves stop signals to the
+    // accepting thread.
+    sigset_t stopSignals, oldMask;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, &oldMask);
+
+    for (unsigned i = 0; i < std::max(workerCount, 1u); i++)
+        workers.emplace_back(runWorker, std::ref(queue), sharedEnv);
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+
+    while (!stopRequested) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd >= 0)
+            queue.push(fd);
+        else if (errno != EINTR && errno != ECONNABORTED)
+            std::cerr << "accept: " << strerror(errno) << "\n";
+    }
+
+    queue.close();
+    for (auto &worker : workers)
+        worker.join();
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+
+    return 0;
+}
+
+int sendRequest(const std::string &socketPath,
+                const std::string &request) {
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path '" << socketPath << "' is too long\n";
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        std::cerr << "Could not connect to '" << socketPath << "': "
+                  << strerror(errno) << "\n";
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    FdOutBuf buffer(fd);
+    std::ostream out(&buffer);
+    out << request;
+    out.flush();
+    shutdown(fd, SHUT_WR);
+
+    // Copy the response as it arrives.
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        std::cout.write(chunk, n);
+        std::cout.flush();
+    }
+    close(fd);
+
+    return n == 0 ? 0 : 1;
+}
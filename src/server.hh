@@ -0,0 +1,49 @@
+/**
+ * \file
+ * \brief     Evaluation server on a Unix domain socket.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ *
+ * Protocol: a client connects, sends one request and shuts down its
+ * writing side. A request is a header line followed by a body:
+ *
+ *   eval\n<source text>   Evaluate all expressions in the source text.
+ *   file <path>\n         Evaluate a file on the server (using its AST
+ *                         cache).
+ *
+ * The server streams back everything the evaluation prints, followed
+ * by the printed result of each expression, and closes the connection
+ * when done.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief Serve evaluation requests on a Unix domain socket.
+ *
+ * Requests are handled by a pool of worker threads. Every request is
+ * evaluated in a fresh root environment layered over SHAREDENV (see
+ * Env::layer()), which is frozen when the server starts: requests see
+ * the globals of SHAREDENV, and globals they set, also through
+ * functions defined in SHAREDENV, are private to the request. Environments are never shared between clients. Every
+ * expression in a request runs with the default budget limits (see
+ * budget.hh).
+ *
+ * Runs until interrupted by SIGINT or SIGTERM.
+ *
+ * \return An exit status
+ */
+int serve(const std::string &socketPath,
+          unsigned workerCount,
+          EnvPtr sharedEnv);
+
+/**
+ * \brief Send a request to a server and copy its response to stdout.
+ *
+ * \return An exit status
+ */
+int sendRequest(const std::string &socketPath,
+                const std::string &request);
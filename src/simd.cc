@@ -0,0 +1,400 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "simd.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+namespace {
+
+struct Kernels {
+    Level level;
+    void    (*add)      (const int64_t*, const int64_t*, int64_t*, size_t);
+    void    (*mul)      (const int64_t*, const int64_t*, int64_t*, size_t);
+    void    (*scale)    (const int64_t*, int64_t, int64_t*, size_t);
+    void    (*prefixSum)(const int64_t*, int64_t*, size_t);
+    int64_t (*sum)      (const int64_t*, size_t);
+    int64_t (*dot)      (const int64_t*, const int64_t*, size_t);
+    int64_t (*min)      (const int64_t*, size_t);
+    int64_t (*max)      (const int64_t*, size_t);
+};
+
+// Scalar kernels {{{
+
+// Arithmetic is done on unsigned integers, where overflow is defined.
+
+void addScalar(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint64_t)a[i] + (uint64_t)b[i];
+}
+
+void mulScalar(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint64_t)a[i] * (uint64_t)b[i];
+}
+
+void scaleScalar(const int64_t *a, int64_t factor, int64_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint64_t)a[i] * (uint64_t)factor;
+}
+
+void prefixSumScalar(const int64_t *a, int64_t *out, size_t n) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+        out[i] = acc += a[i];
+}
+
+int64_t sumScalar(const int64_t *a, size_t n) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+        acc += a[i];
+    return acc;
+}
+
+int64_t dotScalar(const int64_t *a, const int64_t *b, size_t n) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < n; i++)
+        acc += (uint64_t)a[i] * (uint64_t)b[i];
+    return acc;
+}
+
+int64_t minScalar(const int64_t *a, size_t n) {
+    int64_t result = a[0];
+    for (size_t i = 1; i < n; i++)
+        result = a[i] < result ? a[i] : result;
+    return result;
+}
+
+int64_t maxScalar(const int64_t *a, size_t n) {
+    int64_t result = a[0];
+    for (size_t i = 1; i < n; i++)
+        result = a[i] > result ? a[i] : result;
+    return result;
+}
+
+const Kernels scalarKernels = {
+    Level::SCALAR,
+    addScalar, mulScalar, scaleScalar, prefixSumScalar,
+    sumScalar, dotScalar, minScalar, maxScalar,
+};
+
+// }}}
+
+#if defined(__x86_64__)
+
+// SSE2 kernels {{{
+
+// SSE2 is part of x86-64, so these need no CPU check. SSE2 cannot
+// compare 64-bit integers; min and max use the scalar kernels.
+
+inline __m128i load2(const int64_t *p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+inline void store2(int64_t *p, __m128i x) {
+    _mm_storeu_si128((__m128i*)p, x);
+}
+
+/**
+ * \brief Multiply 64-bit lanes, keeping the low 64 bits.
+ *
+ * Built from 32x32->64 bit multiplies: the high halves of both
+ * operands only contribute to the high half of the result.
+ */
+inline __m128i mul2(__m128i a, __m128i b) {
+    __m128i low   = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+inline int64_t horizontalSum2(__m128i x) {
+    return _mm_cvtsi128_si64(_mm_add_epi64(x, _mm_unpackhi_epi64(x, x)));
+}
+
+void addSse2(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        store2(out + i, _mm_add_epi64(load2(a + i), load2(b + i)));
+    addScalar(a + i, b + i, out + i, n - i);
+}
+
+void mulSse2(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        store2(out + i, mul2(load2(a + i), load2(b + i)));
+    mulScalar(a + i, b + i, out + i, n - i);
+}
+
+void scaleSse2(const int64_t *a, int64_t factor, int64_t *out, size_t n) {
+    __m128i f = _mm_set1_epi64x(factor);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        store2(out + i, mul2(load2(a + i), f));
+    scaleScalar(a + i, factor, out + i, n - i);
+}
+
+void prefixSumSse2(const int64_t *a, int64_t *out, size_t n) {
+    __m128i carry = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i x = load2(a + i);
+        x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi64(x, carry);
+        store2(out + i, x);
+        carry = _mm_unpackhi_epi64(x, x);
+    }
+    uint64_t acc = _mm_cvtsi128_si64(carry);
+    for (; i < n; i++)
+        out[i] = acc += a[i];
+}
+
+int64_t sumSse2(const int64_t *a, size_t n) {
+    // Two accumulators, to hide the latency of the adds.
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, load2(a + i));
+        acc1 = _mm_add_epi64(acc1, load2(a + i + 2));
+    }
+    return (uint64_t)horizontalSum2(_mm_add_epi64(acc0, acc1))
+         + (uint64_t)sumScalar(a + i, n - i);
+}
+
+int64_t dotSse2(const int64_t *a, const int64_t *b, size_t n) {
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        acc = _mm_add_epi64(acc, mul2(load2(a + i), load2(b + i)));
+    return (uint64_t)horizontalSum2(acc)
+         + (uint64_t)dotScalar(a + i, b + i, n - i);
+}
+
+const Kernels sse2Kernels = {
+    Level::SSE2,
+    addSse2, mulSse2, scaleSse2, prefixSumSse2,
+    sumSse2, dotSse2, minScalar, maxScalar,
+};
+
+// }}}
+// AVX2 kernels {{{
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 inline __m256i load4(const int64_t *p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+AVX2 inline void store4(int64_t *p, __m256i x) {
+    _mm256_storeu_si256((__m256i*)p, x);
+}
+
+/**
+ * \brief Multiply 64-bit lanes, keeping the low 64 bits (see mul2()).
+ */
+AVX2 inline __m256i mul4(__m256i a, __m256i b) {
+    __m256i low   = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 inline int64_t horizontalSum4(__m256i x) {
+    return horizontalSum2(_mm_add_epi64(_mm256_castsi256_si128(x),
+                                        _mm256_extracti128_si256(x, 1)));
+}
+
+AVX2 void addAvx2(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        store4(out + i, _mm256_add_epi64(load4(a + i), load4(b + i)));
+    addScalar(a + i, b + i, out + i, n - i);
+}
+
+AVX2 void mulAvx2(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        store4(out + i, mul4(load4(a + i), load4(b + i)));
+    mulScalar(a + i, b + i, out + i, n - i);
+}
+
+AVX2 void scaleAvx2(const int64_t *a, int64_t factor, int64_t *out, size_t n) {
+    __m256i f = _mm256_set1_epi64x(factor);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        store4(out + i, mul4(load4(a + i), f));
+    scaleScalar(a + i, factor, out + i, n - i);
+}
+
+AVX2 void prefixSumAvx2(const int64_t *a, int64_t *out, size_t n) {
+    __m256i zero  = _mm256_setzero_si256();
+    __m256i carry = zero;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = load4(a + i);
+        // Add the lane before each lane, then the lane two before it.
+        x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0x90),
+                                                   zero, 0x03));
+        x = _mm256_add_epi64(x, _mm256_permute2x128_si256(x, x, 0x08));
+        x = _mm256_add_epi64(x, carry);
+        store4(out + i, x);
+        carry = _mm256_permute4x64_epi64(x, 0xff);
+    }
+    uint64_t acc = _mm256_extract_epi64(carry, 0);
+    for (; i < n; i++)
+        out[i] = acc += a[i];
+}
+
+AVX2 int64_t sumAvx2(const int64_t *a, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, load4(a + i));
+        acc1 = _mm256_add_epi64(acc1, load4(a + i + 4));
+    }
+    return (uint64_t)horizontalSum4(_mm256_add_epi64(acc0, acc1))
+         + (uint64_t)sumScalar(a + i, n - i);
+}
+
+AVX2 int64_t dotAvx2(const int64_t *a, const int64_t *b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_add_epi64(acc, mul4(load4(a + i), load4(b + i)));
+    return (uint64_t)horizontalSum4(acc)
+         + (uint64_t)dotScalar(a + i, b + i, n - i);
+}
+
+AVX2 int64_t minAvx2(const int64_t *a, size_t n) {
+    if (n < 4)
+        return minScalar(a, n);
+
+    __m256i acc = load4(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = load4(a + i);
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+    }
+
+    int64_t lanes[4];
+    store4(lanes, acc);
+    int64_t result = minScalar(lanes, 4);
+    return i < n ? std::min(result, minScalar(a + i, n - i)) : result;
+}
+
+AVX2 int64_t maxAvx2(const int64_t *a, size_t n) {
+    if (n < 4)
+        return maxScalar(a, n);
+
+    __m256i acc = load4(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = load4(a + i);
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+    }
+
+    int64_t lanes[4];
+    store4(lanes, acc);
+    int64_t result = maxScalar(lanes, 4);
+    return i < n ? std::max(result, maxScalar(a + i, n - i)) : result;
+}
+
+#undef AVX2
+
+const Kernels avx2Kernels = {
+    Level::AVX2,
+    addAvx2, mulAvx2, scaleAvx2, prefixSumAvx2,
+    sumAvx2, dotAvx2, minAvx2, maxAvx2,
+};
+
+// }}}
+
+#endif
+
+const Kernels &select() {
+    Level limit = Level::AVX2;
+
+    if (const char *env = getenv("MATIG_SIMD")) {
+        if (!strcmp(env, "scalar"))
+            limit = Level::SCALAR;
+        else if (!strcmp(env, "sse2"))
+            limit = Level::SSE2;
+    }
+
+#if defined(__x86_64__)
+    if (limit >= Level::AVX2 && __builtin_cpu_supports("avx2"))
+        return avx2Kernels;
+    if (limit >= Level::SSE2)
+        return sse2Kernels;
+#endif
+
+    return scalarKernels;
+}
+
+const Kernels &kernels() {
+    static const Kernels &chosen = select();
+    return chosen;
+}
+
+}
+
+Level level() {
+    return kernels().level;
+}
+
+const char *name(Level level) {
+    switch (level) {
+    case Level::SCALAR: return "scalar";
+    case Level::SSE2:   return "sse2";
+    case Level::AVX2:   return "avx2";
+    }
+    return "";
+}
+
+void add(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    kernels().add(a, b, out, n);
+}
+
+void mul(const int64_t *a, const int64_t *b, int64_t *out, size_t n) {
+    kernels().mul(a, b, out, n);
+}
+
+void scale(const int64_t *a, int64_t factor, int64_t *out, size_t n) {
+    kernels().scale(a, factor, out, n);
+}
+
+void prefixSum(const int64_t *a, int64_t *out, size_t n) {
+    kernels().prefixSum(a, out, n);
+}
+
+int64_t sum(const int64_t *a, size_t n) {
+    return kernels().sum(a, n);
+}
+
+int64_t dot(const int64_t *a, const int64_t *b, size_t n) {
+    return kernels().dot(a, b, n);
+}
+
+int64_t min(const int64_t *a, size_t n) {
+    return kernels().min(a, n);
+}
+
+int64_t max(const int64_t *a, size_t n) {
+    return kernels().max(a, n);
+}
+
+}
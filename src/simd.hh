@@ -0,0 +1,58 @@
+/**
+ * \file
+ * \brief     Vectorized kernels over arrays of integers.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Each kernel has a scalar implementation and, on x86-64, SSE2 and
+ * AVX2 implementations. The best one the CPU supports is chosen on
+ * first use. Setting MATIG_SIMD to "scalar" or "sse2" chooses a lower
+ * level, for comparing them.
+ *
+ * Arithmetic wraps around on overflow, and output arrays may be the
+ * same as input arrays.
+ */
+namespace simd {
+
+enum class Level {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+/**
+ * \brief Get the level of the kernels in use.
+ */
+Level level();
+
+const char *name(Level level);
+
+/// OUT[i] = A[i] + B[i]
+void add(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+
+/// OUT[i] = A[i] * B[i]
+void mul(const int64_t *a, const int64_t *b, int64_t *out, size_t n);
+
+/// OUT[i] = A[i] * FACTOR
+void scale(const int64_t *a, int64_t factor, int64_t *out, size_t n);
+
+/// OUT[i] = A[0] + ... + A[i]
+void prefixSum(const int64_t *a, int64_t *out, size_t n);
+
+int64_t sum(const int64_t *a, size_t n);
+int64_t dot(const int64_t *a, const int64_t *b, size_t n);
+
+/// N must not be 0.
+int64_t min(const int64_t *a, size_t n);
+int64_t max(const int64_t *a, size_t n);
+
+}
@@ -0,0 +1,126 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "stats.hh"
+
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace stats {
+
+bool enabled = false;
+
+thread_local Counters *localCounters = nullptr;
+
+namespace {
+
+// Counters outlive their threads, so that their counts stay in the
+// totals.
+std::mutex           countersMutex;
+std::deque<Counters> allCounters;
+
+std::atomic<int64_t> liveObjects { 0 };
+std::atomic<int64_t> peakLiveObjects { 0 };
+
+const char *counterNames[] = {
+    "form-evals",
+    "symbol-evals",
+    "builtin-calls",
+    "lisp-calls",
+    "env-frames",
+    "object-allocs",
+    "cons-allocs",
+    "numeric-allocs",
+    "string-allocs",
+};
+
+static_assert(sizeof(counterNames) / sizeof(*counterNames) == (size_t)Counter::COUNT,
+              "Every counter needs a name");
+
+}
+
+Counters *registerThread() {
+    std::lock_guard<std::mutex> lock(countersMutex);
+    allCounters.emplace_back();
+    return &allCounters.back();
+}
+
+void objectCreated() {
+    increment(local().counts[(size_t)Counter::OBJECT_ALLOCS]);
+
+    int64_t live = liveObjects.fetch_add(1, std::memory_order_relaxed) + 1;
+    int64_t peak = peakLiveObjects.load(std::memory_order_relaxed);
+
+    while (live > peak
+           && !peakLiveObjects.compare_exchange_weak(peak, live,
+                                                     std::memory_order_relaxed));
+}
+
+void objectDestroyed() {
+    liveObjects.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void start() {
+    enabled = true;
+}
+
+Totals totals() {
+    Totals result;
+
+    std::lock_guard<std::mutex> lock(countersMutex);
+    for (auto &counters : allCounters) {
+        for (size_t i = 0; i < (size_t)Counter::COUNT; i++)
+            result.counts[i] += counters.counts[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= maxHops; i++)
+            result.lookupHops[i] += counters.lookupHops[i].load(std::memory_order_relaxed);
+    }
+
+    result.liveObjects     = liveObjects;
+    result.peakLiveObjects = peakLiveObjects;
+
+    return result;
+}
+
+const char *name(Counter counter) {
+    return counterNames[(size_t)counter];
+}
+
+std::string report() {
+    Totals t = totals();
+    std::ostringstream out;
+
+    out << "Interpreter statistics:\n";
+    for (size_t i = 0; i < (size_t)Counter::COUNT; i++)
+        out << "  " << std::left  << std::setw(20) << counterNames[i]
+                    << std::right << std::setw(14) << t.counts[i] << "\n";
+
+    out << "  " << std::left  << std::setw(20) << "live-objects"
+                << std::right << std::setw(14) << t.liveObjects << "\n"
+        << "  " << std::left  << std::setw(20) << "peak-live-objects"
+                << std::right << std::setw(14) << t.peakLiveObjects << "\n";
+
+    uint64_t lookups = 0;
+    for (auto count : t.lookupHops)
+        lookups += count;
+
+    out << "Symbol lookups by parent environments searched:\n";
+    for (unsigned i = 0; i <= maxHops; i++) {
+        if (!t.lookupHops[i])
+            continue;
+
+        out << "  " << std::setw(3) << i << (i == maxHops ? "+" : " ")
+            << std::setw(16) << t.lookupHops[i]
+            << std::setw(8)  << std::fixed << std::setprecision(1)
+            << 100.0 * t.lookupHops[i] / lookups << "%\n";
+    }
+
+    return out.str();
+}
+
+}
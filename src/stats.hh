@@ -0,0 +1,108 @@
+/**
+ * \file
+ * \brief     Interpreter statistics.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Counts of what the interpreter does, for deciding which parts are
+ * worth optimizing. Counting is off unless started, in which case
+ * every thread increments its own counters, which are summed when a
+ * report is made.
+ */
+namespace stats {
+
+enum class Counter {
+    FORM_EVALS,     ///< Conses evaluated as function calls.
+    SYMBOL_EVALS,   ///< Symbols evaluated (other atoms evaluate to themselves).
+    BUILTIN_CALLS,
+    LISP_CALLS,
+    ENV_FRAMES,
+    OBJECT_ALLOCS,  ///< Expressions of any type.
+    CONS_ALLOCS,
+    NUMERIC_ALLOCS,
+    STRING_ALLOCS,
+    COUNT,
+};
+
+/// Lookups needing this many parent hops or more share a bucket.
+constexpr unsigned maxHops = 16;
+
+struct Counters {
+    std::atomic<uint64_t> counts[(size_t)Counter::COUNT] { };
+    std::atomic<uint64_t> lookupHops[maxHops + 1] { };
+};
+
+extern bool enabled;
+
+extern thread_local Counters *localCounters;
+
+Counters *registerThread();
+
+inline void increment(std::atomic<uint64_t> &counter) {
+    // Only the owning thread writes its counters.
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+}
+
+inline Counters &local() {
+    if (!localCounters)
+        localCounters = registerThread();
+    return *localCounters;
+}
+
+inline void count(Counter counter) {
+    if (enabled)
+        increment(local().counts[(size_t)counter]);
+}
+
+/**
+ * \brief Count a symbol lookup that went up HOPS environments.
+ */
+inline void countLookup(unsigned hops) {
+    if (enabled)
+        increment(local().lookupHops[hops < maxHops ? hops : maxHops]);
+}
+
+void objectCreated();
+void objectDestroyed();
+
+/**
+ * \brief Start counting.
+ *
+ * Must be called before any expression exists, for live object counts
+ * to be right.
+ */
+void start();
+
+struct Totals {
+    uint64_t counts[(size_t)Counter::COUNT] = { };
+    uint64_t lookupHops[maxHops + 1] = { };
+    int64_t  liveObjects = 0;
+    int64_t  peakLiveObjects = 0;
+};
+
+/**
+ * \brief Sum the counters of all threads.
+ */
+Totals totals();
+
+/**
+ * \brief Get the name of a counter, as used in reports.
+ */
+const char *name(Counter counter);
+
+/**
+ * \brief Get a textual report of the totals.
+ */
+std::string report();
+
+}
@@ -0,0 +1,151 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "struct.hh"
+
+#include <algorithm>
+
+std::string StructExpr::repr() const {
+    std::string s = "<" + structType->name;
+
+    for (size_t i = 0; i < size(); i++)
+        s += " :" + structType->slotNames[i] + " " + slots[i]->repr();
+
+    return s + ">";
+}
+
+StructExpr::StructExpr(StructTypePtr structType, Elist values)
+    : structType(std::move(structType)),
+      slots(new Eptr[values.size()]) {
+
+    if (values.size() != size())
+        throw LogicError("Structure slot count mismatch");
+
+    std::move(values.begin(), values.end(), slots.get());
+
+    profileAlloc(Type::STRUCT, sizeof(*this) + size() * sizeof(Eptr));
+}
+
+StructExpr::StructExpr(const StructExpr &other)
+    : structType(other.structType),
+      slots(new Eptr[other.size()]) {
+
+    std::copy(other.slots.get(), other.slots.get() + size(), slots.get());
+
+    profileAlloc(Type::STRUCT, sizeof(*this) + size() * sizeof(Eptr));
+}
+
+static std::string functionName(const StructType &structType,
+                                FuncStruct::Kind kind,
+                                size_t slotIndex) {
+    switch (kind) {
+    case FuncStruct::Kind::CONSTRUCTOR:
+        return "make-" + structType.name;
+    case FuncStruct::Kind::PREDICATE:
+        return structType.name + "?";
+    case FuncStruct::Kind::GETTER:
+        return structType.name + "-" + structType.slotNames.at(slotIndex);
+    case FuncStruct::Kind::SETTER:
+        return "set-" + structType.name + "-" + structType.slotNames.at(slotIndex) + "!";
+    }
+    throw LogicError("Unknown structure function kind");
+}
+
+static Func::Signature functionSignature(const StructType &structType,
+                                         FuncStruct::Kind kind) {
+    Func::Signature signature;
+
+    switch (kind) {
+    case FuncStruct::Kind::CONSTRUCTOR:
+        // Slots that are not given are nil.
+        for (const auto &slotName : structType.slotNames)
+            signature.positional.emplace_back(slotName, std::make_shared<SymbolExpr>("nil"));
+        break;
+    case FuncStruct::Kind::PREDICATE:
+        signature.positional.emplace_back("thing");
+        break;
+    case FuncStruct::Kind::GETTER:
+        signature.positional.emplace_back(structType.name);
+        break;
+    case FuncStruct::Kind::SETTER:
+        signature.positional.emplace_back(structType.name);
+        signature.positional.emplace_back("value");
+        break;
+    }
+
+    return signature;
+}
+
+static std::string functionDoc(const StructType &structType,
+                               FuncStruct::Kind kind,
+                               size_t slotIndex) {
+    switch (kind) {
+    case FuncStruct::Kind::CONSTRUCTOR:
+        return "Create a " + structType.name + ". Slots that are not given are nil.";
+    case FuncStruct::Kind::PREDICATE:
+        return "Return t if THING is a " + structType.name + ".";
+    case FuncStruct::Kind::GETTER:
+        return "Return the " + structType.slotNames.at(slotIndex)
+            + " slot of a " + structType.name + ".";
+    case FuncStruct::Kind::SETTER:
+        return "Set the " + structType.slotNames.at(slotIndex)
+            + " slot of a " + structType.name + " to VALUE. Return VALUE.";
+    }
+    throw LogicError("Unknown structure function kind");
+}
+
+StructExpr &FuncStruct::instanceParam(const Eptr &expr) const {
+    if (expr->type() != Expr::Type::STRUCT
+        || static_cast<StructExpr*>(expr.get())->getStructType() != structType) {
+
+        std::string upperName = name;
+        std::transform(upperName.begin(),
+                       upperName.end(),
+                       upperName.begin(),
+                       toupper);
+
+        throw ProgramError("Parameter to "s + upperName + " must be a " + structType->name);
+    }
+
+    return *static_cast<StructExpr*>(expr.get());
+}
+
+Eptr FuncStruct::operator()(Elist  positional,
+                            Emap   keyValue,
+                            Elist  rest,
+                            EnvPtr env) const {
+
+    stats::count(stats::Counter::BUILTIN_CALLS);
+
+    switch (kind) {
+    case Kind::CONSTRUCTOR:
+        return std::make_shared<StructExpr>(structType, std::move(positional));
+
+    case Kind::PREDICATE:
+        return std::make_shared<SymbolExpr>(
+            positional[0]->type() == Expr::Type::STRUCT
+            && static_cast<StructExpr*>(positional[0].get())->getStructType() == structType
+            ? "t" : "nil");
+
+    case Kind::GETTER:
+        return instanceParam(positional[0]).slot(slotIndex);
+
+    case Kind::SETTER:
+        return instanceParam(positional[0]).slot(slotIndex) = std::move(positional[1]);
+    }
+    throw LogicError("Unknown structure function kind");
+}
+
+FuncStruct::FuncStruct(StructTypePtr structType, Kind kind, size_t slotIndex)
+    : Func(functionSignature(*structType, kind),
+           false,
+           functionDoc(*structType, kind, slotIndex)),
+      structType(structType),
+      kind(kind),
+      slotIndex(slotIndex),
+      name(functionName(*structType, kind, slotIndex))
+    { }
@@ -0,0 +1,112 @@
+/**
+ * \file
+ * \brief     Structure types.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+#include "function.hh"
+
+/**
+ * \brief A structure type, as defined by DEFSTRUCT.
+ *
+ * Instances are recognized by the address of their type, so two
+ * definitions with the same name are different types.
+ */
+struct StructType {
+    std::string              name;
+    std::vector<std::string> slotNames;
+};
+
+typedef std::shared_ptr<const StructType> StructTypePtr;
+
+/**
+ * \brief Structure Expression type.
+ *
+ * An instance of a structure type: a fixed number of slots, accessed
+ * by index. Like vectors, structures can be modified in place and are
+ * not synchronized.
+ */
+class StructExpr : public Expr {
+
+    StructTypePtr           structType;
+    std::unique_ptr<Eptr[]> slots;
+
+public:
+    Type type() const override { return Type::STRUCT; }
+
+    std::string repr() const override;
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    const StructTypePtr &getStructType() const { return structType; }
+
+    size_t size() const { return structType->slotNames.size(); }
+
+    /**
+     * \brief Get slot I. I is not range checked.
+     */
+    const Eptr &slot(size_t i) const { return slots[i]; }
+          Eptr &slot(size_t i)       { return slots[i]; }
+
+    /**
+     * \param values The slot values, one per slot
+     */
+    StructExpr(StructTypePtr structType, Elist values);
+
+    StructExpr(const StructExpr &other);
+};
+
+typedef std::shared_ptr<StructExpr> StructEptr;
+
+/**
+ * \brief A function generated by DEFSTRUCT.
+ *
+ * Constructors, predicates and slot accessors are native functions
+ * that know their type and slot index, so that slot access is a type
+ * check and an index.
+ */
+class FuncStruct : public Func {
+
+public:
+    enum class Kind {
+        CONSTRUCTOR, ///< (make-NAME SLOT...)
+        PREDICATE,   ///< (NAME? THING)
+        GETTER,      ///< (NAME-SLOT INSTANCE)
+        SETTER,      ///< (set-NAME-SLOT! INSTANCE VALUE)
+    };
+
+private:
+    StructTypePtr structType;
+    Kind          kind;
+    size_t        slotIndex;
+    std::string   name;
+
+    StructExpr &instanceParam(const Eptr &expr) const;
+
+public:
+    Eptr operator()(Elist  positional,
+                    Emap   keyValue,
+                    Elist  rest,
+                    EnvPtr env) const override;
+
+    /**
+     * \brief Get the name DEFSTRUCT defines this function as.
+     */
+    const std::string &getName() const { return name; }
+
+    const StructTypePtr &getStructType() const { return structType; }
+    Kind                 getKind()       const { return kind;       }
+    size_t               getSlotIndex()  const { return slotIndex;  }
+
+    /**
+     * \param slotIndex The slot accessed by getters and setters
+     */
+    FuncStruct(StructTypePtr structType, Kind kind, size_t slotIndex = 0);
+};
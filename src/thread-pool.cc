@@ -0,0 +1,170 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "thread-pool.hh"
+
+#include <chrono>
+#include <cstdlib>
+
+/// The pool the current thread is a worker of, if any.
+static thread_local ThreadPool *currentPool  = nullptr;
+static thread_local unsigned    currentIndex = 0;
+
+ThreadPool &ThreadPool::instance() {
+    // Never destroyed: destroying the pool joins its workers, and a
+    // worker may be stuck in a task that never finishes.
+    static ThreadPool *pool = new ThreadPool([]{
+        const char *env = getenv("MATIG_THREADS");
+        if (env && atoi(env) > 0)
+            return (unsigned)atoi(env);
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }());
+
+    return *pool;
+}
+
+void ThreadPool::push(Task task, bool front) {
+    unsigned index = currentPool == this
+                   ? currentIndex
+                   : nextQueue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if (front)
+            queues[index]->tasks.push_front(std::move(task));
+        else
+            queues[index]->tasks.push_back(std::move(task));
+    }
+    wakeup.notify_one();
+}
+
+void ThreadPool::submit(Task task) {
+    push(std::move(task), false);
+}
+
+void ThreadPool::defer(Task task) {
+    push(std::move(task), true);
+}
+
+bool ThreadPool::take(unsigned index, Task &task) {
+    auto &queue = *queues[index];
+
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    pending--;
+    return true;
+}
+
+bool ThreadPool::steal(unsigned index, Task &task) {
+    for (size_t i = 1; i <= queues.size(); i++) {
+        auto &queue = *queues[(index + i) % queues.size()];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.size()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::runOne() {
+    if (!pending)
+        return false;
+
+    unsigned index = currentPool == this ? currentIndex : 0;
+
+    Task task;
+    if (take(index, task) || steal(index, task)) {
+        task();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::runWorker(unsigned index) {
+    currentPool  = this;
+    currentIndex = index;
+
+    while (true) {
+        Task task;
+        if (take(index, task) || steal(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeup.wait(lock, [this]{ return stopping || pending; });
+        if (stopping)
+            return;
+    }
+}
+
+ThreadPool::ThreadPool(unsigned size) {
+    for (unsigned i = 0; i < size; i++)
+        queues.emplace_back(new Queue);
+    for (unsigned i = 0; i < size; i++)
+        threads.emplace_back(&ThreadPool::runWorker, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
+
+void TaskGroup::run(ThreadPool::Task task) {
+    remaining++;
+
+    pool.submit([this, task]{
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+
+        // The group may be destroyed as soon as the waiter sees the
+        // last task finish, so the count must drop under the lock.
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!--remaining)
+            done.notify_all();
+    });
+}
+
+void TaskGroup::wait() {
+    while (remaining) {
+        if (pool.runOne())
+            continue;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait_for(lock, std::chrono::milliseconds(1),
+                      [this]{ return !remaining; });
+    }
+
+    // Synchronize with the last task releasing the lock.
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -0,0 +1,127 @@
+/**
+ * \file
+ * \brief     Work-stealing thread pool.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief A work-stealing thread pool.
+ *
+ * Every worker owns a task deque. Workers take tasks from the back of
+ * their own deque (so that recently spawned, cache-warm work runs
+ * first), and steal from the front of other deques when theirs is
+ * empty. Tasks submitted from a worker go to that worker's deque,
+ * other tasks are distributed round-robin.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+private:
+    struct Queue {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread>            threads;
+
+    std::atomic<size_t>   pending { 0 };
+    std::atomic<unsigned> nextQueue { 0 };
+
+    std::mutex              sleepMutex;
+    std::condition_variable wakeup;
+    bool                    stopping = false;
+
+    void push(Task task, bool front);
+    bool take(unsigned index, Task &task);
+    bool steal(unsigned index, Task &task);
+    void runWorker(unsigned index);
+
+public:
+    /**
+     * \brief Get the process-wide pool.
+     *
+     * It is started on first use, with one worker per core (or
+     * $MATIG_THREADS workers), and is never destroyed, so that tasks
+     * that never finish do not keep the process from exiting.
+     */
+    static ThreadPool &instance();
+
+    unsigned size() const { return threads.size(); }
+
+    void submit(Task task);
+
+    /**
+     * \brief Submit a task that should run after those already queued.
+     *
+     * On a worker, the task goes to the end of the worker's deque that
+     * it takes from last (and others steal from first).
+     */
+    void defer(Task task);
+
+    /**
+     * \brief Run one pending task on the calling thread.
+     *
+     * \return false if no task was pending
+     */
+    bool runOne();
+
+    ThreadPool(unsigned size);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool &operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+};
+
+/**
+ * \brief A set of tasks that can be waited for as a whole.
+ */
+class TaskGroup {
+
+    ThreadPool &pool;
+
+    std::atomic<size_t> remaining { 0 };
+    std::atomic<bool>   failed    { false };
+    std::exception_ptr  error;
+
+    std::mutex              mutex;
+    std::condition_variable done;
+
+public:
+    void run(ThreadPool::Task task);
+
+    /**
+     * \brief Check whether a task in the group has thrown.
+     *
+     * Long-running tasks may use this to stop early.
+     */
+    bool hasFailed() const { return failed; }
+
+    /**
+     * \brief Wait for all tasks in the group to finish.
+     *
+     * The waiting thread runs pending pool tasks in the meantime, so
+     * that nested groups cannot starve the pool.
+     *
+     * \throw The first exception thrown by a task in the group
+     */
+    void wait();
+
+    TaskGroup(ThreadPool &pool = ThreadPool::instance())
+        : pool(pool)
+        { }
+};
@@ -0,0 +1,176 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "trace.hh"
+#include "expression.hh"
+#include "profiler.hh"
+#include "serialize.hh"
+
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+namespace trace {
+
+bool     enabled  = false;
+unsigned maxDepth = 0;
+
+thread_local unsigned depth = 0;
+
+namespace {
+
+struct Event {
+    const char       *label;    ///< nullptr for function calls.
+    uint32_t          function; ///< A profiler::nameId().
+    std::string       args;
+    Clock::time_point start;
+    Clock::time_point end;
+};
+
+/**
+ * \brief The events of one thread.
+ *
+ * Only contended while the trace is being written.
+ */
+struct Buffer {
+    unsigned           tid;
+    std::mutex         mutex;
+    std::vector<Event> events;
+};
+
+Clock::time_point origin;
+
+std::mutex         buffersMutex;
+std::deque<Buffer> buffers;
+
+thread_local Buffer *localBuffer = nullptr;
+
+Buffer &local() {
+    if (!localBuffer) {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffers.emplace_back();
+        buffers.back().tid = buffers.size();
+        localBuffer = &buffers.back();
+    }
+    return *localBuffer;
+}
+
+void add(Event event) {
+    auto &buffer = local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back(std::move(event));
+}
+
+/**
+ * \brief Format a duration in microseconds, as trace events want.
+ */
+std::string micros(Clock::duration d) {
+    char s[32];
+    snprintf(s, sizeof(s), "%.3f",
+             std::chrono::duration<double, std::micro>(d).count());
+    return s;
+}
+
+}
+
+void record(const char *label,
+            const std::string &args,
+            Clock::time_point start,
+            Clock::time_point end) {
+
+    add(Event { label, 0, args, start, end });
+}
+
+void recordCall(const SymbolExpr &function,
+                Clock::time_point start,
+                Clock::time_point end) {
+
+    add(Event { nullptr, profiler::nameId(function), "", start, end });
+}
+
+std::string jsonString(const std::string &s) {
+    std::string result = "\"";
+
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            result += escape;
+        } else {
+            result += c;
+        }
+    }
+
+    return result + "\"";
+}
+
+void start(unsigned depthLimit) {
+    origin   = Clock::now();
+    maxDepth = depthLimit;
+    enabled  = true;
+}
+
+void write(const std::string &path) {
+    std::ostringstream out;
+    std::string pid = std::to_string(getpid());
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    auto separate = [&]{
+        if (!first)
+            out << ",\n";
+        first = false;
+    };
+
+    std::lock_guard<std::mutex> lock(buffersMutex);
+
+    for (auto &buffer : buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+
+        separate();
+        out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+            << ",\"tid\":" << buffer.tid
+            << ",\"args\":{\"name\":\""
+            << (buffer.tid == 1 ? "main" : "thread " + std::to_string(buffer.tid))
+            << "\"}}";
+
+        for (auto &event : buffer.events) {
+            separate();
+            out << "{\"ph\":\"X\",\"pid\":" << pid
+                << ",\"tid\":" << buffer.tid;
+
+            if (event.label)
+                out << ",\"cat\":\"phase\",\"name\":" << jsonString(event.label);
+            else
+                out << ",\"cat\":\"call\",\"name\":"
+                    << jsonString(profiler::name(event.function));
+
+            out << ",\"ts\":"  << micros(event.start - origin)
+                << ",\"dur\":" << micros(event.end - event.start);
+
+            if (event.args.size())
+                out << ",\"args\":{" << event.args << "}";
+
+            out << "}";
+        }
+    }
+
+    out << "\n]}\n";
+
+    if (!writeFileAtomic(path, out.str()))
+        throw ProgramError("Could not write trace to '"s + path + "'");
+}
+
+}
@@ -0,0 +1,129 @@
+/**
+ * \file
+ * \brief     Chrome trace-event output.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+
+#include <chrono>
+#include <cstdint>
+
+class SymbolExpr;
+
+/**
+ * While tracing, spans of wall time are recorded per thread: reading,
+ * evaluating and printing top-level forms, and function calls up to a
+ * depth limit. They are written as Chrome trace-event JSON, which
+ * opens in chrome://tracing, Perfetto and similar viewers.
+ */
+namespace trace {
+
+extern bool enabled;
+
+/**
+ * \brief Calls nested deeper than this are not recorded.
+ */
+extern unsigned maxDepth;
+
+/**
+ * \brief The call nesting depth of this thread (green threads swap it).
+ */
+extern thread_local unsigned depth;
+
+typedef std::chrono::steady_clock Clock;
+
+void record(const char *label,
+            const std::string &args,
+            Clock::time_point start,
+            Clock::time_point end);
+
+void recordCall(const SymbolExpr &function,
+                Clock::time_point start,
+                Clock::time_point end);
+
+/**
+ * \brief Records a phase of work (e.g. "read") for the lifetime of this
+ *        object, if tracing.
+ */
+class Span {
+
+    const char       *label;
+    std::string       args;
+    Clock::time_point start;
+
+public:
+    /**
+     * \brief Attach details, as the members of a JSON object (e.g.
+     *        "\"file\": \"x.l\"").
+     */
+    void setArgs(std::string json) { args = std::move(json); }
+
+    Span(const char *label)
+        : label(enabled ? label : nullptr) {
+        if (this->label)
+            start = Clock::now();
+    }
+
+    ~Span() {
+        if (label)
+            record(label, args, start, Clock::now());
+    }
+
+    Span(const Span&) = delete;
+    Span &operator=(const Span&) = delete;
+};
+
+/**
+ * \brief Records a function call for the lifetime of this object, if
+ *        tracing and not nested too deeply.
+ */
+class Call {
+
+    bool              active;
+    const SymbolExpr *function = nullptr;
+    Clock::time_point start;
+
+public:
+    Call(const SymbolExpr &function)
+        : active(enabled) {
+        if (active && depth++ < maxDepth) {
+            this->function = &function;
+            start = Clock::now();
+        }
+    }
+
+    ~Call() {
+        if (!active)
+            return;
+
+        depth--;
+        if (function)
+            recordCall(*function, start, Clock::now());
+    }
+
+    Call(const Call&) = delete;
+    Call &operator=(const Call&) = delete;
+};
+
+/**
+ * \brief Quote a string for JSON.
+ */
+std::string jsonString(const std::string &s);
+
+/**
+ * \brief Start tracing, recording calls nested up to MAXDEPTH deep.
+ */
+void start(unsigned maxDepth);
+
+/**
+ * \brief Write the trace recorded so far to PATH.
+ *
+ * \throw ProgramError if the file could not be written
+ */
+void write(const std::string &path);
+
+}
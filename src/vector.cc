@@ -0,0 +1,59 @@
+/**
+ * \file
+ * \brief
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#include "vector.hh"
+
+std::string VectorExpr::repr() const {
+    std::string s = "#(";
+
+    for (size_t i = 0; i < items.size(); i++) {
+        if (i)
+            s += " ";
+        s += items[i]->repr();
+    }
+
+    return s + ")";
+}
+
+/**
+ * \brief Check that I is an index into a TYPENAME of SIZE items.
+ */
+static size_t checkIndex(int64_t i, size_t size, const char *typeName) {
+    if (i < 0 || (uint64_t)i >= size)
+        throw ProgramError("Index "s + std::to_string(i)
+                           + " out of range for " + typeName + " of length "
+                           + std::to_string(size));
+    return i;
+}
+
+const Eptr &VectorExpr::at(int64_t i) const {
+    return items[checkIndex(i, items.size(), "vector")];
+}
+
+Eptr &VectorExpr::at(int64_t i) {
+    return items[checkIndex(i, items.size(), "vector")];
+}
+
+std::string IntArrayExpr::repr() const {
+    std::string s = "#i64(";
+
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i)
+            s += " ";
+        s += std::to_string(values[i]);
+    }
+
+    return s + ")";
+}
+
+int64_t IntArrayExpr::at(int64_t i) const {
+    return values[checkIndex(i, values.size(), "integer array")];
+}
+
+int64_t &IntArrayExpr::at(int64_t i) {
+    return values[checkIndex(i, values.size(), "integer array")];
+}
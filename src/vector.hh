@@ -0,0 +1,101 @@
+/**
+ * \file
+ * \brief     Vectors and integer arrays.
+ * \author    Chris Smeele
+ * \copyright Copyright (c) 2017, Chris Smeele
+ * \license   MIT, see LICENSE.
+ */
+#pragma once
+
+#include "common.hh"
+#include "expression.hh"
+
+/**
+ * \brief Vector Expression type.
+ *
+ * A growable array of expressions, with constant time indexing.
+ * Unlike other expressions, vectors can be modified in place. They
+ * are not synchronized: a vector that is modified must not be used by
+ * other threads at the same time.
+ */
+class VectorExpr : public Expr {
+
+    Elist items;
+
+public:
+    Type type() const override { return Type::VECTOR; }
+
+    std::string repr() const override;
+
+    /**
+     * \brief Vectors evaluate to themselves, their items are not
+     *        evaluated.
+     */
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    const Elist &getItems() const { return items; }
+          Elist &getItems()       { return items; }
+
+    size_t size() const { return items.size(); }
+
+    /**
+     * \brief Get the item at index I.
+     *
+     * \throw ProgramError if I is out of range
+     */
+    const Eptr &at(int64_t i) const;
+          Eptr &at(int64_t i);
+
+    VectorExpr(Elist items = { })
+        : items(std::move(items)) {
+        profileAlloc(Type::VECTOR, sizeof(*this)
+                                   + this->items.capacity() * sizeof(Eptr));
+    }
+};
+
+typedef std::shared_ptr<VectorExpr> VectorEptr;
+
+/**
+ * \brief Integer array Expression type.
+ *
+ * A growable array of raw 64-bit integers, for numeric work: it takes
+ * a fraction of the memory of a vector of numerics, and builtins can
+ * process it with SIMD kernels (see simd.hh). Like vectors, integer
+ * arrays can be modified in place and are not synchronized.
+ */
+class IntArrayExpr : public Expr {
+
+    std::vector<int64_t> values;
+
+public:
+    Type type() const override { return Type::INT_ARRAY; }
+
+    std::string repr() const override;
+
+    Eptr eval(EnvPtr env) override {
+        return shared_from_this();
+    }
+
+    const std::vector<int64_t> &getValues() const { return values; }
+          std::vector<int64_t> &getValues()       { return values; }
+
+    size_t size() const { return values.size(); }
+
+    /**
+     * \brief Get the value at index I.
+     *
+     * \throw ProgramError if I is out of range
+     */
+    int64_t  at(int64_t i) const;
+    int64_t &at(int64_t i);
+
+    IntArrayExpr(std::vector<int64_t> values = { })
+        : values(std::move(values)) {
+        profileAlloc(Type::INT_ARRAY, sizeof(*this)
+                                      + this->values.capacity() * sizeof(int64_t));
+    }
+};
+
+typedef std::shared_ptr<IntArrayExpr> IntArrayEptr;
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Runaway recursion must fail with a budget error instead of
+# overflowing the stack, on the main thread, in green threads, on pool
+# workers, and in server requests without taking the server down.
+#
+# Usage: deep-recursion.sh MATIG TESTDIR
+
+matig=$1
+socket=$(mktemp -u /tmp/matig-test.XXXXXX)
+
+echo "(loop 0) (print (down 3000)) (await (spawn (loop 0))) (print (pmap down '(3000 3000)))" \
+    | cat "$2/deep-recursion.l" - \
+    | "$matig" --no-cache --max-steps 100000 -
+
+"$matig" --no-cache --serve "$socket" --workers 2 "$2/deep-recursion.l" &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT
+
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$socket" ] && break
+    sleep 0.1
+done
+
+echo "(loop 0)"                  | "$matig" --connect "$socket"
+echo "(down 3000)"               | "$matig" --connect "$socket"
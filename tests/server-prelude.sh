@@ -0,0 +1,21 @@
+#!/bin/sh
+# Prelude functions that set prelude globals must work under --serve,
+# and the globals they set must stay private to the request.
+#
+# Usage: server-prelude.sh MATIG TESTDIR
+
+matig=$1
+socket=$(mktemp -u /tmp/matig-test.XXXXXX)
+
+"$matig" --no-cache --serve "$socket" --workers 2 "$2/server-prelude.l" &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT
+
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$socket" ] && break
+    sleep 0.1
+done
+
+echo "(bump) (bump) counter"     | "$matig" --connect "$socket"
+echo "counter"                   | "$matig" --connect "$socket"
+echo "(bump-elsewhere)"          | "$matig" --connect "$socket"